@@ -0,0 +1,2 @@
+var xs = [];
+var _ = push(xs);
\ No newline at end of file
@@ -0,0 +1,14 @@
+var empty = [];
+var xs = [1, "two", 3.0, [4, 5], {a: 6}];
+
+xs[0] = add(xs[0], 1);
+xs[3][1] = 7;
+xs[length(xs)] = empty;
+
+var n = push(empty, xs[3][0]);
+
+var i = 0;
+while (less(i, length(xs))) {
+  print(xs[i]);
+  i = add(i, 1);
+}
@@ -0,0 +1,39 @@
+var unused = 1;
+var once = 2;
+print(once);
+
+var classify = function(n) {
+  if (less(n, 0)) {
+    return "negative";
+  } else {
+    if (equal(n, 0)) {
+      return "zero";
+    } else {
+      return "positive";
+    }
+  }
+  print("unreachable");
+};
+
+var counter = function() {
+  var state = {count: 0};
+  return function() {
+    set(state, "count", add(get(state, "count"), 1));
+    return get(state, "count");
+  };
+};
+
+var next = counter();
+var i = 0;
+while (true) {
+  if (greater(next(), 3)) {
+    break;
+  }
+  i = add(i, 1);
+}
+
+while (false) {
+  print("never");
+}
+
+print(classify(i));
@@ -0,0 +1,13 @@
+var o = {items: [1, 2, 3]};
+
+var first = get(o, "items")[0];
+get(o, "items")[1] = first;
+
+var literal = [1, 2][0];
+var nested = [[1, 2], [3, 4]][1][0];
+var call = function() {
+  return [5, 6];
+};
+var called = call()[1];
+
+print(add(first, add(literal, add(nested, called))));
\ No newline at end of file
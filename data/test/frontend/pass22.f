@@ -0,0 +1,20 @@
+var number = function() {
+  var push = 1;
+  return push;
+};
+print(number());
+
+var local = function() {
+  var push = function(xs, x) {
+    return x;
+  };
+  return push([], 2);
+};
+print(local());
+
+var xs = [];
+var builtIn = function() {
+  return push(xs, 3);
+};
+print(builtIn());
+print(push(xs, 4));
\ No newline at end of file
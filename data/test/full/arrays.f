@@ -0,0 +1,74 @@
+var println = function(x) {
+  print(x);
+  print("\n");
+};
+
+var show = function(xs) {
+  var ret = "[";
+  var i = 0;
+
+  while (less(i, length(xs))) {
+    if (greater(i, 0)) {
+      ret = append(ret, ", ");
+    }
+
+    var x = xs[i];
+    if (equal(type(x), "array")) {
+      ret = append(ret, show(x));
+    } else {
+      ret = append(ret, x);
+    }
+
+    i = add(i, 1);
+  }
+
+  return append(ret, "]");
+};
+
+var empty = [];
+println(empty);
+println(length(empty));
+
+var xs = [1, "two", 3.5, [4, 5], true];
+println(xs);
+println(length(xs));
+
+println(xs[0]);
+println(xs[1]);
+println(xs[3][1]);
+println([6, 7][1]);
+
+println(xs[5]);
+println(xs[100]);
+println(xs["one"]);
+println(empty[0]);
+
+xs[0] = add(xs[0], 10);
+xs[3][0] = [8];
+println(show(xs));
+
+println(push(empty, "a"));
+println(push(empty, "b"));
+empty[length(empty)] = "c";
+println(show(empty));
+println(length(empty));
+
+var o = {items: [1, 2, 3]};
+get(o, "items")[2] = 30;
+println(get(o, "items")[2]);
+
+var squares = [];
+var i = 0;
+while (less(i, 5)) {
+  push(squares, multiply(i, i));
+  i = add(i, 1);
+}
+println(show(squares));
+
+var sum = 0;
+i = 0;
+while (less(i, length(squares))) {
+  sum = add(sum, squares[i]);
+  i = add(i, 1);
+}
+println(sum);
\ No newline at end of file
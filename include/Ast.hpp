@@ -16,6 +16,7 @@ statement
   | break statement
   | return statement
   | assign statment
+  | index assign statement
   | block statement
   | expression statement
   ;
@@ -45,6 +46,10 @@ assign statement
   : IDENTIFIER '=' expression ';'
   ;
 
+index assign statement
+  : index expression '=' expression ';'
+  ;
+
 block statement
   : '{' statement* '}'
   ;
@@ -62,6 +67,8 @@ expression
   | function invocation
   | function declaration
   | object declaration
+  | array declaration
+  | index expression
   | built in function invocation
   ;
 
@@ -85,6 +92,16 @@ object declaration
   | '{' IDENTIFIER ':' expression '}'
   | '{' IDENTIFIER ':' expression ( ',' IDENTIFIER ':' expression )* '}'
   ;
+
+array declaration
+  : '[' ']'
+  | '[' expression ( ',' expression )* ']'
+  ;
+
+index expression
+  : IDENTIFIER ( '[' expression ']' )+
+  | function invocation ( '[' expression ']' )+
+  ;
 */
 
 class AstNode {
@@ -205,6 +222,23 @@ public:
   {}
 };
 
+class IndexAssignStatementAstNode : public StatementAstNode {
+public:
+  const std::shared_ptr<ExpressionAstNode> array;
+  const std::shared_ptr<ExpressionAstNode> index;
+  const std::shared_ptr<ExpressionAstNode> expression;
+
+  explicit IndexAssignStatementAstNode(
+    std::shared_ptr<ExpressionAstNode> array,
+    std::shared_ptr<ExpressionAstNode> index,
+    std::shared_ptr<ExpressionAstNode> expression
+  ) noexcept
+  : array{std::move(array)},
+    index{std::move(index)},
+    expression{std::move(expression)}
+  {}
+};
+
 class BlockStatementAstNode : public StatementAstNode {
 public:
   const std::vector<std::shared_ptr<StatementAstNode>> statements;
@@ -306,4 +340,29 @@ public:
   {}
 };
 
+class ArrayDeclarationExpressionAstNode : public ExpressionAstNode {
+public:
+  const std::vector<std::shared_ptr<ExpressionAstNode>> expressions;
+
+  explicit ArrayDeclarationExpressionAstNode(
+    std::vector<std::shared_ptr<ExpressionAstNode>> expressions
+  ) noexcept
+  : expressions{std::move(expressions)}
+  {}
+};
+
+class IndexExpressionAstNode : public ExpressionAstNode {
+public:
+  const std::shared_ptr<ExpressionAstNode> array;
+  const std::shared_ptr<ExpressionAstNode> index;
+
+  explicit IndexExpressionAstNode(
+    std::shared_ptr<ExpressionAstNode> array,
+    std::shared_ptr<ExpressionAstNode> index
+  ) noexcept
+  : array{std::move(array)},
+    index{std::move(index)}
+  {}
+};
+
 #endif
\ No newline at end of file
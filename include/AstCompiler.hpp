@@ -5,14 +5,26 @@
 #include "Ast.hpp"
 #include "AstWalker.hpp"
 #include "ByteCode.hpp"
+#include "PeepholeOptimizer.hpp"
 
 namespace compiler {
 
+struct CompilerOptions {
+  // 0 emits the bytecode as walked, 1 runs the PeepholeOptimizer over every
+  // function
+  std::size_t optimizationLevel = 1;
+};
+
 class AstCompiler {
 private:
+  const CompilerOptions options;
 
 public:
 
+  explicit AstCompiler(CompilerOptions options = CompilerOptions{}) noexcept
+  : options{options}
+  {}
+
   std::shared_ptr<bytecode::CompiledFile> compile(std::shared_ptr<ScriptAstNode> file) noexcept;
 
 };
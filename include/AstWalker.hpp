@@ -18,6 +18,7 @@ public:
   virtual void visitScriptAstNode(ScriptAstNode* node) noexcept;
   virtual void visitDeclareStatementAstNode(DeclareStatementAstNode* node) noexcept;
   virtual void visitAssignStatementAstNode(AssignStatementAstNode* node) noexcept;
+  virtual void visitIndexAssignStatementAstNode(IndexAssignStatementAstNode* node) noexcept;
   virtual void visitIfStatementAstNode(IfStatementAstNode* node) noexcept;
   virtual void visitWhileStatementAstNode(WhileStatementAstNode* node) noexcept;
   virtual void visitBreakStatementAstNode(BreakStatementAstNode* node) noexcept;
@@ -29,12 +30,15 @@ public:
   virtual void visitBuiltInFunctionInvocationExpressionAstNode(BuiltInFunctionInvocationExpressionAstNode* node) noexcept;
   virtual void visitFunctionDeclarationExpressionAstNode(FunctionDeclarationExpressionAstNode* node) noexcept;
   virtual void visitObjectDeclarationExpressionAstNode(ObjectDeclarationExpressionAstNode* node) noexcept;
+  virtual void visitArrayDeclarationExpressionAstNode(ArrayDeclarationExpressionAstNode* node) noexcept;
+  virtual void visitIndexExpressionAstNode(IndexExpressionAstNode* node) noexcept;
   virtual void visitExpressionStatementAstNode(ExpressionStatementAstNode* node) noexcept;
 
   // enter callbacks
   virtual void onEnterScriptAstNode(ScriptAstNode*  /*node*/) noexcept {}
   virtual void onEnterDeclareStatementAstNode(DeclareStatementAstNode*  /*node*/) noexcept {}
   virtual void onEnterAssignStatementAstNode(AssignStatementAstNode* /*node*/) noexcept {}
+  virtual void onEnterIndexAssignStatementAstNode(IndexAssignStatementAstNode* /*node*/) noexcept {}
   virtual void onEnterIfStatementAstNode(IfStatementAstNode*  /*node*/) noexcept {}
   virtual void onEnterWhileStatementAstNode(WhileStatementAstNode*  /*node*/) noexcept {}
   virtual void onEnterBreakStatementAstNode(BreakStatementAstNode*  /*node*/) noexcept {}
@@ -46,12 +50,15 @@ public:
   virtual void onEnterBuiltInFunctionInvocationExpressionAstNode(BuiltInFunctionInvocationExpressionAstNode*  /*node*/) noexcept {}
   virtual void onEnterFunctionDeclarationExpressionAstNode(FunctionDeclarationExpressionAstNode*  /*node*/) noexcept {}
   virtual void onEnterObjectDeclarationExpressionAstNode(ObjectDeclarationExpressionAstNode*  /*node*/) noexcept {}
+  virtual void onEnterArrayDeclarationExpressionAstNode(ArrayDeclarationExpressionAstNode*  /*node*/) noexcept {}
+  virtual void onEnterIndexExpressionAstNode(IndexExpressionAstNode*  /*node*/) noexcept {}
   virtual void onEnterExpressionStatementAstNode(ExpressionStatementAstNode*) noexcept {}
 
   // exit callbacks
   virtual void onExitScriptAstNode(ScriptAstNode*  /*node*/) noexcept {}
   virtual void onExitDeclareStatementAstNode(DeclareStatementAstNode*  /*node*/) noexcept {}
   virtual void onExitAssignStatementAstNode(AssignStatementAstNode* /*node*/) noexcept {}
+  virtual void onExitIndexAssignStatementAstNode(IndexAssignStatementAstNode* /*node*/) noexcept {}
   virtual void onExitIfStatementAstNode(IfStatementAstNode*  /*node*/) noexcept {}
   virtual void onExitWhileStatementAstNode(WhileStatementAstNode*  /*node*/) noexcept {}
   virtual void onExitBreakStatementAstNode(BreakStatementAstNode*  /*node*/) noexcept {}
@@ -63,6 +70,8 @@ public:
   virtual void onExitBuiltInFunctionInvocationExpressionAstNode(BuiltInFunctionInvocationExpressionAstNode*  /*node*/) noexcept {}
   virtual void onExitFunctionDeclarationExpressionAstNode(FunctionDeclarationExpressionAstNode*  /*node*/) noexcept {}
   virtual void onExitObjectDeclarationExpressionAstNode(ObjectDeclarationExpressionAstNode*  /*node*/) noexcept {}
+  virtual void onExitArrayDeclarationExpressionAstNode(ArrayDeclarationExpressionAstNode*  /*node*/) noexcept {}
+  virtual void onExitIndexExpressionAstNode(IndexExpressionAstNode*  /*node*/) noexcept {}
   virtual void onExitExpressionStatementAstNode(ExpressionStatementAstNode*) noexcept {}
 };
 
@@ -48,10 +48,48 @@ enum class ByteCodeInstruction {
   GetEnv, // 1 arg, returns string
   LoadClosure,
   Pop,
+  TailCall, // Invoke reusing the current stack frame, always followed by Return
+  MakeArray, // parameter args, returns array
+  IndexGet, // 2 args
+  IndexSet, // 3 args, returns nothing
+  ArrayPush, // 2 args, returns the new length
+
+  // superinstructions, see FusedOperands
+  AddIntegerToLocal, // local = add(local, integer constant)
+  JumpUnlessLocalLessInteger, // JumpIfFalse on less(local, integer constant)
+  LoadLocalProperty, // get(local, string constant)
+
+  // quickened forms of the arithmetic and comparison instructions for two
+  // integers or two floats, only the vm writes these, see runtime::Prototype
+  AddInt,
+  AddFloat,
+  SubtractInt,
+  SubtractFloat,
+  MultiplyInt,
+  MultiplyFloat,
+  DivideInt,
+  DivideFloat,
+  LessInt,
+  LessFloat,
+  LessOrEqualInt,
+  LessOrEqualFloat,
+  GreaterInt,
+  GreaterFloat,
+  GreaterOrEqualInt,
+  GreaterOrEqualFloat,
 };
 
+// one past the last instruction
+static constexpr std::size_t instructionCount = static_cast<std::size_t>(ByteCodeInstruction::GreaterOrEqualFloat) + 1;
+
+// Changes with the instruction set, their numbering, parameters and stack
+// effects. Code emitted by compiler::CEmitter is only run by a flang_runtime
+// of the same version, see flang_run.
+static constexpr std::uint32_t version = 1;
+
 struct ByteCode {
-  const ByteCodeInstruction instruction;
+  // not const so that the vm can quicken instructions in place
+  ByteCodeInstruction instruction;
   const std::size_t parameter;
 
   explicit ByteCode(
@@ -63,33 +101,65 @@ struct ByteCode {
   {}
 };
 
+// Superinstructions stand for a fixed sequence of plain instructions and
+// pack the operands of that sequence into their parameter, the first two
+// with 16 bits each and the third with the remaining 32. Sequences whose
+// operands do not fit are not fused.
+struct FusedOperands {
+  std::size_t first;
+  std::size_t second;
+  std::size_t third;
+
+  static constexpr std::size_t smallOperandLimit = std::size_t{1} << 16;
+  static constexpr std::size_t largeOperandLimit = std::size_t{1} << 32;
+
+  bool fits() const noexcept {
+    return this->first < smallOperandLimit && this->second < smallOperandLimit && this->third < largeOperandLimit;
+  }
+
+  std::size_t pack() const noexcept {
+    return this->first | (this->second << 16) | (this->third << 32);
+  }
+
+  static FusedOperands Unpack(std::size_t parameter) noexcept {
+    return FusedOperands{parameter & 0xFFFF, (parameter >> 16) & 0xFFFF, parameter >> 32};
+  }
+};
+
+// when isLocal is set the closure captures the local at index of the function
+// creating it, otherwise it shares that function's capture at index
 struct ClosureContext {
-  const std::size_t scopeOffsets;
-  const std::size_t localIndex;
+  const bool isLocal;
+  const std::size_t index;
 
   explicit ClosureContext(
-    std::size_t scopeOffsets,
-    std::size_t localIndex
+    bool isLocal,
+    std::size_t index
   ) noexcept
-  : scopeOffsets{scopeOffsets}
-  , localIndex{localIndex}
+  : isLocal{isLocal}
+  , index{index}
   {}
 };
 
+// maxStack is the most values the function's op stack holds at once, frames
+// reserve room for them up front
 struct Function {
   const std::size_t argumentCount;
   const std::size_t localsCount;
+  const std::size_t maxStack;
   const std::vector<ClosureContext> closures;
   const std::vector<ByteCode> byteCode;
 
   explicit Function(
     std::size_t argumentCount,
     std::size_t localsCount,
+    std::size_t maxStack,
     std::vector<ClosureContext> closures,
     std::vector<ByteCode> byteCode
   ) noexcept
   : argumentCount{argumentCount}
   , localsCount{localsCount}
+  , maxStack{maxStack}
   , closures{std::move(closures)}
   , byteCode{std::move(byteCode)}
   {}
@@ -105,6 +175,109 @@ struct ObjectConstructor {
   {}
 };
 
+// how many values an instruction takes off the op stack and puts back, the
+// object constructor of a MakeObj has to exist
+struct StackEffect {
+  std::size_t pops;
+  std::size_t pushes;
+};
+
+inline StackEffect stackEffect(const std::vector<ObjectConstructor>& objects, ByteCode bc) noexcept {
+  switch (bc.instruction) {
+    case ByteCodeInstruction::Halt:
+    case ByteCodeInstruction::Jump:
+    case ByteCodeInstruction::NoOp:
+    case ByteCodeInstruction::AddIntegerToLocal:
+    case ByteCodeInstruction::JumpUnlessLocalLessInteger: {
+      return StackEffect{0, 0};
+    }
+    case ByteCodeInstruction::Read:
+    case ByteCodeInstruction::LoadIntegerConstant:
+    case ByteCodeInstruction::LoadFloatConstant:
+    case ByteCodeInstruction::LoadStringConstant:
+    case ByteCodeInstruction::LoadUndefinedConstant:
+    case ByteCodeInstruction::LoadBooleanTrueConstant:
+    case ByteCodeInstruction::LoadBooleanFalseConstant:
+    case ByteCodeInstruction::LoadLocal:
+    case ByteCodeInstruction::LoadClosure:
+    case ByteCodeInstruction::MakeFn:
+    case ByteCodeInstruction::LoadLocalProperty: {
+      return StackEffect{0, 1};
+    }
+    case ByteCodeInstruction::JumpIfFalse:
+    case ByteCodeInstruction::SetLocal:
+    case ByteCodeInstruction::Pop: {
+      return StackEffect{1, 0};
+    }
+    case ByteCodeInstruction::Print:
+    case ByteCodeInstruction::Not:
+    case ByteCodeInstruction::GetType:
+    case ByteCodeInstruction::CastToInt:
+    case ByteCodeInstruction::CastToFloat:
+    case ByteCodeInstruction::Length:
+    case ByteCodeInstruction::GetEnv: {
+      return StackEffect{1, 1};
+    }
+    case ByteCodeInstruction::Add:
+    case ByteCodeInstruction::Subtract:
+    case ByteCodeInstruction::Multiply:
+    case ByteCodeInstruction::Divide:
+    case ByteCodeInstruction::Less:
+    case ByteCodeInstruction::LessOrEqual:
+    case ByteCodeInstruction::Greater:
+    case ByteCodeInstruction::GreaterOrEqual:
+    case ByteCodeInstruction::Equal:
+    case ByteCodeInstruction::NotEqual:
+    case ByteCodeInstruction::And:
+    case ByteCodeInstruction::Or:
+    case ByteCodeInstruction::ChatAt:
+    case ByteCodeInstruction::StringAppend:
+    case ByteCodeInstruction::ObjectGet:
+    case ByteCodeInstruction::IndexGet:
+    case ByteCodeInstruction::ArrayPush:
+    case ByteCodeInstruction::AddInt:
+    case ByteCodeInstruction::AddFloat:
+    case ByteCodeInstruction::SubtractInt:
+    case ByteCodeInstruction::SubtractFloat:
+    case ByteCodeInstruction::MultiplyInt:
+    case ByteCodeInstruction::MultiplyFloat:
+    case ByteCodeInstruction::DivideInt:
+    case ByteCodeInstruction::DivideFloat:
+    case ByteCodeInstruction::LessInt:
+    case ByteCodeInstruction::LessFloat:
+    case ByteCodeInstruction::LessOrEqualInt:
+    case ByteCodeInstruction::LessOrEqualFloat:
+    case ByteCodeInstruction::GreaterInt:
+    case ByteCodeInstruction::GreaterFloat:
+    case ByteCodeInstruction::GreaterOrEqualInt:
+    case ByteCodeInstruction::GreaterOrEqualFloat: {
+      return StackEffect{2, 1};
+    }
+    case ByteCodeInstruction::ObjectSet: {
+      return StackEffect{3, 1};
+    }
+    case ByteCodeInstruction::IndexSet: {
+      return StackEffect{3, 0};
+    }
+    case ByteCodeInstruction::Return: {
+      // the value is pushed onto the caller's op stack
+      return StackEffect{1, 0};
+    }
+    case ByteCodeInstruction::Invoke:
+    case ByteCodeInstruction::TailCall: {
+      return StackEffect{bc.parameter + 1, 1};
+    }
+    case ByteCodeInstruction::MakeObj: {
+      return StackEffect{objects[bc.parameter].keys.size(), 1};
+    }
+    case ByteCodeInstruction::MakeArray: {
+      return StackEffect{bc.parameter, 1};
+    }
+  }
+
+  return StackEffect{0, 0};
+}
+
 struct CompiledFile {
 
   const Function entrypoint;
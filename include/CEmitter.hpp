@@ -0,0 +1,25 @@
+#ifndef C_EMITTER_HPP
+#define C_EMITTER_HPP
+
+#include "lib.hpp"
+#include "ByteCode.hpp"
+
+namespace compiler {
+
+// Lowers a compiled file to a C translation unit with a main function, to be
+// linked against the flang_runtime library, see flang.h. The file's bytecode
+// is kept as data for the vm, and each function becomes C code with the jumps
+// between instructions compiled to gotos. With NaN-boxing, locals, constants,
+// arithmetic, comparisons and branches on integers, floats and booleans run
+// inline behind type checks, and everything else, like calls, allocation and
+// property access, calls back into the vm. The file has to pass the verifier.
+class CEmitter {
+public:
+
+  void emit(const bytecode::CompiledFile& file, std::ostream& out) noexcept;
+
+};
+
+}
+
+#endif
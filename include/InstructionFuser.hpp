@@ -0,0 +1,21 @@
+#ifndef INSTRUCTION_FUSER_HPP
+#define INSTRUCTION_FUSER_HPP
+
+#include "lib.hpp"
+#include "ByteCode.hpp"
+
+namespace compiler {
+
+// Rewrites the hot instruction sequences the compiler emits into
+// superinstructions, see bytecode::FusedOperands. A sequence is only fused
+// when no jump lands inside of it.
+class InstructionFuser {
+public:
+
+  std::shared_ptr<bytecode::CompiledFile> fuse(const bytecode::CompiledFile& file) noexcept;
+
+};
+
+}
+
+#endif
@@ -10,23 +10,40 @@
 #include "Parser.hpp"
 #include "SemanticAnalyzer.hpp"
 #include "AstCompiler.hpp"
+#include "InstructionFuser.hpp"
+#include "Verifier.hpp"
+#include "CEmitter.hpp"
 #include "Runtime.hpp"
 
 namespace interpreter {
 
 class Interpreter {
 private:
+  const compiler::CompilerOptions compilerOptions;
+  const runtime::GcOptions gcOptions;
+  const runtime::StackOptions stackOptions;
+  const runtime::JitOptions jitOptions;
+  // where to write the type profile, none when not profiling
+  const std::optional<std::string> profilePath;
   std::ostream & out;
   std::istream & in;
 
 public:
 
-  explicit Interpreter(std::ostream & out, std::istream & in) noexcept
-  : out{out}
+  explicit Interpreter(compiler::CompilerOptions compilerOptions, runtime::GcOptions gcOptions, runtime::StackOptions stackOptions, runtime::JitOptions jitOptions, std::optional<std::string> profilePath, std::ostream & out, std::istream & in) noexcept
+  : compilerOptions{compilerOptions}
+  , gcOptions{gcOptions}
+  , stackOptions{stackOptions}
+  , jitOptions{jitOptions}
+  , profilePath{std::move(profilePath)}
+  , out{out}
   , in{in}
   {}
 
   void Run(const std::string & data);
+
+  // writes the compiled script to path as C, see compiler::CEmitter
+  void EmitC(const std::string & data, const std::string & path);
 };
 
 }
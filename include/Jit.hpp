@@ -0,0 +1,201 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include "lib.hpp"
+#include "ByteCode.hpp"
+#include "flang.h"
+
+// The baseline compiler emits x86-64 machine code for the System V calling
+// convention, anywhere else functions are never compiled and keep running in
+// the interpreter. Build with -DFLANG_JIT=0 to leave it out.
+#ifndef FLANG_JIT
+#if defined(__x86_64__) && defined(__linux__)
+#define FLANG_JIT 1
+#else
+#define FLANG_JIT 0
+#endif
+#endif
+
+namespace runtime {
+
+class VirtualMachine;
+
+}
+
+namespace jit {
+
+// Runs one instruction of the function on top of the vm's call stack and
+// returns the program counter it left behind.
+using Helper = std::size_t (*)(runtime::VirtualMachine* vm);
+
+// a helper for each bytecode::ByteCodeInstruction, null for those the
+// interpreter has to run itself
+using Helpers = std::array<Helper, bytecode::instructionCount>;
+
+// Code compiled ahead of time for one bytecode::Function, see
+// compiler::CEmitter. The vm is passed as the flang_vm of flang.h.
+using Precompiled = flang_code;
+
+struct TraceState;
+
+// Machine code for one bytecode::Function, held in its own executable
+// mapping.
+class NativeCode {
+private:
+  void* memory;
+  std::size_t size;
+  // where the code of each instruction starts
+  std::vector<std::uint32_t> offsets;
+
+public:
+  explicit NativeCode(void* memory, std::size_t size, std::vector<std::uint32_t> offsets) noexcept;
+
+  NativeCode(const NativeCode&) = delete;
+
+  NativeCode& operator=(const NativeCode&) = delete;
+
+  virtual ~NativeCode();
+
+  // Runs the function from the state's program counter until it calls,
+  // returns or reaches an instruction without a helper. Returns false in the
+  // last case, the instruction at the state's program counter is then left
+  // to the interpreter.
+  bool run(runtime::VirtualMachine* vm, TraceState* state) const noexcept;
+};
+
+// What the trace recorder saw of an operand. Integers are only marked when
+// they fit into a Variable without being boxed.
+enum class TraceType : std::uint8_t {
+  Other,
+  Integer,
+  Float,
+  Boolean,
+};
+
+// One instruction of a recorded loop iteration.
+struct TraceStep {
+  bytecode::ByteCodeInstruction instruction;
+  std::size_t parameter;
+  std::size_t programCounter;
+  // where the recording went on to, in the callee after an Invoke and in the
+  // caller after a Return
+  std::size_t nextProgramCounter;
+  // values on the op stack of the instruction's function before it ran
+  std::size_t stackDepth;
+  // the two operands of arithmetic and comparisons, the condition of
+  // JumpIfFalse and the local of superinstructions come first
+  std::array<TraceType, 2> operands;
+  // the Variable bits of a loaded constant, or the integer constant of a
+  // superinstruction
+  std::uint64_t constant;
+  // the prototype of the function an Invoke called, null when it called
+  // anything else
+  const void* callee;
+};
+
+// How Variables are packed into 64 bits, see runtime::Variable. Traces are
+// only compiled when Variables are NaN-boxed.
+struct ValueEncoding {
+  // the top 16 bits of inline integers
+  std::uint64_t integerTag;
+  // doubles have top 16 bits up to this one
+  std::uint64_t lastFloatTag;
+  // what NaNs with a payload colliding with a tag become
+  std::uint64_t canonicalNan;
+  std::uint64_t trueBits;
+  std::uint64_t falseBits;
+  std::uint64_t undefinedBits;
+};
+
+// Where running native code keeps the vm's registers, the vm copies them back
+// in and out around every helper the code calls.
+struct TraceState {
+  std::uint64_t* locals;
+  // op stack base of the current frame
+  std::uint64_t* stack;
+  std::uint64_t* stackTop;
+  std::size_t programCounter;
+  // the function the next Invoke has to call to stay on the trace
+  const void* callee;
+};
+
+// Runs helper for the instruction at the state's program counter and returns
+// the program counter it left behind.
+using TraceCall = std::size_t (*)(runtime::VirtualMachine* vm, Helper helper);
+
+// What native code calls back into, the baseline compiler only uses call and
+// instructions.
+struct TraceHelpers {
+  TraceCall call;
+  // instructions the code does not compile itself
+  const Helpers* instructions;
+  // an Invoke which leaves the vm as it was when the callee is not the
+  // state's callee
+  Helper invoke;
+  // the collection point of the loop's back edge
+  Helper backEdge;
+};
+
+// Machine code for one recorded loop, entered at the loop header.
+class NativeTrace {
+private:
+  void* memory;
+  std::size_t size;
+
+public:
+  explicit NativeTrace(void* memory, std::size_t size) noexcept;
+
+  NativeTrace(const NativeTrace&) = delete;
+
+  NativeTrace& operator=(const NativeTrace&) = delete;
+
+  virtual ~NativeTrace();
+
+  // Runs the loop until a guard fails, state then holds where the
+  // interpreter goes on.
+  void run(runtime::VirtualMachine* vm, TraceState* state) const noexcept;
+};
+
+// Compiles a recorded loop iteration into a native loop. Arithmetic and
+// comparisons on the operand types seen while recording, loads, stores and
+// branches run as machine code after guards on the types and on the
+// direction each branch took, anything else calls its helper and checks that
+// it went where the recording did. Values stay in their locals and constants
+// until a helper or a side exit needs the op stack written out, and every
+// side exit leaves the vm before the instruction whose guard failed.
+class TraceCompiler {
+public:
+
+  // null when the trace can not be compiled on this platform
+  std::unique_ptr<NativeTrace> compile(
+    const std::vector<TraceStep>& steps,
+    const TraceHelpers& helpers,
+    const ValueEncoding& encoding
+  ) noexcept;
+
+};
+
+// Compiles each instruction of a function to a template of machine code.
+// Loads, stores, constants, forward branches and integer arithmetic and
+// comparisons run inline behind checks of their operands' tags, anything
+// else, and any operand the templates do not handle, calls its helper.
+// Without NaN-boxing every instruction but forward jumps calls its helper.
+// The generated code leaves after every Invoke, TailCall and Return so that
+// the caller decides how the next function runs.
+class Compiler {
+public:
+
+  // null when the function can not be compiled on this platform, encoding is
+  // null when Variables are not NaN-boxed
+  std::unique_ptr<NativeCode> compile(
+    const bytecode::CompiledFile& file,
+    const std::vector<bytecode::ByteCode>& byteCode,
+    const TraceHelpers& helpers,
+    const ValueEncoding* encoding
+  ) noexcept;
+
+};
+
+}
+
+#endif
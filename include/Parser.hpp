@@ -46,9 +46,6 @@ public:
   const std::optional<std::shared_ptr<BlockStatementAstNode>>
   parseBlockStatement() noexcept;
 
-  const std::optional<std::shared_ptr<ExpressionStatementAstNode>>
-  parseExpressionStatement() noexcept;
-
   const std::optional<std::shared_ptr<ExpressionAstNode>>
   parseExpression() noexcept;
 
@@ -64,12 +61,21 @@ public:
   const std::optional<std::shared_ptr<ObjectDeclarationExpressionAstNode>>
   parseObjectDeclarationExpression() noexcept;
 
+  const std::optional<std::shared_ptr<ArrayDeclarationExpressionAstNode>>
+  parseArrayDeclarationExpression() noexcept;
+
   const std::optional<std::shared_ptr<ExpressionAstNode>>
   parseIdentifierOrFunctionInvocationExpression() noexcept;
 
+  const std::optional<std::shared_ptr<ExpressionAstNode>>
+  parseIndexExpression(std::shared_ptr<ExpressionAstNode> array) noexcept;
+
   const std::optional<std::shared_ptr<StatementAstNode>>
   parseAssignOrExpressionStatement() noexcept;
 
+  const std::optional<std::shared_ptr<StatementAstNode>>
+  parseIndexAssignOrExpressionStatement() noexcept;
+
   const std::optional<std::shared_ptr<FunctionInvocationExpressionAstNode>>
   parseFunctionInvocationExpression() noexcept;
 
@@ -0,0 +1,27 @@
+#ifndef PEEPHOLE_OPTIMIZER_HPP
+#define PEEPHOLE_OPTIMIZER_HPP
+
+#include "lib.hpp"
+#include "ByteCode.hpp"
+
+namespace compiler {
+
+// Cleans up the bytecode the compiler emits for one function: jumps to jumps
+// are threaded, unreachable instructions are dropped, values pushed only to
+// be popped again are never pushed, and stores to locals nothing else reads
+// are skipped. Runs again until nothing changes. The functions and objects
+// are the ones compiled so far, which fn may refer to.
+class PeepholeOptimizer {
+public:
+
+  bytecode::Function optimize(
+    const std::vector<bytecode::Function>& functions,
+    const std::vector<bytecode::ObjectConstructor>& objects,
+    const bytecode::Function& fn
+  ) noexcept;
+
+};
+
+}
+
+#endif
@@ -3,6 +3,8 @@
 
 #include "lib.hpp"
 #include "ByteCode.hpp"
+#include "Verifier.hpp"
+#include "Jit.hpp"
 
 namespace runtime {
 
@@ -10,23 +12,120 @@ struct StackFrame;
 
 struct Variable;
 
-struct ClosureContext;
+struct Upvalue;
 
 struct Function;
 
 struct Object;
 
+struct Array;
+
+struct Shape;
+
+struct ConstructorShape;
+
+struct InlineCache;
+
+struct Prototype;
+
+struct String;
+
+struct BoxedInteger;
+
+struct Rope;
+
+struct HeapObject;
+
+enum class HeapObjectType;
+
 class VirtualMachine;
 
+class Heap;
+
+struct GcOptions {
+  // size in bytes of the nursery young objects are bump allocated in
+  std::size_t nurserySize = 1 << 21;
+
+  // number of live old objects at which the first major collection happens
+  std::size_t initialThreshold = 1 << 16;
+  // after a collection the next one happens once the heap has grown to this
+  // many times the objects that survived
+  double growthFactor = 2.0;
+};
+
+struct StackOptions {
+  // calls nested deeper than this panic, the stacks grow on demand up to it
+  std::size_t maxFrames = 1 << 22;
+};
+
+struct JitOptions {
+  // run functions as native code, see jit::Compiler
+  bool isEnabled = false;
+
+  // calls of a function before it is compiled, 0 leaves functions to the
+  // interpreter
+  std::size_t threshold = 1;
+
+  // back edges of a loop before an iteration of it is recorded and compiled,
+  // see jit::TraceCompiler, 0 leaves loops to the baseline compiler
+  std::size_t traceThreshold = 64;
+
+  // code for each function of the file followed by the entrypoint, which runs
+  // instead of the interpreter when the file verifies, see flang_run
+  const jit::Precompiled* precompiled = nullptr;
+};
+
+// Memory resource handing out nursery memory to the containers of young
+// objects. Nothing is freed individually, the whole nursery is released by
+// each minor collection.
+class NurseryResource : public std::pmr::memory_resource {
+private:
+  runtime::Heap* heap;
+
+public:
+  explicit NurseryResource(runtime::Heap* heap) noexcept;
+
+protected:
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+
+  void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+};
+
+struct NurseryOverflow {
+  void* memory;
+  std::size_t bytes;
+  std::size_t alignment;
+};
+
 class Heap {
 private:
-  std::list<std::string*> createdStrings;
-  std::list<runtime::Function*> createdFunctions;
-  std::list<runtime::Object*> createdObjects;
+  friend class NurseryResource;
+
+  runtime::VirtualMachine* vm;
+  const runtime::GcOptions options;
+
+  runtime::HeapObject* objects;
+  std::size_t objectCount;
+  std::size_t nextCollection;
+  bool isCollecting;
+
+  std::vector<runtime::HeapObject*> grayObjects;
+
+  std::unique_ptr<char[]> nursery;
+  char* nurseryTop;
+  char* nurseryEnd;
+  bool isNurseryExhausted;
+  runtime::NurseryResource nurseryResource;
+  std::vector<runtime::NurseryOverflow> nurseryOverflow;
+
+  std::vector<runtime::HeapObject*> rememberedObjects;
+  std::vector<runtime::HeapObject*> promotedObjects;
 
 public:
 
-  explicit Heap(runtime::VirtualMachine*) noexcept;
+  explicit Heap(runtime::VirtualMachine* vm, runtime::GcOptions options) noexcept;
 
   virtual ~Heap() noexcept;
 
@@ -34,48 +133,216 @@ public:
 
   void EndGc() noexcept;
 
-  std::string* NewString() noexcept;
+  bool ShouldCollect() const noexcept;
+
+  void Collect() noexcept;
+
+  void MarkVariable(runtime::Variable var) noexcept;
+
+  void MarkObject(runtime::HeapObject* object) noexcept;
+
+  void WriteBarrier(runtime::HeapObject* owner, runtime::Variable value) noexcept;
+
+  void WriteBarrier(runtime::HeapObject* owner, runtime::HeapObject* value) noexcept;
+
+  void ForwardVariable(runtime::Variable& var) noexcept;
+
+  template<typename T>
+  void ForwardReference(T*& reference) noexcept;
+
+  runtime::String* NewString() noexcept;
+
+  runtime::String* NewOldString() noexcept;
 
   runtime::Function* NewFunction() noexcept;
 
   runtime::Object* NewObject() noexcept;
 
+  runtime::Array* NewArray() noexcept;
+
+  runtime::Upvalue* NewUpvalue() noexcept;
+
+  runtime::Rope* NewRope() noexcept;
+
+  runtime::BoxedInteger* NewBoxedInteger() noexcept;
+
+private:
+  template<typename T>
+  T* allocate(runtime::HeapObjectType type) noexcept;
+
+  template<typename T>
+  T* allocateOld(runtime::HeapObjectType type) noexcept;
+
+  void* allocateYoung(std::size_t bytes, std::size_t alignment) noexcept;
+
+  void linkOldObject(runtime::HeapObject* object, runtime::HeapObjectType type) noexcept;
+
+  runtime::HeapObject* promote(runtime::HeapObject* object) noexcept;
+
+  void forwardReferences(runtime::HeapObject* object) noexcept;
+
+  void minorCollection() noexcept;
+
+  void majorCollection() noexcept;
+
+  void releaseNursery() noexcept;
+
+  void traceReferences() noexcept;
+
+  void sweep() noexcept;
+
+  void freeObject(runtime::HeapObject* object) noexcept;
+
 };
 
 class VirtualMachine {
 private:
   const std::shared_ptr<const bytecode::CompiledFile> file;
-  std::shared_ptr<StackFrame> stackFrame;
+
+  std::unique_ptr<Variable[]> valueStack;
+  Variable* stackTop;
+  Variable* stackEnd;
+
+  std::unique_ptr<StackFrame[]> frames;
+  StackFrame* stackFrame;
+  StackFrame* framesEnd;
+  const std::size_t maxStackFrames;
+
+  Upvalue* openUpvalues;
+
+  std::vector<runtime::String*> stringConstants;
+
+  std::array<runtime::String*, 256> characterStrings{};
+
+  std::array<runtime::String*, 8> typeNameStrings{};
+
+  // interned strings keyed by their own contents, the collector removes
+  // strings as they die
+  std::unordered_map<std::string_view, runtime::String*> internTable;
+
+  std::vector<std::unique_ptr<runtime::Shape>> shapes;
+  std::vector<runtime::ConstructorShape> constructorShapes;
+  std::vector<runtime::Prototype> prototypes;
 
   Heap heap;
 
   std::ostream & out;
   std::istream & in;
+
+  // output of print is collected here and written to out when the buffer
+  // fills, before reading input, and when the program ends
+  std::unique_ptr<char[]> outputBuffer;
+  char* outputTop;
+  char* outputEnd;
+
+  // input read ahead for read(), lines are split out of inputTop up to
+  // inputEnd and the buffer is refilled a block at a time
+  std::unique_ptr<char[]> inputBuffer;
+  char* inputTop;
+  char* inputEnd;
+
+  const JitOptions jitOptions;
+  // what native code calls for each instruction, only set up when isJit
+  jit::Helpers nativeHelpers;
+
+  // where the type profile is written as JSON at the end of the program, null
+  // when not profiling
+  std::ostream* profile;
+
+  // what traces call for the instructions they do not compile, only set up
+  // when isTracing
+  jit::TraceHelpers traceHelpers;
+  jit::ValueEncoding valueEncoding;
+  // the state of the running trace
+  jit::TraceState* traceState;
+
+  // the loop iteration being recorded, see recordStep
+  std::vector<jit::TraceStep> traceSteps;
+  runtime::Prototype* tracePrototype;
+  runtime::StackFrame* traceFrame;
+  runtime::StackFrame* traceLastFrame;
+  std::size_t traceHeader;
+
   bool isPanicing;
   bool isDebug;
+  bool isVerified;
+  bool isJit;
+  // functions are compiled or were precompiled, see runNative
+  bool hasNativeFunctions;
+  bool isProfiling;
+  bool isTracing;
+  bool isRecording;
 
 public:
   explicit VirtualMachine(
     bool isDebug,
+    runtime::GcOptions gcOptions,
+    runtime::StackOptions stackOptions,
+    runtime::JitOptions jitOptions,
+    std::ostream* profile,
     std::ostream & out,
     std::istream & in,
     std::shared_ptr<const bytecode::CompiledFile> file
-  ) noexcept
-  : file{std::move(file)}
-  , stackFrame{nullptr}
-  , heap{this}
-  , out{out}
-  , in{in}
-  , isPanicing{false}
-  , isDebug{isDebug}
-  {}
-
-  virtual ~VirtualMachine() = default;
+  ) noexcept;
+
+  virtual ~VirtualMachine();
 
   void run() noexcept;
 
 private:
-  void pushStackFrame(const runtime::Function* function);
+  friend class Heap;
+
+  friend void ::flang_enter(flang_vm* vm, flang_frame* frame);
+  friend std::size_t ::flang_call(flang_vm* vm, flang_frame* frame, std::size_t programCounter, std::size_t depth);
+  friend void ::flang_leave(flang_vm* vm, std::size_t programCounter, std::size_t depth);
+
+  void collectGarbageIfNeeded();
+
+  void markRoots();
+
+  void forwardRoots();
+
+  bytecode::ByteCodeInstruction fetchInstruction();
+
+  void checkInstruction();
+
+  void debugStep();
+
+  void runNative();
+
+  void profileStep();
+
+  void writeProfile();
+
+  static jit::Helpers makeNativeHelpers();
+
+  template <void (VirtualMachine::*handler)()>
+  static std::size_t callFromNative(VirtualMachine* vm) noexcept;
+
+  static std::size_t jumpFromNative(VirtualMachine* vm) noexcept;
+
+  bool traceLoop(std::size_t header);
+
+  void recordStep();
+
+  void finishTrace();
+
+  void abortTrace();
+
+  static std::size_t callFromTrace(VirtualMachine* vm, jit::Helper helper) noexcept;
+
+  static std::size_t invokeFromTrace(VirtualMachine* vm) noexcept;
+
+  static std::size_t backEdgeFromTrace(VirtualMachine* vm) noexcept;
+
+  void pushStackFrame(const runtime::Function* function, Variable* locals, std::size_t argumentCount);
+
+  // doubles the frames up to maxStackFrames, moving the pointers to them along
+  void growFrames();
+
+  // grows the value stack to hold at least size values, moving the pointers
+  // into it along
+  void growValueStack(std::size_t size);
 
   void popStackFrame();
 
@@ -86,6 +353,10 @@ private:
 
   void pushOpStack(Variable v);
 
+  runtime::Upvalue* captureUpvalue(Variable* local);
+
+  void closeUpvalues(Variable* last);
+
   void Add();
 
   void Subtract();
@@ -102,6 +373,8 @@ private:
 
   void JumpIfFalse();
 
+  void jumpTo(std::size_t target);
+
   void LoadIntegerConstant();
 
   void LoadFloatConstant();
@@ -124,10 +397,14 @@ private:
 
   void Invoke();
 
+  void TailCall();
+
   void MakeFn();
 
   void MakeObj();
 
+  void MakeArray();
+
   void Less();
 
   void LessOrEqual();
@@ -160,30 +437,96 @@ private:
 
   void ObjectGet();
 
+  Variable objectGet(Variable first, Variable second);
+
+  void AddIntegerToLocal();
+
+  void JumpUnlessLocalLessInteger();
+
+  void LoadLocalProperty();
+
+  void AddInt();
+
+  void AddFloat();
+
+  void SubtractInt();
+
+  void SubtractFloat();
+
+  void MultiplyInt();
+
+  void MultiplyFloat();
+
+  void DivideInt();
+
+  void DivideFloat();
+
+  void LessInt();
+
+  void LessFloat();
+
+  void LessOrEqualInt();
+
+  void LessOrEqualFloat();
+
+  void GreaterInt();
+
+  void GreaterFloat();
+
+  void GreaterOrEqualInt();
+
+  void GreaterOrEqualFloat();
+
+  void quicken(Variable first, Variable second, bytecode::ByteCodeInstruction integer, bytecode::ByteCodeInstruction floating);
+
+  void despecialize(Variable first, Variable second, bytecode::ByteCodeInstruction generic);
+
   void ObjectSet();
 
+  void IndexGet();
+
+  void IndexSet();
+
+  void ArrayPush();
+
   void GetEnv();
 
   void Pop();
 
   bool protectDifferentTypes(Variable v1, Variable v2);
 
+  void flushOutput();
+
+  void writeOutput(std::string_view text);
+
+  void writeInteger(std::int64_t val);
+
+  void writeFloat(double val);
+
+  bool fillInput();
+
   void pushUndefined();
 
   void pushInteger(std::int64_t val);
 
+  Variable makeInteger(std::int64_t val);
+
   void pushFloat(double val);
 
   void pushBoolean(bool val);
 
-  void pushString(const std::string* str);
+  void pushString(runtime::String* str);
 
   void pushFunction(runtime::Function* fn);
 
   void pushObject(runtime::Object* obj);
 
+  void pushArray(runtime::Array* arr);
+
   std::size_t getByteCodeParameter();
 
+  runtime::String* appendOperand(Variable var);
+
   std::string variableToString(Variable var, bool panic);
 
   std::string byteCodeToString(bytecode::ByteCode bc, bool panic);
@@ -198,9 +541,29 @@ private:
 
   void advance();
 
-  runtime::ClosureContext loadClosure(const bytecode::ClosureContext& closure);
+  runtime::Upvalue* loadClosure(const bytecode::ClosureContext& closure);
 
   runtime::Variable loadClosureValue(const runtime::Function* fn, std::size_t index);
+
+  runtime::String* intern(std::string_view value);
+
+  runtime::String* intern(runtime::String* str);
+
+  void forgetInterned(runtime::String* str);
+
+  runtime::Shape* newShape(runtime::Shape* parent, runtime::String* key);
+
+  runtime::Shape* shapeTransition(runtime::Shape* shape, runtime::String* key);
+
+  void makeDictionary(runtime::Object* obj);
+
+  const runtime::Variable* findProperty(const runtime::Object* obj, runtime::String* key);
+
+  void setProperty(runtime::Object* obj, runtime::String* key, runtime::Variable value);
+
+  std::size_t propertyCount(const runtime::Object* obj);
+
+  runtime::InlineCache& inlineCache();
 };
 
 }
@@ -0,0 +1,42 @@
+#ifndef VERIFIER_HPP
+#define VERIFIER_HPP
+
+#include "lib.hpp"
+#include "ByteCode.hpp"
+
+namespace verifier {
+
+// Checks that the instruction at programCounter of fn only refers to
+// constants, locals, captures, functions and instructions which exist and
+// that depth values on the op stack are enough for it. Returns why not.
+std::optional<std::string> checkInstruction(
+  const bytecode::CompiledFile& file,
+  const bytecode::Function& fn,
+  bool isEntrypoint,
+  std::size_t programCounter,
+  std::size_t depth
+) noexcept;
+
+// Proves for every function of a compiled file that each reachable
+// instruction passes checkInstruction, that every path through the function
+// sees the same op stack depth at each instruction and ends in a Halt or a
+// Return, and that the op stack never holds more than the function's
+// maxStack.
+class Verifier {
+public:
+  // why isValid returned false
+  std::string error;
+
+  explicit Verifier() noexcept = default;
+
+  virtual ~Verifier() = default;
+
+  bool isValid(const bytecode::CompiledFile& file) noexcept;
+
+private:
+  bool isValidFunction(const bytecode::CompiledFile& file, const bytecode::Function& fn, bool isEntrypoint) noexcept;
+};
+
+}
+
+#endif // VERIFIER_HPP
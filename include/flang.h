@@ -0,0 +1,312 @@
+#ifndef FLANG_H
+#define FLANG_H
+
+// The interface between C code emitted by compiler::CEmitter and the
+// flang_runtime library it links against. It is plain C so that the system C
+// compiler can build the emitted code.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Changes whenever this file changes in a way which breaks programs built
+// against an older copy of it, flang_run refuses programs built for another
+// version.
+#define FLANG_ABI_VERSION 1
+
+// Values are packed into 64 bits when the platform's pointers fit into 48
+// bits, build with -DFLANG_NAN_BOXING=0 to use a tagged union instead, see
+// runtime::Variable.
+#ifndef FLANG_NAN_BOXING
+#if defined(__x86_64__) || defined(__aarch64__)
+#define FLANG_NAN_BOXING 1
+#else
+#define FLANG_NAN_BOXING 0
+#endif
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// the runtime::VirtualMachine running the program
+typedef struct flang_vm flang_vm;
+
+// The bits of a runtime::Variable when values are NaN-boxed. Doubles are
+// stored as themselves, every other value is a negative NaN with the tag in
+// the top 16 bits and the payload in the low 48 bits.
+typedef uint64_t flang_value;
+
+// Where the function on top of the vm's call stack keeps its locals and the
+// bottom of its op stack, only set when values are NaN-boxed.
+typedef struct flang_frame {
+  flang_value* locals;
+  flang_value* stack;
+} flang_frame;
+
+// Runs a function from program_counter until it calls, returns or reaches an
+// instruction it leaves to the interpreter, like jit::NativeCode::run.
+// Returns 1 in the last case, the vm then runs the instruction at its program
+// counter, and 0 otherwise.
+typedef int (*flang_code)(flang_vm* vm, size_t program_counter);
+
+// Fills frame in for the function on top of the vm's call stack.
+void flang_enter(flang_vm* vm, flang_frame* frame);
+
+// Runs the instruction at program_counter of the function on top of the vm's
+// call stack, which has depth values on its op stack, and fills frame in
+// again afterwards since the stack may have moved. Returns the program counter
+// the instruction left behind.
+size_t flang_call(flang_vm* vm, flang_frame* frame, size_t program_counter, size_t depth);
+
+// Leaves the instruction at program_counter to the interpreter, with depth
+// values on the op stack.
+void flang_leave(flang_vm* vm, size_t program_counter, size_t depth);
+
+// see bytecode::ClosureContext
+typedef struct flang_closure {
+  int is_local;
+  size_t index;
+} flang_closure;
+
+// see bytecode::ByteCode
+typedef struct flang_instruction {
+  uint32_t instruction;
+  size_t parameter;
+} flang_instruction;
+
+// see bytecode::Function, native runs its instructions
+typedef struct flang_function {
+  size_t argument_count;
+  size_t locals_count;
+  size_t max_stack;
+  const flang_closure* closures;
+  size_t closure_count;
+  const flang_instruction* code;
+  size_t code_count;
+  flang_code native;
+} flang_function;
+
+// strings may hold zero bytes
+typedef struct flang_string {
+  const char* data;
+  size_t size;
+} flang_string;
+
+// see bytecode::ObjectConstructor
+typedef struct flang_object {
+  const flang_string* keys;
+  size_t key_count;
+} flang_object;
+
+// see bytecode::CompiledFile
+typedef struct flang_program {
+  // FLANG_ABI_VERSION of the flang.h the program was built with
+  uint32_t abi_version;
+  // bytecode::version of the flang which emitted the program
+  uint32_t bytecode_version;
+  // whether the code works on NaN-boxed values itself, which only a runtime
+  // built with FLANG_NAN_BOXING can run
+  int is_nan_boxed;
+  flang_function entrypoint;
+  const flang_function* functions;
+  size_t function_count;
+  const flang_object* objects;
+  size_t object_count;
+  const int64_t* int_constants;
+  size_t int_constant_count;
+  // the bits of each double
+  const uint64_t* float_constants;
+  size_t float_constant_count;
+  const flang_string* string_constants;
+  size_t string_constant_count;
+} flang_program;
+
+// Runs the program with the default options of the interpreter, reading from
+// standard input and writing to standard output. Returns the exit status.
+int flang_run(const flang_program* program);
+
+#if FLANG_NAN_BOXING
+
+// The tags of the values emitted code works on, the rest are left to the
+// runtime. Integers which do not fit into the payload are boxed on the heap.
+#define FLANG_TAG_SHIFT 48
+#define FLANG_PAYLOAD_MASK ((UINT64_C(1) << FLANG_TAG_SHIFT) - 1)
+#define FLANG_LAST_FLOAT_TAG UINT64_C(0xFFF7)
+#define FLANG_UNDEFINED_TAG UINT64_C(0xFFF8)
+#define FLANG_INTEGER_TAG UINT64_C(0xFFF9)
+#define FLANG_BOOLEAN_TAG UINT64_C(0xFFFA)
+
+#define FLANG_UNDEFINED (FLANG_UNDEFINED_TAG << FLANG_TAG_SHIFT)
+
+static inline int flang_is_integer(flang_value value) {
+  return (value >> FLANG_TAG_SHIFT) == FLANG_INTEGER_TAG;
+}
+
+static inline int64_t flang_integer(flang_value value) {
+  // sign extend the payload
+  return (int64_t) (value << (64 - FLANG_TAG_SHIFT)) >> (64 - FLANG_TAG_SHIFT);
+}
+
+static inline int flang_fits_integer(int64_t integer) {
+  return integer >= -(INT64_C(1) << (FLANG_TAG_SHIFT - 1)) && integer < (INT64_C(1) << (FLANG_TAG_SHIFT - 1));
+}
+
+static inline flang_value flang_make_integer(int64_t integer) {
+  return (FLANG_INTEGER_TAG << FLANG_TAG_SHIFT) | ((uint64_t) integer & FLANG_PAYLOAD_MASK);
+}
+
+static inline int flang_is_float(flang_value value) {
+  return (value >> FLANG_TAG_SHIFT) <= FLANG_LAST_FLOAT_TAG;
+}
+
+static inline double flang_float(flang_value value) {
+  double floating;
+  memcpy(&floating, &value, sizeof(floating));
+  return floating;
+}
+
+static inline flang_value flang_make_float(double floating) {
+  flang_value value;
+  memcpy(&value, &floating, sizeof(value));
+
+  // NaNs whose payload would collide with a tag
+  if ((value >> FLANG_TAG_SHIFT) > FLANG_LAST_FLOAT_TAG) {
+    value = FLANG_LAST_FLOAT_TAG << FLANG_TAG_SHIFT;
+  }
+
+  return value;
+}
+
+static inline flang_value flang_make_boolean(int boolean) {
+  return (FLANG_BOOLEAN_TAG << FLANG_TAG_SHIFT) | (boolean ? 1u : 0u);
+}
+
+// only false and undefined are falsy
+static inline int flang_is_true(flang_value value) {
+  uint64_t tag = value >> FLANG_TAG_SHIFT;
+
+  if (tag == FLANG_BOOLEAN_TAG) {
+    return (value & FLANG_PAYLOAD_MASK) != 0;
+  }
+
+  return tag != FLANG_UNDEFINED_TAG;
+}
+
+// The operations below replace first with their result and return 1 for the
+// operands they handle, they return 0 and leave first as it was for anything
+// the runtime has to do, like mixed types and boxed integers.
+
+#define FLANG_ARITHMETIC(name, op) \
+  static inline int name(flang_value* first, flang_value second) { \
+    if (flang_is_integer(*first) && flang_is_integer(second)) { \
+      /* two payloads never overflow 64 bits */ \
+      int64_t integer = flang_integer(*first) op flang_integer(second); \
+      if (!flang_fits_integer(integer)) { \
+        return 0; \
+      } \
+      *first = flang_make_integer(integer); \
+      return 1; \
+    } \
+    if (flang_is_float(*first) && flang_is_float(second)) { \
+      *first = flang_make_float(flang_float(*first) op flang_float(second)); \
+      return 1; \
+    } \
+    return 0; \
+  }
+
+FLANG_ARITHMETIC(flang_add, +)
+FLANG_ARITHMETIC(flang_subtract, -)
+
+#undef FLANG_ARITHMETIC
+
+static inline int flang_multiply(flang_value* first, flang_value second) {
+  if (flang_is_integer(*first) && flang_is_integer(second)) {
+    int64_t left = flang_integer(*first);
+    int64_t right = flang_integer(second);
+    const int64_t limit = INT64_C(1) << 31;
+
+    // the product of anything larger may not fit into 64 bits
+    if (left < -limit || left >= limit || right < -limit || right >= limit || !flang_fits_integer(left * right)) {
+      return 0;
+    }
+
+    *first = flang_make_integer(left * right);
+    return 1;
+  }
+
+  if (flang_is_float(*first) && flang_is_float(second)) {
+    *first = flang_make_float(flang_float(*first) * flang_float(second));
+    return 1;
+  }
+
+  return 0;
+}
+
+static inline int flang_divide(flang_value* first, flang_value second) {
+  if (flang_is_integer(*first) && flang_is_integer(second)) {
+    int64_t left = flang_integer(*first);
+    int64_t right = flang_integer(second);
+
+    if (right == 0 || !flang_fits_integer(left / right)) {
+      return 0;
+    }
+
+    *first = flang_make_integer(left / right);
+    return 1;
+  }
+
+  if (flang_is_float(*first) && flang_is_float(second)) {
+    *first = flang_make_float(flang_float(*first) / flang_float(second));
+    return 1;
+  }
+
+  return 0;
+}
+
+#define FLANG_COMPARISON(name, op) \
+  static inline int name(flang_value* first, flang_value second) { \
+    if (flang_is_integer(*first) && flang_is_integer(second)) { \
+      *first = flang_make_boolean(flang_integer(*first) op flang_integer(second)); \
+      return 1; \
+    } \
+    if (flang_is_float(*first) && flang_is_float(second)) { \
+      *first = flang_make_boolean(flang_float(*first) op flang_float(second)); \
+      return 1; \
+    } \
+    return 0; \
+  }
+
+FLANG_COMPARISON(flang_less, <)
+FLANG_COMPARISON(flang_less_or_equal, <=)
+FLANG_COMPARISON(flang_greater, >)
+FLANG_COMPARISON(flang_greater_or_equal, >=)
+
+#undef FLANG_COMPARISON
+
+// equal when is_equal is 1, not equal when it is 0
+static inline int flang_equal(flang_value* first, flang_value second, int is_equal) {
+  uint64_t tag = *first >> FLANG_TAG_SHIFT;
+
+  // these are equal exactly when their bits are
+  if (tag == (second >> FLANG_TAG_SHIFT)
+    && (tag == FLANG_INTEGER_TAG || tag == FLANG_BOOLEAN_TAG || tag == FLANG_UNDEFINED_TAG)) {
+    *first = flang_make_boolean((*first == second) == is_equal);
+    return 1;
+  }
+
+  if (flang_is_float(*first) && flang_is_float(second)) {
+    *first = flang_make_boolean((flang_float(*first) == flang_float(second)) == is_equal);
+    return 1;
+  }
+
+  return 0;
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
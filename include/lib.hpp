@@ -4,6 +4,8 @@
 #include <string>
 #include <optional>
 #include <memory>
+#include <new>
+#include <memory_resource>
 #include <string_view>
 #include <utility>
 #include <vector>
@@ -15,5 +17,13 @@
 #include <list>
 #include <unordered_map>
 #include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <charconv>
+#include <cerrno>
+#include <limits>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #endif // LIB_HPP
\ No newline at end of file
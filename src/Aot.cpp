@@ -0,0 +1,109 @@
+#include "flang.h"
+#include "Runtime.hpp"
+
+static bytecode::Function toFunction(const flang_function& function) {
+  std::vector<bytecode::ClosureContext> closures;
+  closures.reserve(function.closure_count);
+  for (std::size_t i = 0; i < function.closure_count; i++) {
+    closures.emplace_back(function.closures[i].is_local != 0, function.closures[i].index);
+  }
+
+  std::vector<bytecode::ByteCode> byteCode;
+  byteCode.reserve(function.code_count);
+  for (std::size_t i = 0; i < function.code_count; i++) {
+    byteCode.emplace_back(
+      static_cast<bytecode::ByteCodeInstruction>(function.code[i].instruction),
+      function.code[i].parameter
+    );
+  }
+
+  return bytecode::Function{
+    function.argument_count,
+    function.locals_count,
+    function.max_stack,
+    std::move(closures),
+    std::move(byteCode)
+  };
+}
+
+static std::string toString(const flang_string& string) {
+  return std::string{string.data, string.size};
+}
+
+extern "C" int flang_run(const flang_program* program) {
+  if (program->abi_version != FLANG_ABI_VERSION || program->bytecode_version != bytecode::version) {
+    std::cerr << "The program was compiled for another version of flang." << std::endl;
+    return 1;
+  }
+
+  if (program->is_nan_boxed != 0 && !FLANG_NAN_BOXING) {
+    std::cerr << "The program needs a flang_runtime built with FLANG_NAN_BOXING." << std::endl;
+    return 1;
+  }
+
+  std::vector<bytecode::Function> functions;
+  functions.reserve(program->function_count);
+  for (std::size_t i = 0; i < program->function_count; i++) {
+    functions.push_back(toFunction(program->functions[i]));
+  }
+
+  std::vector<bytecode::ObjectConstructor> objects;
+  objects.reserve(program->object_count);
+  for (std::size_t i = 0; i < program->object_count; i++) {
+    std::vector<std::string> keys;
+    for (std::size_t j = 0; j < program->objects[i].key_count; j++) {
+      keys.push_back(toString(program->objects[i].keys[j]));
+    }
+    objects.emplace_back(std::move(keys));
+  }
+
+  std::vector<std::int64_t> intConstants{program->int_constants, program->int_constants + program->int_constant_count};
+
+  std::vector<double> floatConstants;
+  floatConstants.reserve(program->float_constant_count);
+  for (std::size_t i = 0; i < program->float_constant_count; i++) {
+    double value;
+    std::memcpy(&value, &program->float_constants[i], sizeof(value));
+    floatConstants.push_back(value);
+  }
+
+  std::vector<std::string> stringConstants;
+  stringConstants.reserve(program->string_constant_count);
+  for (std::size_t i = 0; i < program->string_constant_count; i++) {
+    stringConstants.push_back(toString(program->string_constants[i]));
+  }
+
+  auto file = std::make_shared<bytecode::CompiledFile>(
+    toFunction(program->entrypoint),
+    std::move(functions),
+    std::move(objects),
+    std::move(intConstants),
+    std::move(floatConstants),
+    std::move(stringConstants)
+  );
+
+  // in the order of the vm's prototypes, the entrypoint comes last
+  std::vector<jit::Precompiled> precompiled;
+  precompiled.reserve(program->function_count + 1);
+  for (std::size_t i = 0; i < program->function_count; i++) {
+    precompiled.push_back(program->functions[i].native);
+  }
+  precompiled.push_back(program->entrypoint.native);
+
+  runtime::JitOptions jitOptions;
+  jitOptions.precompiled = precompiled.data();
+
+  auto vm = std::make_shared<runtime::VirtualMachine>(
+    false,
+    runtime::GcOptions{},
+    runtime::StackOptions{},
+    jitOptions,
+    nullptr,
+    std::cout,
+    std::cin,
+    std::move(file)
+  );
+  vm->run();
+
+  return 0;
+}
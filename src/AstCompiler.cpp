@@ -5,8 +5,8 @@ namespace compiler {
 class ClosureContext {
 public:
   std::string value;
-  std::size_t outerScopeCount;
-  std::size_t localScopeIndex;
+  bool isLocal;
+  std::size_t index;
 };
 
 class VariableDeclaration {
@@ -25,6 +25,12 @@ public:
   std::vector<bytecode::ByteCode> byteCode;
   std::shared_ptr<EmissionContext> outerContext;
 
+  // Op stack depth after the last instruction and the deepest it got. Every
+  // statement leaves the op stack empty and jumps only go between statements,
+  // so following the instructions in order gives the depth on every path.
+  std::size_t stackDepth = 0;
+  std::size_t maxStack = 0;
+
   std::vector<std::size_t> loopStartIndices;
   std::vector<std::size_t> loopConditionEvalJumpIndices;
   std::unordered_map<std::size_t, std::shared_ptr<std::vector<std::size_t>>> breakStatementsForLoops;
@@ -89,8 +95,15 @@ public:
     this->scopeStartIndex.pop_back();
   }
 
-  void EmitByteCode(bytecode::ByteCode bc) {
+  void EmitByteCode(bytecode::ByteCode bc, bytecode::StackEffect effect) {
     this->byteCode.push_back(bc);
+    this->stackDepth = this->stackDepth - effect.pops + effect.pushes;
+    this->maxStack = std::max(this->maxStack, this->stackDepth);
+  }
+
+  void PopByteCode(bytecode::StackEffect effect) {
+    this->byteCode.pop_back();
+    this->stackDepth = this->stackDepth - effect.pushes + effect.pops;
   }
 };
 
@@ -110,6 +123,8 @@ public:
 
     std::shared_ptr<compiler::EmissionContext> ec;
 
+    const CompilerOptions options;
+
     std::unordered_map<std::string, bytecode::ByteCodeInstruction> builtInFunctionLookup{{
       {"add",            bytecode::ByteCodeInstruction::Add},
       {"subtract",       bytecode::ByteCodeInstruction::Subtract},
@@ -137,15 +152,22 @@ public:
       {"append",         bytecode::ByteCodeInstruction::StringAppend}
     }};
 
-  explicit CompilerAstWalker() noexcept
+    // built in functions which are not keywords, calls to them are only
+    // built in when no variable of the same name is in scope
+    std::unordered_map<std::string, bytecode::ByteCodeInstruction> unreservedBuiltInFunctionLookup{{
+      {"push",           bytecode::ByteCodeInstruction::ArrayPush}
+    }};
+
+  explicit CompilerAstWalker(CompilerOptions options) noexcept
   : ec{std::make_shared<EmissionContext>(nullptr)}
+  , options{options}
   {}
 
   virtual ~CompilerAstWalker() noexcept = default;
 
   std::shared_ptr<bytecode::CompiledFile> ConstructCompiledFile() noexcept {
     return std::make_shared<bytecode::CompiledFile>(
-      bytecode::Function{ 0, this->ec->variables.size(), {}, this->ec->byteCode },
+      this->finishFunction(bytecode::Function{ 0, this->ec->variables.size(), this->ec->maxStack, {}, this->ec->byteCode }),
       this->functions,
       this->objects,
       this->intConstants,
@@ -154,6 +176,15 @@ public:
     );
   }
 
+  bytecode::Function finishFunction(const bytecode::Function& fn) noexcept {
+    if (this->options.optimizationLevel == 0) {
+      return fn;
+    }
+
+    PeepholeOptimizer optimizer;
+    return optimizer.optimize(this->functions, this->objects, fn);
+  }
+
   template<typename T>
   std::size_t indexOfConstant(T t, std::vector<T> & vec, std::unordered_map<T, std::size_t> & lookup) noexcept {
     auto find = lookup.find(t);
@@ -174,7 +205,8 @@ public:
   }
 
   void emit(bytecode::ByteCodeInstruction instruction, std::size_t arg) noexcept {
-    this->ec->EmitByteCode(bytecode::ByteCode{instruction, arg});
+    bytecode::ByteCode bc{instruction, arg};
+    this->ec->EmitByteCode(bc, bytecode::stackEffect(this->objects, bc));
   }
 
   void popEmissionContext() noexcept {
@@ -290,42 +322,78 @@ public:
       this->emit(bytecode::ByteCodeInstruction::LoadLocal, index);
     } else {
       // it's a closure
-      std::size_t i = 0;
-      for (const auto& cc : this->ec->closures) {
-        if (cc.value == str) {
-          this->emit(bytecode::ByteCodeInstruction::LoadClosure, i);
-          return;
-        }
-        i++;
-      }
-      // if we've gotten to this point, we need to add a new closure
-      std::size_t localOffsets = 1;
-      auto ec = this->ec->outerContext;
-
-      while (true) {
-        Error::assertWithPanic(ec != nullptr, "Emission context was nullptr when we expected one in resolving closure");
-        std::size_t index;
-        if (ec->GetDeclarationIndex(str, index, true)) {
-          ClosureContext cc;
-          cc.value = str;
-          cc.outerScopeCount = localOffsets;
-          cc.localScopeIndex = index;
-          std::size_t closureIndex = this->ec->closures.size();
-          this->ec->closures.push_back(cc);
-          this->emit(bytecode::ByteCodeInstruction::LoadClosure, closureIndex);
-          return;
-        }
-        ec = ec->outerContext;
-        localOffsets++;
+      this->emit(bytecode::ByteCodeInstruction::LoadClosure, this->captureVariable(this->ec, str));
+    }
+  }
+
+  // finds or adds the capture of str to ec's closures, every function between
+  // ec and the one declaring str captures it as well so that the value can be
+  // handed down when the closures are created
+  std::size_t captureVariable(const std::shared_ptr<compiler::EmissionContext>& ec, const std::string& str) noexcept {
+    std::size_t i = 0;
+    for (const auto& cc : ec->closures) {
+      if (cc.value == str) {
+        return i;
       }
+      i++;
     }
+
+    auto outer = ec->outerContext;
+
+    Error::assertWithPanic(outer != nullptr, "Emission context was nullptr when we expected one in resolving closure");
+
+    ClosureContext cc;
+    cc.value = str;
+
+    std::size_t index;
+    if (outer->GetDeclarationIndex(str, index, true)) {
+      cc.isLocal = true;
+      cc.index = index;
+    } else {
+      cc.isLocal = false;
+      cc.index = this->captureVariable(outer, str);
+    }
+
+    std::size_t closureIndex = ec->closures.size();
+    ec->closures.push_back(cc);
+    return closureIndex;
   }
 
   void onEnterIdentifierExpressionAstNode(IdentifierExpressionAstNode* node) noexcept override {
     this->loadVariable(node->token->value);
   }
 
+  // resolves str the same way loadVariable does, without capturing it
+  bool isDeclared(const std::string& str) noexcept {
+    std::size_t index;
+    if (this->ec->GetDeclarationIndex(str, index, false)) {
+      return true;
+    }
+
+    for (auto outer = this->ec->outerContext; outer != nullptr; outer = outer->outerContext) {
+      if (outer->GetDeclarationIndex(str, index, true)) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  std::optional<bytecode::ByteCodeInstruction> unreservedBuiltInOf(FunctionInvocationExpressionAstNode* node) noexcept {
+    auto find = this->unreservedBuiltInFunctionLookup.find(node->identifier->value);
+
+    if (find == this->unreservedBuiltInFunctionLookup.end() || this->isDeclared(node->identifier->value)) {
+      return std::nullopt;
+    }
+
+    return find->second;
+  }
+
   void onEnterFunctionInvocationExpressionAstNode(FunctionInvocationExpressionAstNode* node) noexcept override {
+    if (this->unreservedBuiltInOf(node)) {
+      return;
+    }
+
     this->loadVariable(node->identifier->value);
   }
 
@@ -431,6 +499,15 @@ public:
   void onExitReturnStatementAstNode(ReturnStatementAstNode* node) noexcept override {
     if (!node->expression) {
       this->emit(bytecode::ByteCodeInstruction::LoadUndefinedConstant);
+
+    } else if (
+      !this->ec->byteCode.empty()
+      && this->ec->byteCode.back().instruction == bytecode::ByteCodeInstruction::Invoke
+    ) {
+      // return f(...), the callee can reuse this function's stack frame
+      std::size_t argCount = this->ec->byteCode.back().parameter;
+      this->ec->PopByteCode(bytecode::stackEffect(this->objects, this->ec->byteCode.back()));
+      this->emit(bytecode::ByteCodeInstruction::TailCall, argCount);
     }
     this->emit(bytecode::ByteCodeInstruction::Return);
   }
@@ -440,6 +517,13 @@ public:
   }
 
   void onExitFunctionInvocationExpressionAstNode(FunctionInvocationExpressionAstNode* node) noexcept override {
+    auto builtIn = this->unreservedBuiltInOf(node);
+
+    if (builtIn) {
+      this->emit(builtIn.value());
+      return;
+    }
+
     this->emit(bytecode::ByteCodeInstruction::Invoke, node->expressions.size());
   }
 
@@ -463,15 +547,16 @@ public:
     std::vector<bytecode::ClosureContext> closures;
 
     for (const auto& cc : this->ec->closures) {
-      closures.emplace_back(cc.outerScopeCount, cc.localScopeIndex);
+      closures.emplace_back(cc.isLocal, cc.index);
     }
 
-    this->functions.emplace_back(bytecode::Function{
+    this->functions.push_back(this->finishFunction(bytecode::Function{
       node->parameters.size(),
       this->ec->variables.size(),
+      this->ec->maxStack,
       closures,
       this->ec->byteCode
-    });
+    }));
 
     this->popEmissionContext();
 
@@ -494,6 +579,18 @@ public:
     this->emit(bytecode::ByteCodeInstruction::MakeObj, objectIndex);
   }
 
+  void onExitArrayDeclarationExpressionAstNode(ArrayDeclarationExpressionAstNode* node) noexcept override {
+    this->emit(bytecode::ByteCodeInstruction::MakeArray, node->expressions.size());
+  }
+
+  void onExitIndexExpressionAstNode(IndexExpressionAstNode* /*node*/) noexcept override {
+    this->emit(bytecode::ByteCodeInstruction::IndexGet);
+  }
+
+  void onExitIndexAssignStatementAstNode(IndexAssignStatementAstNode* /*node*/) noexcept override {
+    this->emit(bytecode::ByteCodeInstruction::IndexSet);
+  }
+
   void onExitExpressionStatementAstNode(ExpressionStatementAstNode*) noexcept override {
     this->emit(bytecode::ByteCodeInstruction::Pop);
   }
@@ -501,7 +598,7 @@ public:
 };
 
 std::shared_ptr<bytecode::CompiledFile> compiler::AstCompiler::compile(std::shared_ptr<ScriptAstNode> file) noexcept {
-  CompilerAstWalker astWalker;
+  CompilerAstWalker astWalker{this->options};
 
   astWalker.visitScriptAstNode(file.get());
 
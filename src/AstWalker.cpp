@@ -15,6 +15,12 @@ void AstWalker::visitStatementAstNode(StatementAstNode* node) noexcept {
     return;
   }
 
+  auto indexAssign = dynamic_cast<IndexAssignStatementAstNode*>(node);
+  if (indexAssign != nullptr) {
+    this->visitIndexAssignStatementAstNode(indexAssign);
+    return;
+  }
+
   auto ifStmt = dynamic_cast<IfStatementAstNode*>(node);
   if (ifStmt != nullptr) {
     this->visitIfStatementAstNode(ifStmt);
@@ -86,6 +92,18 @@ void AstWalker::visitExpressionAstNode(ExpressionAstNode* node) noexcept {
     return;
   }
 
+  auto arrDef = dynamic_cast<ArrayDeclarationExpressionAstNode*>(node);
+  if (arrDef != nullptr) {
+    this->visitArrayDeclarationExpressionAstNode(arrDef);
+    return;
+  }
+
+  auto index = dynamic_cast<IndexExpressionAstNode*>(node);
+  if (index != nullptr) {
+    this->visitIndexExpressionAstNode(index);
+    return;
+  }
+
   auto builtInFn = dynamic_cast<BuiltInFunctionInvocationExpressionAstNode*>(node);
   if (builtInFn != nullptr) {
     this->visitBuiltInFunctionInvocationExpressionAstNode(builtInFn);
@@ -116,6 +134,14 @@ void AstWalker::visitAssignStatementAstNode(AssignStatementAstNode* node) noexce
   this->onExitAssignStatementAstNode(node);
 }
 
+void AstWalker::visitIndexAssignStatementAstNode(IndexAssignStatementAstNode* node) noexcept {
+  this->onEnterIndexAssignStatementAstNode(node);
+  this->visitExpressionAstNode(node->array.get());
+  this->visitExpressionAstNode(node->index.get());
+  this->visitExpressionAstNode(node->expression.get());
+  this->onExitIndexAssignStatementAstNode(node);
+}
+
 void AstWalker::visitIfStatementAstNode(IfStatementAstNode* node) noexcept {
   this->onEnterIfStatementAstNode(node);
   this->visitExpressionAstNode(node->expression.get());
@@ -196,6 +222,21 @@ void AstWalker::visitObjectDeclarationExpressionAstNode(ObjectDeclarationExpress
   this->onExitObjectDeclarationExpressionAstNode(node);
 }
 
+void AstWalker::visitArrayDeclarationExpressionAstNode(ArrayDeclarationExpressionAstNode* node) noexcept {
+  this->onEnterArrayDeclarationExpressionAstNode(node);
+  for (auto & expression : node->expressions) {
+    this->visitExpressionAstNode(expression.get());
+  }
+  this->onExitArrayDeclarationExpressionAstNode(node);
+}
+
+void AstWalker::visitIndexExpressionAstNode(IndexExpressionAstNode* node) noexcept {
+  this->onEnterIndexExpressionAstNode(node);
+  this->visitExpressionAstNode(node->array.get());
+  this->visitExpressionAstNode(node->index.get());
+  this->onExitIndexExpressionAstNode(node);
+}
+
 void AstWalker::visitExpressionStatementAstNode(ExpressionStatementAstNode* node) noexcept {
   this->onEnterExpressionStatementAstNode(node);
   this->visitExpressionAstNode(node->expression.get());
@@ -0,0 +1,590 @@
+#include "CEmitter.hpp"
+#include "flang.h"
+
+namespace compiler {
+
+using bytecode::ByteCode;
+using bytecode::ByteCodeInstruction;
+
+static void emitInt(std::ostream& out, std::int64_t value) {
+  if (value == std::numeric_limits<std::int64_t>::min()) {
+    out << "INT64_MIN";
+  } else {
+    out << "INT64_C(" << value << ")";
+  }
+}
+
+// every byte outside of plain ASCII becomes an octal escape of three digits,
+// so that a digit after it is not taken as part of it
+static void emitString(std::ostream& out, const std::string& value) {
+  static const char digits[] = "01234567";
+
+  out << '"';
+  for (char c : value) {
+    auto byte = static_cast<unsigned char>(c);
+
+    if (byte >= ' ' && byte <= '~' && c != '"' && c != '\\' && c != '?') {
+      out << c;
+      continue;
+    }
+
+    out << '\\' << digits[(byte >> 6) & 7] << digits[(byte >> 3) & 7] << digits[byte & 7];
+  }
+  out << '"';
+}
+
+static void emitStrings(std::ostream& out, const std::string& name, const std::vector<std::string>& values) {
+  if (values.empty()) {
+    return;
+  }
+
+  out << "static const flang_string " << name << "[] = {\n";
+  for (const auto& value : values) {
+    out << "  {";
+    emitString(out, value);
+    out << ", " << value.size() << "u},\n";
+  }
+  out << "};\n\n";
+}
+
+// the array holding values, NULL when there are none because C has no empty
+// arrays
+static std::string arrayOf(const std::string& name, std::size_t values) {
+  return values == 0 ? "NULL" : name;
+}
+
+// the op stack depth before each instruction of a verified function, empty
+// for instructions which are never reached
+static std::vector<std::optional<std::size_t>> stackDepths(const bytecode::CompiledFile& file, const bytecode::Function& fn) {
+  std::vector<std::optional<std::size_t>> depths(fn.byteCode.size());
+  std::vector<std::size_t> workList;
+
+  auto reach = [&](std::size_t programCounter, std::size_t depth) {
+    if (programCounter < depths.size() && !depths[programCounter]) {
+      depths[programCounter] = depth;
+      workList.push_back(programCounter);
+    }
+  };
+
+  reach(0, 0);
+
+  while (!workList.empty()) {
+    std::size_t programCounter = workList.back();
+    workList.pop_back();
+
+    ByteCode bc = fn.byteCode[programCounter];
+    bytecode::StackEffect effect = bytecode::stackEffect(file.objects, bc);
+    std::size_t depth = *depths[programCounter] - effect.pops + effect.pushes;
+
+    switch (bc.instruction) {
+      case ByteCodeInstruction::Halt:
+      case ByteCodeInstruction::Return: {
+        break;
+      }
+      case ByteCodeInstruction::Jump: {
+        reach(bc.parameter, depth);
+        break;
+      }
+      case ByteCodeInstruction::JumpIfFalse: {
+        reach(bc.parameter, depth);
+        reach(programCounter + 1, depth);
+        break;
+      }
+      case ByteCodeInstruction::JumpUnlessLocalLessInteger: {
+        reach(bytecode::FusedOperands::Unpack(bc.parameter).third, depth);
+        reach(programCounter + 1, depth);
+        break;
+      }
+      default: {
+        reach(programCounter + 1, depth);
+      }
+    }
+  }
+
+  return depths;
+}
+
+#if FLANG_NAN_BOXING
+
+// the flang.h operation replacing the first operand of an instruction with
+// its result, null for instructions without one
+static const char* binaryOperationOf(ByteCodeInstruction instruction) {
+  switch (instruction) {
+    case ByteCodeInstruction::Add:
+    case ByteCodeInstruction::AddInt:
+    case ByteCodeInstruction::AddFloat: return "flang_add";
+    case ByteCodeInstruction::Subtract:
+    case ByteCodeInstruction::SubtractInt:
+    case ByteCodeInstruction::SubtractFloat: return "flang_subtract";
+    case ByteCodeInstruction::Multiply:
+    case ByteCodeInstruction::MultiplyInt:
+    case ByteCodeInstruction::MultiplyFloat: return "flang_multiply";
+    case ByteCodeInstruction::Divide:
+    case ByteCodeInstruction::DivideInt:
+    case ByteCodeInstruction::DivideFloat: return "flang_divide";
+    case ByteCodeInstruction::Less:
+    case ByteCodeInstruction::LessInt:
+    case ByteCodeInstruction::LessFloat: return "flang_less";
+    case ByteCodeInstruction::LessOrEqual:
+    case ByteCodeInstruction::LessOrEqualInt:
+    case ByteCodeInstruction::LessOrEqualFloat: return "flang_less_or_equal";
+    case ByteCodeInstruction::Greater:
+    case ByteCodeInstruction::GreaterInt:
+    case ByteCodeInstruction::GreaterFloat: return "flang_greater";
+    case ByteCodeInstruction::GreaterOrEqual:
+    case ByteCodeInstruction::GreaterOrEqualInt:
+    case ByteCodeInstruction::GreaterOrEqualFloat: return "flang_greater_or_equal";
+    default: return nullptr;
+  }
+}
+
+#endif
+
+// Emits the code of one function. Values on the op stack live in a local
+// array the C compiler keeps in registers, and are only written out to the
+// vm's stack, and read back, around calls into the runtime. Locals are read
+// and written in place. Without NaN-boxing every instruction but the jumps
+// calls into the runtime.
+class FunctionEmitter {
+public:
+  std::ostream& out;
+  const bytecode::CompiledFile& file;
+  const bytecode::Function& fn;
+  std::vector<std::optional<std::size_t>> depths;
+  // has_called tells back edges whether the runtime ran since the last one
+  // and may want to collect garbage, they skip the call otherwise
+  bool hasBackEdges;
+
+  explicit FunctionEmitter(std::ostream& out, const bytecode::CompiledFile& file, const bytecode::Function& fn) noexcept
+  : out{out}
+  , file{file}
+  , fn{fn}
+  , depths{stackDepths(file, fn)}
+  , hasBackEdges{false}
+  {
+    for (std::size_t i = 0; i < fn.byteCode.size(); i++) {
+      if (fn.byteCode[i].instruction == ByteCodeInstruction::Jump && fn.byteCode[i].parameter <= i) {
+        this->hasBackEdges = true;
+      }
+    }
+  }
+
+  static std::string value(std::size_t index) {
+    return "values[" + std::to_string(index) + "]";
+  }
+
+  static std::string local(std::size_t index) {
+    return "frame.locals[" + std::to_string(index) + "]";
+  }
+
+  void spill(std::size_t depth, const char* indent = "  ") {
+    if (FLANG_NAN_BOXING) {
+      for (std::size_t i = 0; i < depth; i++) {
+        this->out << indent << "frame.stack[" << i << "] = " << value(i) << ";\n";
+      }
+    }
+  }
+
+  void reload(std::size_t depth, const char* indent = "  ") {
+    if (FLANG_NAN_BOXING) {
+      for (std::size_t i = 0; i < depth; i++) {
+        this->out << indent << value(i) << " = frame.stack[" << i << "];\n";
+      }
+    }
+  }
+
+  std::string call(std::size_t programCounter, std::size_t depth) {
+    return "flang_call(vm, &frame, " + std::to_string(programCounter) + "u, " + std::to_string(depth) + "u)";
+  }
+
+  // the runtime runs the instruction and the code goes on after it
+  void callRuntime(std::size_t programCounter, std::size_t depth, std::size_t nextDepth, const char* indent = "  ") {
+    this->spill(depth, indent);
+    this->out << indent << this->call(programCounter, depth) << ";\n";
+    if (this->hasBackEdges) {
+      this->out << indent << "has_called = 1;\n";
+    }
+    this->reload(nextDepth, indent);
+  }
+
+  // the runtime runs a conditional jump and the code follows it
+  void branchInRuntime(std::size_t programCounter, std::size_t depth, std::size_t nextDepth, std::size_t target, const char* indent = "  ") {
+    this->spill(depth, indent);
+    this->out << indent << "program_counter = " << this->call(programCounter, depth) << ";\n";
+    if (this->hasBackEdges) {
+      this->out << indent << "has_called = 1;\n";
+    }
+    this->reload(nextDepth, indent);
+    this->out << indent << "if (program_counter == " << target << "u) {\n";
+    this->out << indent << "  goto instruction_" << target << ";\n";
+    this->out << indent << "}\n";
+  }
+
+  // the runtime runs the instruction and the vm is in another function
+  // afterwards
+  void leaveFunction(std::size_t programCounter, std::size_t depth) {
+    this->spill(depth);
+    this->out << "  " << this->call(programCounter, depth) << ";\n";
+    this->out << "  return 0;\n";
+  }
+
+  void emitJump(std::size_t programCounter, std::size_t depth, std::size_t target) {
+    // back edges are where the vm collects garbage
+    if (target <= programCounter) {
+      this->out << "  if (has_called) {\n";
+      this->spill(depth, "    ");
+      this->out << "    if (" << this->call(programCounter, depth) << " != " << target << "u) {\n";
+      this->out << "      return 0;\n";
+      this->out << "    }\n";
+      this->out << "    has_called = 0;\n";
+      this->reload(depth, "    ");
+      this->out << "  }\n";
+    }
+
+    this->out << "  goto instruction_" << target << ";\n";
+  }
+
+  void emitBinary(std::size_t programCounter, std::size_t depth, const std::string& operation) {
+    this->out << "  if (!" << operation << ") {\n";
+    this->callRuntime(programCounter, depth, depth - 1, "    ");
+    this->out << "  }\n";
+  }
+
+  void emitInstruction(std::size_t programCounter, std::size_t depth) {
+    ByteCode bc = this->fn.byteCode[programCounter];
+    bytecode::StackEffect effect = bytecode::stackEffect(this->file.objects, bc);
+    std::size_t nextDepth = depth - effect.pops + effect.pushes;
+
+    switch (bc.instruction) {
+      case ByteCodeInstruction::Halt: {
+        this->spill(depth);
+        this->out << "  flang_leave(vm, " << programCounter << "u, " << depth << "u);\n";
+        this->out << "  return 1;\n";
+        return;
+      }
+      case ByteCodeInstruction::Invoke:
+      case ByteCodeInstruction::TailCall:
+      case ByteCodeInstruction::Return: {
+        this->leaveFunction(programCounter, depth);
+        return;
+      }
+      case ByteCodeInstruction::Jump: {
+        this->emitJump(programCounter, depth, bc.parameter);
+        return;
+      }
+      case ByteCodeInstruction::NoOp: {
+        return;
+      }
+      default: {
+        break;
+      }
+    }
+
+#if FLANG_NAN_BOXING
+    this->emitInline(programCounter, depth, nextDepth);
+#else
+    switch (bc.instruction) {
+      case ByteCodeInstruction::JumpIfFalse: {
+        this->branchInRuntime(programCounter, depth, nextDepth, bc.parameter);
+        break;
+      }
+      case ByteCodeInstruction::JumpUnlessLocalLessInteger: {
+        this->branchInRuntime(programCounter, depth, nextDepth, bytecode::FusedOperands::Unpack(bc.parameter).third);
+        break;
+      }
+      default: {
+        this->callRuntime(programCounter, depth, nextDepth);
+      }
+    }
+#endif
+  }
+
+#if FLANG_NAN_BOXING
+  void emitInline(std::size_t programCounter, std::size_t depth, std::size_t nextDepth) {
+    ByteCode bc = this->fn.byteCode[programCounter];
+
+    const char* binary = binaryOperationOf(bc.instruction);
+    if (binary != nullptr) {
+      this->emitBinary(programCounter, depth, std::string{binary} + "(&" + value(depth - 2) + ", " + value(depth - 1) + ")");
+      return;
+    }
+
+    switch (bc.instruction) {
+      case ByteCodeInstruction::LoadIntegerConstant: {
+        std::int64_t integer = this->file.intConstants[bc.parameter];
+
+        // larger ones are boxed on the heap
+        if (!flang_fits_integer(integer)) {
+          this->callRuntime(programCounter, depth, nextDepth);
+          break;
+        }
+
+        this->out << "  " << value(depth) << " = flang_make_integer(";
+        emitInt(this->out, integer);
+        this->out << ");\n";
+        break;
+      }
+      case ByteCodeInstruction::LoadFloatConstant: {
+        this->out << "  " << value(depth) << " = UINT64_C(" << flang_make_float(this->file.floatConstants[bc.parameter]) << ");\n";
+        break;
+      }
+      case ByteCodeInstruction::LoadUndefinedConstant: {
+        this->out << "  " << value(depth) << " = FLANG_UNDEFINED;\n";
+        break;
+      }
+      case ByteCodeInstruction::LoadBooleanTrueConstant:
+      case ByteCodeInstruction::LoadBooleanFalseConstant: {
+        bool boolean = bc.instruction == ByteCodeInstruction::LoadBooleanTrueConstant;
+        this->out << "  " << value(depth) << " = flang_make_boolean(" << (boolean ? 1 : 0) << ");\n";
+        break;
+      }
+      case ByteCodeInstruction::LoadLocal: {
+        this->out << "  " << value(depth) << " = " << local(bc.parameter) << ";\n";
+        break;
+      }
+      case ByteCodeInstruction::SetLocal: {
+        this->out << "  " << local(bc.parameter) << " = " << value(depth - 1) << ";\n";
+        break;
+      }
+      case ByteCodeInstruction::Pop: {
+        break;
+      }
+      case ByteCodeInstruction::Not: {
+        this->out << "  " << value(depth - 1) << " = flang_make_boolean(!flang_is_true(" << value(depth - 1) << "));\n";
+        break;
+      }
+      case ByteCodeInstruction::And:
+      case ByteCodeInstruction::Or: {
+        const char* op = bc.instruction == ByteCodeInstruction::And ? " && " : " || ";
+        this->out << "  " << value(depth - 2) << " = flang_make_boolean(flang_is_true(" << value(depth - 2) << ")"
+          << op << "flang_is_true(" << value(depth - 1) << "));\n";
+        break;
+      }
+      case ByteCodeInstruction::Equal:
+      case ByteCodeInstruction::NotEqual: {
+        bool isEqual = bc.instruction == ByteCodeInstruction::Equal;
+        this->emitBinary(programCounter, depth,
+          "flang_equal(&" + value(depth - 2) + ", " + value(depth - 1) + ", " + (isEqual ? "1" : "0") + ")");
+        break;
+      }
+      case ByteCodeInstruction::JumpIfFalse: {
+        // the runtime collects garbage at back edges
+        if (bc.parameter <= programCounter) {
+          this->branchInRuntime(programCounter, depth, nextDepth, bc.parameter);
+          break;
+        }
+
+        this->out << "  if (!flang_is_true(" << value(depth - 1) << ")) {\n";
+        this->out << "    goto instruction_" << bc.parameter << ";\n";
+        this->out << "  }\n";
+        break;
+      }
+      case ByteCodeInstruction::AddIntegerToLocal: {
+        auto operands = bytecode::FusedOperands::Unpack(bc.parameter);
+        std::int64_t integer = this->file.intConstants[operands.second];
+
+        if (!flang_fits_integer(integer)) {
+          this->callRuntime(programCounter, depth, nextDepth);
+          break;
+        }
+
+        this->out << "  if (!flang_add(&" << local(operands.first) << ", flang_make_integer(";
+        emitInt(this->out, integer);
+        this->out << "))) {\n";
+        this->callRuntime(programCounter, depth, nextDepth, "    ");
+        this->out << "  }\n";
+        break;
+      }
+      case ByteCodeInstruction::JumpUnlessLocalLessInteger: {
+        auto operands = bytecode::FusedOperands::Unpack(bc.parameter);
+
+        if (operands.third <= programCounter) {
+          this->branchInRuntime(programCounter, depth, nextDepth, operands.third);
+          break;
+        }
+
+        this->out << "  if (flang_is_integer(" << local(operands.first) << ")) {\n";
+        this->out << "    if (flang_integer(" << local(operands.first) << ") >= ";
+        emitInt(this->out, this->file.intConstants[operands.second]);
+        this->out << ") {\n";
+        this->out << "      goto instruction_" << operands.third << ";\n";
+        this->out << "    }\n";
+        this->out << "  } else {\n";
+        this->branchInRuntime(programCounter, depth, nextDepth, operands.third, "    ");
+        this->out << "  }\n";
+        break;
+      }
+      default: {
+        // calls, allocation, property access and builtins
+        this->callRuntime(programCounter, depth, nextDepth);
+      }
+    }
+  }
+
+#endif
+
+  void emit(const std::string& name) {
+    const std::vector<ByteCode>& byteCode = this->fn.byteCode;
+
+    this->out << "static int " << name << "(flang_vm* vm, size_t program_counter) {\n";
+    this->out << "  flang_frame frame;\n";
+    if (this->hasBackEdges) {
+      this->out << "  int has_called = 1;\n";
+    }
+    if (FLANG_NAN_BOXING && this->fn.maxStack > 0) {
+      // some functions only ever keep values for calls into the runtime
+      this->out << "  flang_value values[" << this->fn.maxStack << "];\n";
+      this->out << "  (void) values;\n";
+    }
+    this->out << "\n";
+    this->out << "  flang_enter(vm, &frame);\n\n";
+
+    // the vm comes back here after calls and returns into the middle of the
+    // function, the op stack is then in memory
+    this->out << "  switch (program_counter) {\n";
+    for (std::size_t i = 0; i < byteCode.size(); i++) {
+      if (!this->depths[i]) {
+        continue;
+      }
+
+      this->out << "    case " << i << "u:\n";
+      this->reload(*this->depths[i], "      ");
+      this->out << "      goto instruction_" << i << ";\n";
+    }
+    this->out << "    default: return 1;\n";
+    this->out << "  }\n\n";
+
+    for (std::size_t i = 0; i < byteCode.size(); i++) {
+      if (!this->depths[i]) {
+        continue;
+      }
+
+      this->out << "instruction_" << i << ":\n";
+      this->emitInstruction(i, *this->depths[i]);
+    }
+
+    // verified code never runs off the end
+    this->out << "}\n\n";
+  }
+};
+
+static void emitFunctionData(std::ostream& out, const std::string& name, const bytecode::Function& fn) {
+  if (!fn.closures.empty()) {
+    out << "static const flang_closure " << name << "_closures[] = {\n";
+    for (const auto& closure : fn.closures) {
+      out << "  {" << (closure.isLocal ? 1 : 0) << ", " << closure.index << "u},\n";
+    }
+    out << "};\n\n";
+  }
+
+  if (!fn.byteCode.empty()) {
+    out << "static const flang_instruction " << name << "_instructions[] = {\n";
+    for (const auto& bc : fn.byteCode) {
+      out << "  {" << static_cast<std::size_t>(bc.instruction) << "u, " << bc.parameter << "u},\n";
+    }
+    out << "};\n\n";
+  }
+}
+
+static void emitFunction(std::ostream& out, const std::string& name, const bytecode::Function& fn) {
+  out << "{"
+    << fn.argumentCount << "u, "
+    << fn.localsCount << "u, "
+    << fn.maxStack << "u, "
+    << arrayOf(name + "_closures", fn.closures.size()) << ", "
+    << fn.closures.size() << "u, "
+    << arrayOf(name + "_instructions", fn.byteCode.size()) << ", "
+    << fn.byteCode.size() << "u, "
+    << name << "}";
+}
+
+void CEmitter::emit(const bytecode::CompiledFile& file, std::ostream& out) noexcept {
+  out << "// Emitted by flang --emit-c, build with the system C compiler and link\n";
+  out << "// against the flang_runtime library and the C++ standard library.\n\n";
+  out << "#include \"flang.h\"\n\n";
+
+  if (FLANG_NAN_BOXING) {
+    out << "#if !FLANG_NAN_BOXING\n";
+    out << "#error \"The program works on NaN-boxed values, see FLANG_NAN_BOXING in flang.h.\"\n";
+    out << "#endif\n\n";
+  }
+
+  std::vector<std::string> names;
+  for (std::size_t i = 0; i < file.functions.size(); i++) {
+    names.push_back("function_" + std::to_string(i));
+  }
+
+  for (std::size_t i = 0; i < file.functions.size(); i++) {
+    emitFunctionData(out, names[i], file.functions[i]);
+    FunctionEmitter{out, file, file.functions[i]}.emit(names[i]);
+  }
+  emitFunctionData(out, "entrypoint", file.entrypoint);
+  FunctionEmitter{out, file, file.entrypoint}.emit("entrypoint");
+
+  if (!file.functions.empty()) {
+    out << "static const flang_function functions[] = {\n";
+    for (std::size_t i = 0; i < file.functions.size(); i++) {
+      out << "  ";
+      emitFunction(out, names[i], file.functions[i]);
+      out << ",\n";
+    }
+    out << "};\n\n";
+  }
+
+  for (std::size_t i = 0; i < file.objects.size(); i++) {
+    emitStrings(out, "object_" + std::to_string(i) + "_keys", file.objects[i].keys);
+  }
+
+  if (!file.objects.empty()) {
+    out << "static const flang_object objects[] = {\n";
+    for (std::size_t i = 0; i < file.objects.size(); i++) {
+      std::size_t keys = file.objects[i].keys.size();
+      out << "  {" << arrayOf("object_" + std::to_string(i) + "_keys", keys) << ", " << keys << "u},\n";
+    }
+    out << "};\n\n";
+  }
+
+  if (!file.intConstants.empty()) {
+    out << "static const int64_t int_constants[] = {\n";
+    for (std::int64_t value : file.intConstants) {
+      out << "  ";
+      emitInt(out, value);
+      out << ",\n";
+    }
+    out << "};\n\n";
+  }
+
+  // as bits, which keeps every double exactly as it was, infinities and NaNs
+  // included
+  if (!file.floatConstants.empty()) {
+    out << "static const uint64_t float_constants[] = {\n";
+    for (double value : file.floatConstants) {
+      std::uint64_t bits;
+      std::memcpy(&bits, &value, sizeof(bits));
+      out << "  UINT64_C(" << bits << "),\n";
+    }
+    out << "};\n\n";
+  }
+
+  emitStrings(out, "string_constants", file.stringConstants);
+
+  out << "static const flang_program program = {\n";
+  out << "  FLANG_ABI_VERSION,\n";
+  out << "  " << bytecode::version << "u,\n";
+  out << "  " << (FLANG_NAN_BOXING ? 1 : 0) << ",\n";
+  out << "  ";
+  emitFunction(out, "entrypoint", file.entrypoint);
+  out << ",\n";
+  out << "  " << arrayOf("functions", file.functions.size()) << ", " << file.functions.size() << "u,\n";
+  out << "  " << arrayOf("objects", file.objects.size()) << ", " << file.objects.size() << "u,\n";
+  out << "  " << arrayOf("int_constants", file.intConstants.size()) << ", " << file.intConstants.size() << "u,\n";
+  out << "  " << arrayOf("float_constants", file.floatConstants.size()) << ", " << file.floatConstants.size() << "u,\n";
+  out << "  " << arrayOf("string_constants", file.stringConstants.size()) << ", " << file.stringConstants.size() << "u,\n";
+  out << "};\n\n";
+
+  out << "int main(void) {\n";
+  out << "  return flang_run(&program);\n";
+  out << "}\n";
+}
+
+}
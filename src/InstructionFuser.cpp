@@ -0,0 +1,156 @@
+#include "InstructionFuser.hpp"
+
+namespace compiler {
+
+using bytecode::ByteCode;
+using bytecode::ByteCodeInstruction;
+using bytecode::FusedOperands;
+
+static bool isInstruction(const std::vector<ByteCode>& byteCode, std::size_t index, ByteCodeInstruction instruction) {
+  return index < byteCode.size() && byteCode[index].instruction == instruction;
+}
+
+static std::vector<ByteCode> fuseByteCode(const std::vector<ByteCode>& byteCode) {
+  std::vector<bool> isJumpTarget(byteCode.size(), false);
+
+  for (const auto& bc : byteCode) {
+    bool isJump = bc.instruction == ByteCodeInstruction::Jump || bc.instruction == ByteCodeInstruction::JumpIfFalse;
+
+    // out of range targets are left for the verifier to reject
+    if (isJump && bc.parameter < byteCode.size()) {
+      isJumpTarget[bc.parameter] = true;
+    }
+  }
+
+  auto isStraightLine = [&](std::size_t start, std::size_t count) {
+    for (std::size_t i = start + 1; i < start + count; i++) {
+      if (i >= byteCode.size() || isJumpTarget[i]) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  // where each old instruction went, jumps are renumbered once all of the
+  // sequences are fused
+  std::vector<std::size_t> newIndex(byteCode.size(), 0);
+  std::vector<ByteCode> fused;
+  fused.reserve(byteCode.size());
+
+  std::size_t i = 0;
+  while (i < byteCode.size()) {
+    newIndex[i] = fused.size();
+
+    if (isInstruction(byteCode, i, ByteCodeInstruction::LoadLocal)) {
+      std::size_t local = byteCode[i].parameter;
+
+      // i = add(i, 1)
+      if (
+        isInstruction(byteCode, i + 1, ByteCodeInstruction::LoadIntegerConstant)
+        && isInstruction(byteCode, i + 2, ByteCodeInstruction::Add)
+        && isInstruction(byteCode, i + 3, ByteCodeInstruction::SetLocal)
+        && byteCode[i + 3].parameter == local
+        && isStraightLine(i, 4)
+      ) {
+        FusedOperands operands{local, byteCode[i + 1].parameter, 0};
+
+        if (operands.fits()) {
+          fused.emplace_back(ByteCodeInstruction::AddIntegerToLocal, operands.pack());
+          i += 4;
+          continue;
+        }
+      }
+
+      // while (less(i, 10))
+      if (
+        isInstruction(byteCode, i + 1, ByteCodeInstruction::LoadIntegerConstant)
+        && isInstruction(byteCode, i + 2, ByteCodeInstruction::Less)
+        && isInstruction(byteCode, i + 3, ByteCodeInstruction::JumpIfFalse)
+        && byteCode[i + 3].parameter < byteCode.size()
+        && isStraightLine(i, 4)
+      ) {
+        // the target is renumbered below
+        FusedOperands operands{local, byteCode[i + 1].parameter, byteCode[i + 3].parameter};
+
+        if (operands.fits()) {
+          fused.emplace_back(ByteCodeInstruction::JumpUnlessLocalLessInteger, operands.pack());
+          i += 4;
+          continue;
+        }
+      }
+
+      // get(obj, "key")
+      if (
+        isInstruction(byteCode, i + 1, ByteCodeInstruction::LoadStringConstant)
+        && isInstruction(byteCode, i + 2, ByteCodeInstruction::ObjectGet)
+        && isStraightLine(i, 3)
+      ) {
+        FusedOperands operands{local, byteCode[i + 1].parameter, 0};
+
+        if (operands.fits()) {
+          fused.emplace_back(ByteCodeInstruction::LoadLocalProperty, operands.pack());
+          i += 3;
+          continue;
+        }
+      }
+    }
+
+    fused.push_back(byteCode[i]);
+    i++;
+  }
+
+  std::vector<ByteCode> ret;
+  ret.reserve(fused.size());
+
+  for (const auto& bc : fused) {
+    switch (bc.instruction) {
+      case ByteCodeInstruction::Jump:
+      case ByteCodeInstruction::JumpIfFalse: {
+        ret.emplace_back(bc.instruction, bc.parameter < newIndex.size() ? newIndex[bc.parameter] : bc.parameter);
+        break;
+      }
+      case ByteCodeInstruction::JumpUnlessLocalLessInteger: {
+        // only fused from jumps whose targets are in range
+        auto operands = FusedOperands::Unpack(bc.parameter);
+        operands.third = newIndex[operands.third];
+        ret.emplace_back(bc.instruction, operands.pack());
+        break;
+      }
+      default: {
+        ret.push_back(bc);
+      }
+    }
+  }
+
+  return ret;
+}
+
+static bytecode::Function fuseFunction(const bytecode::Function& fn) {
+  return bytecode::Function{
+    fn.argumentCount,
+    fn.localsCount,
+    fn.maxStack,
+    fn.closures,
+    fuseByteCode(fn.byteCode)
+  };
+}
+
+std::shared_ptr<bytecode::CompiledFile> InstructionFuser::fuse(const bytecode::CompiledFile& file) noexcept {
+  std::vector<bytecode::Function> functions;
+  functions.reserve(file.functions.size());
+
+  for (const auto& fn : file.functions) {
+    functions.push_back(fuseFunction(fn));
+  }
+
+  return std::make_shared<bytecode::CompiledFile>(
+    fuseFunction(file.entrypoint),
+    std::move(functions),
+    file.objects,
+    file.intConstants,
+    file.floatConstants,
+    file.stringConstants
+  );
+}
+
+}
@@ -23,15 +23,64 @@ std::shared_ptr<ScriptAstNode> parseScript(std::ostream & out, const std::string
   return script;
 }
 
-std::shared_ptr<bytecode::CompiledFile> compile(std::shared_ptr<ScriptAstNode> script) {
-  auto compiler = std::make_shared<compiler::AstCompiler>();
-  return compiler->compile(std::move(script));
+std::shared_ptr<bytecode::CompiledFile> compile(compiler::CompilerOptions options, std::shared_ptr<ScriptAstNode> script) {
+  auto compiler = std::make_shared<compiler::AstCompiler>(options);
+  compiler::InstructionFuser fuser;
+  return fuser.fuse(*compiler->compile(std::move(script)));
+}
+
+void interpreter::Interpreter::EmitC(const std::string & data, const std::string & path) {
+
+  std::shared_ptr<ScriptAstNode> script = parseScript(this->out, data);
+  auto compiledFile = compile(this->compilerOptions, script);
+
+  verifier::Verifier verifier;
+  if (!verifier.isValid(*compiledFile)) {
+    this->out << "Could not emit C, the bytecode does not verify: " << verifier.error << std::endl;
+    exit(1);
+  }
+
+  std::ofstream file{path};
+
+  if (!file) {
+    this->out << "Could not open output file " << path << std::endl;
+    exit(1);
+  }
+
+  compiler::CEmitter emitter;
+  emitter.emit(*compiledFile, file);
+
+  if (!file) {
+    this->out << "Could not write output file " << path << std::endl;
+    exit(1);
+  }
 }
 
 void interpreter::Interpreter::Run(const std::string & data) {
 
   std::shared_ptr<ScriptAstNode> script = parseScript(this->out, data);
-  auto compiledFile = compile(script);
-  auto runtime = std::make_shared<runtime::VirtualMachine>(false, this->out, this->in, std::move(compiledFile));
+  auto compiledFile = compile(this->compilerOptions, script);
+
+  std::ofstream profile;
+
+  if (this->profilePath) {
+    profile.open(this->profilePath.value());
+
+    if (!profile) {
+      this->out << "Could not open profile file " << this->profilePath.value() << std::endl;
+      exit(1);
+    }
+  }
+
+  auto runtime = std::make_shared<runtime::VirtualMachine>(
+    false,
+    this->gcOptions,
+    this->stackOptions,
+    this->jitOptions,
+    this->profilePath ? &profile : nullptr,
+    this->out,
+    this->in,
+    std::move(compiledFile)
+  );
   runtime->run();
 }
\ No newline at end of file
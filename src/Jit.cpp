@@ -0,0 +1,1327 @@
+#include "Jit.hpp"
+
+namespace jit {
+
+#if FLANG_JIT
+
+using bytecode::ByteCodeInstruction;
+
+// how control leaves the code of an instruction once its helper returned
+enum class Exit {
+  // on to the next instruction
+  FallThrough,
+  // to the target of the instruction, unless the helper left the vm
+  // somewhere else because a trace ran or started recording
+  Jump,
+  // to the target of the instruction when the helper took it, otherwise on
+  // to the next instruction
+  Branch,
+  // back to the caller of NativeCode::run, the vm is in another function
+  Leave,
+};
+
+static Exit exitOf(bytecode::ByteCode bc) {
+  switch (bc.instruction) {
+    case ByteCodeInstruction::Jump: {
+      return Exit::Jump;
+    }
+    case ByteCodeInstruction::JumpIfFalse:
+    case ByteCodeInstruction::JumpUnlessLocalLessInteger: {
+      return Exit::Branch;
+    }
+    case ByteCodeInstruction::Invoke:
+    case ByteCodeInstruction::TailCall:
+    case ByteCodeInstruction::Return: {
+      return Exit::Leave;
+    }
+    default: {
+      return Exit::FallThrough;
+    }
+  }
+}
+
+static std::size_t jumpTarget(bytecode::ByteCode bc) {
+  if (bc.instruction == ByteCodeInstruction::JumpUnlessLocalLessInteger) {
+    return bytecode::FusedOperands::Unpack(bc.parameter).third;
+  }
+  return bc.parameter;
+}
+
+enum class Register : std::uint8_t {
+  Rax = 0,
+  Rcx = 1,
+  Rdx = 2,
+  Rbx = 3,
+  Rsi = 6,
+  Rdi = 7,
+  R12 = 12,
+  R13 = 13,
+  R14 = 14,
+  R15 = 15,
+};
+
+// condition codes of jcc and setcc, flipping the lowest bit negates them
+enum class Condition : std::uint8_t {
+  Overflow = 0x0,
+  Below = 0x2,
+  AboveOrEqual = 0x3,
+  Equal = 0x4,
+  NotEqual = 0x5,
+  BelowOrEqual = 0x6,
+  Above = 0x7,
+  Less = 0xC,
+  GreaterOrEqual = 0xD,
+  LessOrEqual = 0xE,
+  Greater = 0xF,
+};
+
+static Condition negate(Condition condition) {
+  return static_cast<Condition>(static_cast<std::uint8_t>(condition) ^ 1);
+}
+
+// Appends x86-64 instructions, rel32 operands of jumps are patched once all
+// of the labels are known.
+class Assembler {
+public:
+  std::vector<std::uint8_t> code;
+
+  void emit(std::initializer_list<std::uint8_t> bytes) {
+    this->code.insert(this->code.end(), bytes);
+  }
+
+  void emit32(std::uint32_t value) {
+    for (std::size_t i = 0; i < 4; i++) {
+      this->code.push_back(static_cast<std::uint8_t>(value >> (i * 8)));
+    }
+  }
+
+  void emit64(std::uint64_t value) {
+    for (std::size_t i = 0; i < 8; i++) {
+      this->code.push_back(static_cast<std::uint8_t>(value >> (i * 8)));
+    }
+  }
+
+  // returns where the rel32 operand is, for patch
+  std::size_t emitRel32() {
+    std::size_t at = this->code.size();
+    this->emit32(0);
+    return at;
+  }
+
+  void patch(std::size_t at, std::size_t target) {
+    auto rel = static_cast<std::int32_t>(static_cast<std::int64_t>(target) - static_cast<std::int64_t>(at + 4));
+    auto value = static_cast<std::uint32_t>(rel);
+
+    for (std::size_t i = 0; i < 4; i++) {
+      this->code[at + i] = static_cast<std::uint8_t>(value >> (i * 8));
+    }
+  }
+
+  // the register operand of modrm goes into reg, the other one into rm
+  void rex(Register reg, Register rm) {
+    auto r = static_cast<std::uint8_t>(reg);
+    auto b = static_cast<std::uint8_t>(rm);
+    this->emit({static_cast<std::uint8_t>(0x48 | ((r >> 3) << 2) | (b >> 3))});
+  }
+
+  // op with the operands reg and [base + disp]
+  void memory(std::uint8_t op, Register reg, Register base, std::int32_t disp) {
+    auto r = static_cast<std::uint8_t>(reg) & 7;
+    auto b = static_cast<std::uint8_t>(base) & 7;
+    this->rex(reg, base);
+    this->emit({op, static_cast<std::uint8_t>(0x80 | (r << 3) | b)});
+    // rsp and r12 as a base need a sib byte
+    if (b == 4) {
+      this->emit({0x24});
+    }
+    this->emit32(static_cast<std::uint32_t>(disp));
+  }
+
+  // op with the operands reg and rm
+  void registers(std::uint8_t op, Register reg, Register rm) {
+    auto r = static_cast<std::uint8_t>(reg) & 7;
+    auto b = static_cast<std::uint8_t>(rm) & 7;
+    this->rex(reg, rm);
+    this->emit({op, static_cast<std::uint8_t>(0xC0 | (r << 3) | b)});
+  }
+
+  void load(Register reg, Register base, std::int32_t disp) {
+    this->memory(0x8B, reg, base, disp);
+  }
+
+  void store(Register base, std::int32_t disp, Register reg) {
+    this->memory(0x89, reg, base, disp);
+  }
+
+  void lea(Register reg, Register base, std::int32_t disp) {
+    this->memory(0x8D, reg, base, disp);
+  }
+
+  // mov qword [base + disp], sign extended value
+  void storeImmediate(Register base, std::int32_t disp, std::int32_t value) {
+    this->memory(0xC7, Register::Rax, base, disp);
+    this->emit32(static_cast<std::uint32_t>(value));
+  }
+
+  void move(Register to, Register from) {
+    this->registers(0x89, from, to);
+  }
+
+  void moveImmediate(Register reg, std::uint64_t value) {
+    auto r = static_cast<std::uint8_t>(reg);
+    this->emit({static_cast<std::uint8_t>(0x48 | (r >> 3)), static_cast<std::uint8_t>(0xB8 | (r & 7))});
+    this->emit64(value);
+  }
+
+  // shl is 4, shr 5 and sar 7
+  void shift(std::uint8_t kind, Register reg, std::uint8_t count) {
+    this->registers(0xC1, static_cast<Register>(kind), reg);
+    this->emit({count});
+  }
+
+  // cmp r32, imm32
+  void compare32(Register reg, std::uint32_t value) {
+    auto r = static_cast<std::uint8_t>(reg);
+    if (r >= 8) {
+      this->emit({0x41});
+    }
+    this->emit({0x81, static_cast<std::uint8_t>(0xF8 | (r & 7))});
+    this->emit32(value);
+  }
+
+  std::size_t jumpIf(Condition condition) {
+    this->emit({0x0F, static_cast<std::uint8_t>(0x80 | static_cast<std::uint8_t>(condition))});
+    return this->emitRel32();
+  }
+
+  std::size_t jump() {
+    this->emit({0xE9});
+    return this->emitRel32();
+  }
+};
+
+static void* mapExecutable(const std::vector<std::uint8_t>& code) {
+  void* memory = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (memory == MAP_FAILED) {
+    return nullptr;
+  }
+
+  std::memcpy(memory, code.data(), code.size());
+
+  if (mprotect(memory, code.size(), PROT_READ | PROT_EXEC) != 0) {
+    munmap(memory, code.size());
+    return nullptr;
+  }
+
+  return memory;
+}
+
+static constexpr std::int32_t variableSize = 8;
+
+static constexpr int tagShift = 48;
+
+// sign extends the 48 bit payload of an inline integer
+static void unboxInteger(Assembler& a, Register reg) {
+  a.shift(4, reg, 64 - tagShift);
+  a.shift(7, reg, 64 - tagShift);
+}
+
+// jumps unless reg holds an inline integer or a double, returns the jump to
+// patch, clobbers rdx
+static std::size_t jumpUnlessType(Assembler& a, const ValueEncoding& encoding, Register reg, TraceType type) {
+  a.move(Register::Rdx, reg);
+  a.shift(5, Register::Rdx, tagShift);
+
+  if (type == TraceType::Integer) {
+    a.compare32(Register::Rdx, static_cast<std::uint32_t>(encoding.integerTag));
+    return a.jumpIf(Condition::NotEqual);
+  }
+
+  a.compare32(Register::Rdx, static_cast<std::uint32_t>(encoding.lastFloatTag));
+  return a.jumpIf(Condition::Above);
+}
+
+// jumps unless rax fits into an inline integer, which it otherwise becomes,
+// returns the jump to patch, clobbers rdx
+static std::size_t boxInteger(Assembler& a, const ValueEncoding& encoding) {
+  a.move(Register::Rdx, Register::Rax);
+  unboxInteger(a, Register::Rdx);
+  // cmp rdx, rax
+  a.registers(0x39, Register::Rax, Register::Rdx);
+  std::size_t jump = a.jumpIf(Condition::NotEqual);
+
+  a.shift(4, Register::Rax, 64 - tagShift);
+  a.shift(5, Register::Rax, 64 - tagShift);
+  a.moveImmediate(Register::Rdx, encoding.integerTag << tagShift);
+  // or rax, rdx
+  a.registers(0x09, Register::Rdx, Register::Rax);
+
+  return jump;
+}
+
+// the generic instruction a quickened one stands for
+static ByteCodeInstruction genericOf(ByteCodeInstruction instruction) {
+  switch (instruction) {
+    case ByteCodeInstruction::AddInt:
+    case ByteCodeInstruction::AddFloat: return ByteCodeInstruction::Add;
+    case ByteCodeInstruction::SubtractInt:
+    case ByteCodeInstruction::SubtractFloat: return ByteCodeInstruction::Subtract;
+    case ByteCodeInstruction::MultiplyInt:
+    case ByteCodeInstruction::MultiplyFloat: return ByteCodeInstruction::Multiply;
+    case ByteCodeInstruction::DivideInt:
+    case ByteCodeInstruction::DivideFloat: return ByteCodeInstruction::Divide;
+    case ByteCodeInstruction::LessInt:
+    case ByteCodeInstruction::LessFloat: return ByteCodeInstruction::Less;
+    case ByteCodeInstruction::LessOrEqualInt:
+    case ByteCodeInstruction::LessOrEqualFloat: return ByteCodeInstruction::LessOrEqual;
+    case ByteCodeInstruction::GreaterInt:
+    case ByteCodeInstruction::GreaterFloat: return ByteCodeInstruction::Greater;
+    case ByteCodeInstruction::GreaterOrEqualInt:
+    case ByteCodeInstruction::GreaterOrEqualFloat: return ByteCodeInstruction::GreaterOrEqual;
+    default: return instruction;
+  }
+}
+
+// the condition under which an integer comparison of rax with rcx is true
+static Condition conditionOf(ByteCodeInstruction instruction) {
+  switch (instruction) {
+    case ByteCodeInstruction::Less: return Condition::Less;
+    case ByteCodeInstruction::LessOrEqual: return Condition::LessOrEqual;
+    case ByteCodeInstruction::Greater: return Condition::Greater;
+    default: return Condition::GreaterOrEqual;
+  }
+}
+
+// pop r15; pop r14; pop r13; pop r12; pop rbx; ret
+static void emitEpilogue(Assembler& a) {
+  a.emit({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3});
+}
+
+#endif
+
+NativeCode::NativeCode(void* memory, std::size_t size, std::vector<std::uint32_t> offsets) noexcept
+: memory{memory}
+, size{size}
+, offsets{std::move(offsets)}
+{}
+
+NativeCode::~NativeCode() {
+#if FLANG_JIT
+  munmap(this->memory, this->size);
+#endif
+}
+
+bool NativeCode::run(runtime::VirtualMachine* vm, TraceState* state) const noexcept {
+  // the code starts with an entry taking the vm, the state and the address to
+  // continue at
+  using Entry = int (*)(runtime::VirtualMachine* vm, TraceState* state, const void* start);
+
+  auto* base = static_cast<const std::uint8_t*>(this->memory);
+  auto entry = reinterpret_cast<Entry>(this->memory);
+
+  return entry(vm, state, base + this->offsets[state->programCounter]) == 0;
+}
+
+#if FLANG_JIT
+
+// Emits the code of one function for Compiler. rbx holds the vm, r15 the
+// state, r13 the locals and r12 the top of the op stack, which the vm only
+// sees around helper calls.
+class BaselineEmitter {
+public:
+  Assembler a;
+  const bytecode::CompiledFile& file;
+  const std::vector<bytecode::ByteCode>& byteCode;
+  const TraceHelpers& helpers;
+  // null when Variables are not NaN-boxed, every instruction then runs its
+  // helper
+  const ValueEncoding* encoding;
+
+  // where the code of each instruction starts, the last one is past the end
+  std::vector<std::uint32_t> offsets;
+
+  // rel32 operands to patch with the code of an instruction
+  std::vector<std::pair<std::size_t, std::size_t>> jumps;
+  // guards which failed, to patch with the code running the instruction's
+  // helper instead
+  std::vector<std::pair<std::size_t, std::size_t>> slowPaths;
+  std::vector<std::size_t> leaves;
+  std::vector<std::size_t> interprets;
+
+  explicit BaselineEmitter(
+    const bytecode::CompiledFile& file,
+    const std::vector<bytecode::ByteCode>& byteCode,
+    const TraceHelpers& helpers,
+    const ValueEncoding* encoding
+  ) noexcept
+  : a{}
+  , file{file}
+  , byteCode{byteCode}
+  , helpers{helpers}
+  , encoding{encoding}
+  , offsets(byteCode.size() + 1, 0)
+  , jumps{}
+  , slowPaths{}
+  , leaves{}
+  , interprets{}
+  {}
+
+  static std::int32_t slot(std::size_t index) {
+    return static_cast<std::int32_t>(index) * variableSize;
+  }
+
+  void push(Register reg) {
+    this->a.store(Register::R12, 0, reg);
+    this->a.lea(Register::R12, Register::R12, variableSize);
+  }
+
+  void pushImmediate(std::uint64_t bits) {
+    this->a.moveImmediate(Register::Rax, bits);
+    this->push(Register::Rax);
+  }
+
+  void pop() {
+    this->a.lea(Register::R12, Register::R12, -variableSize);
+  }
+
+  void jumpTo(std::size_t jump, std::size_t programCounter) {
+    this->jumps.emplace_back(jump, programCounter);
+  }
+
+  // runs the helper of the instruction at programCounter with the op stack
+  // in memory and leaves the program counter it returned in rax
+  void callHelper(std::size_t programCounter, Helper helper) {
+    this->a.store(Register::R15, offsetof(TraceState, stackTop), Register::R12);
+    this->a.storeImmediate(Register::R15, offsetof(TraceState, programCounter), static_cast<std::int32_t>(programCounter));
+
+    this->a.move(Register::Rdi, Register::Rbx);
+    this->a.moveImmediate(Register::Rsi, reinterpret_cast<std::uint64_t>(helper));
+    this->a.moveImmediate(Register::Rax, reinterpret_cast<std::uint64_t>(this->helpers.call));
+    // call rax
+    this->a.emit({0xFF, 0xD0});
+
+    // the helper may have grown the stack, called or returned
+    this->a.load(Register::R13, Register::R15, offsetof(TraceState, locals));
+    this->a.load(Register::R12, Register::R15, offsetof(TraceState, stackTop));
+  }
+
+  // runs the instruction at programCounter through its helper and follows
+  // where the helper left the vm, falling through to the next instruction
+  void runHelper(std::size_t programCounter) {
+    bytecode::ByteCode bc = this->byteCode[programCounter];
+    Helper helper = (*this->helpers.instructions)[static_cast<std::size_t>(bc.instruction)];
+
+    if (helper == nullptr) {
+      this->a.storeImmediate(Register::R15, offsetof(TraceState, programCounter), static_cast<std::int32_t>(programCounter));
+      this->interprets.push_back(this->a.jump());
+      return;
+    }
+
+    this->callHelper(programCounter, helper);
+
+    switch (exitOf(bc)) {
+      case Exit::FallThrough: {
+        break;
+      }
+      case Exit::Jump: {
+        // cmp rax, target; je target; jmp leave
+        this->a.emit({0x48, 0x3D});
+        this->a.emit32(static_cast<std::uint32_t>(jumpTarget(bc)));
+        this->jumpTo(this->a.jumpIf(Condition::Equal), jumpTarget(bc));
+        this->leaves.push_back(this->a.jump());
+        break;
+      }
+      case Exit::Branch: {
+        // cmp rax, target; je target
+        this->a.emit({0x48, 0x3D});
+        this->a.emit32(static_cast<std::uint32_t>(jumpTarget(bc)));
+        this->jumpTo(this->a.jumpIf(Condition::Equal), jumpTarget(bc));
+        break;
+      }
+      case Exit::Leave: {
+        this->leaves.push_back(this->a.jump());
+        break;
+      }
+    }
+  }
+
+  // loads the two operands on top of the op stack into rax and rcx and
+  // takes the slow path unless both are inline integers
+  void loadIntegers(std::size_t programCounter) {
+    this->a.load(Register::Rax, Register::R12, -2 * variableSize);
+    this->a.load(Register::Rcx, Register::R12, -variableSize);
+    this->slowPaths.emplace_back(jumpUnlessType(this->a, *this->encoding, Register::Rax, TraceType::Integer), programCounter);
+    this->slowPaths.emplace_back(jumpUnlessType(this->a, *this->encoding, Register::Rcx, TraceType::Integer), programCounter);
+    unboxInteger(this->a, Register::Rax);
+    unboxInteger(this->a, Register::Rcx);
+  }
+
+  // the Variable bits of an integer, empty when it would be boxed
+  std::optional<std::uint64_t> integerBits(std::int64_t value) const {
+    constexpr std::int64_t limit = std::int64_t{1} << (tagShift - 1);
+
+    if (value < -limit || value >= limit) {
+      return std::nullopt;
+    }
+
+    constexpr std::uint64_t payloadMask = (std::uint64_t{1} << tagShift) - 1;
+    return (this->encoding->integerTag << tagShift) | (static_cast<std::uint64_t>(value) & payloadMask);
+  }
+
+  std::uint64_t floatBits(double value) const {
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    // NaNs which look like tags become canonical
+    if ((bits >> tagShift) > this->encoding->lastFloatTag) {
+      return this->encoding->canonicalNan;
+    }
+
+    return bits;
+  }
+
+  // Emits the instruction at programCounter as machine code which takes the
+  // slow path for operands it does not handle. Returns false for
+  // instructions which always run their helper. Back edges run the helper,
+  // which collects garbage and enters traces.
+  bool emitInline(std::size_t programCounter) {
+    bytecode::ByteCode bc = this->byteCode[programCounter];
+    ByteCodeInstruction instruction = genericOf(bc.instruction);
+
+    switch (instruction) {
+      case ByteCodeInstruction::NoOp: {
+        return true;
+      }
+      case ByteCodeInstruction::Jump: {
+        if (bc.parameter <= programCounter) {
+          return false;
+        }
+        this->jumpTo(this->a.jump(), bc.parameter);
+        return true;
+      }
+      default: {
+        break;
+      }
+    }
+
+    if (this->encoding == nullptr) {
+      return false;
+    }
+
+    const ValueEncoding& encoding = *this->encoding;
+
+    switch (instruction) {
+      case ByteCodeInstruction::LoadLocal: {
+        this->a.load(Register::Rax, Register::R13, slot(bc.parameter));
+        this->push(Register::Rax);
+        return true;
+      }
+      case ByteCodeInstruction::SetLocal: {
+        this->pop();
+        this->a.load(Register::Rax, Register::R12, 0);
+        this->a.store(Register::R13, slot(bc.parameter), Register::Rax);
+        return true;
+      }
+      case ByteCodeInstruction::Pop: {
+        this->pop();
+        return true;
+      }
+      case ByteCodeInstruction::LoadIntegerConstant: {
+        auto bits = this->integerBits(this->file.intConstants[bc.parameter]);
+        if (!bits) {
+          return false;
+        }
+        this->pushImmediate(*bits);
+        return true;
+      }
+      case ByteCodeInstruction::LoadFloatConstant: {
+        this->pushImmediate(this->floatBits(this->file.floatConstants[bc.parameter]));
+        return true;
+      }
+      case ByteCodeInstruction::LoadUndefinedConstant: {
+        this->pushImmediate(encoding.undefinedBits);
+        return true;
+      }
+      case ByteCodeInstruction::LoadBooleanTrueConstant: {
+        this->pushImmediate(encoding.trueBits);
+        return true;
+      }
+      case ByteCodeInstruction::LoadBooleanFalseConstant: {
+        this->pushImmediate(encoding.falseBits);
+        return true;
+      }
+      case ByteCodeInstruction::JumpIfFalse: {
+        if (bc.parameter <= programCounter) {
+          return false;
+        }
+
+        // false and undefined are the falsy values
+        this->pop();
+        this->a.load(Register::Rax, Register::R12, 0);
+        this->a.moveImmediate(Register::Rcx, encoding.falseBits);
+        // cmp rax, rcx
+        this->a.registers(0x39, Register::Rcx, Register::Rax);
+        this->jumpTo(this->a.jumpIf(Condition::Equal), bc.parameter);
+        this->a.moveImmediate(Register::Rcx, encoding.undefinedBits);
+        this->a.registers(0x39, Register::Rcx, Register::Rax);
+        this->jumpTo(this->a.jumpIf(Condition::Equal), bc.parameter);
+        return true;
+      }
+      case ByteCodeInstruction::Add:
+      case ByteCodeInstruction::Subtract:
+      case ByteCodeInstruction::Multiply: {
+        this->loadIntegers(programCounter);
+
+        if (instruction == ByteCodeInstruction::Add) {
+          // add rax, rcx
+          this->a.registers(0x01, Register::Rcx, Register::Rax);
+        } else if (instruction == ByteCodeInstruction::Subtract) {
+          // sub rax, rcx
+          this->a.registers(0x29, Register::Rcx, Register::Rax);
+        } else {
+          // imul rax, rcx
+          this->a.emit({0x48, 0x0F, 0xAF, 0xC1});
+          this->slowPaths.emplace_back(this->a.jumpIf(Condition::Overflow), programCounter);
+        }
+
+        this->slowPaths.emplace_back(boxInteger(this->a, encoding), programCounter);
+        this->pop();
+        this->a.store(Register::R12, -variableSize, Register::Rax);
+        return true;
+      }
+      case ByteCodeInstruction::Less:
+      case ByteCodeInstruction::LessOrEqual:
+      case ByteCodeInstruction::Greater:
+      case ByteCodeInstruction::GreaterOrEqual: {
+        this->loadIntegers(programCounter);
+        // cmp rax, rcx
+        this->a.registers(0x39, Register::Rcx, Register::Rax);
+
+        // setcc cl; movzx ecx, cl, true is false with the lowest bit set
+        this->a.emit({0x0F, static_cast<std::uint8_t>(0x90 | static_cast<std::uint8_t>(conditionOf(instruction))), 0xC1, 0x0F, 0xB6, 0xC9});
+        this->a.moveImmediate(Register::Rax, encoding.falseBits);
+        // or rax, rcx
+        this->a.registers(0x09, Register::Rcx, Register::Rax);
+
+        this->pop();
+        this->a.store(Register::R12, -variableSize, Register::Rax);
+        return true;
+      }
+      case ByteCodeInstruction::AddIntegerToLocal:
+      case ByteCodeInstruction::JumpUnlessLocalLessInteger: {
+        auto operands = bytecode::FusedOperands::Unpack(bc.parameter);
+        std::int64_t value = this->file.intConstants[operands.second];
+
+        // the sum of two inline integers can not overflow
+        if (!this->integerBits(value) || (instruction == ByteCodeInstruction::JumpUnlessLocalLessInteger && operands.third <= programCounter)) {
+          return false;
+        }
+
+        this->a.load(Register::Rax, Register::R13, slot(operands.first));
+        this->slowPaths.emplace_back(jumpUnlessType(this->a, encoding, Register::Rax, TraceType::Integer), programCounter);
+        unboxInteger(this->a, Register::Rax);
+        this->a.moveImmediate(Register::Rcx, static_cast<std::uint64_t>(value));
+
+        if (instruction == ByteCodeInstruction::JumpUnlessLocalLessInteger) {
+          // cmp rax, rcx
+          this->a.registers(0x39, Register::Rcx, Register::Rax);
+          this->jumpTo(this->a.jumpIf(Condition::GreaterOrEqual), operands.third);
+          return true;
+        }
+
+        // add rax, rcx
+        this->a.registers(0x01, Register::Rcx, Register::Rax);
+        this->slowPaths.emplace_back(boxInteger(this->a, encoding), programCounter);
+        this->a.store(Register::R13, slot(operands.first), Register::Rax);
+        return true;
+      }
+      default: {
+        return false;
+      }
+    }
+  }
+};
+
+#endif
+
+std::unique_ptr<NativeCode> Compiler::compile(
+  const bytecode::CompiledFile& file,
+  const std::vector<bytecode::ByteCode>& byteCode,
+  const TraceHelpers& helpers,
+  const ValueEncoding* encoding
+) noexcept {
+#if FLANG_JIT
+  constexpr auto limit = static_cast<std::size_t>(std::numeric_limits<std::int32_t>::max() / variableSize);
+
+  // program counters, jump targets and locals are immediates and
+  // displacements
+  if (byteCode.size() >= limit) {
+    return nullptr;
+  }
+
+  for (const auto& bc : byteCode) {
+    bool isLocal = bc.instruction == ByteCodeInstruction::LoadLocal || bc.instruction == ByteCodeInstruction::SetLocal;
+
+    if (isLocal && bc.parameter >= limit) {
+      return nullptr;
+    }
+  }
+
+  // booleans are made by setting the lowest bit of false
+  if (encoding != nullptr && encoding->trueBits != (encoding->falseBits | 1)) {
+    encoding = nullptr;
+  }
+
+  BaselineEmitter e{file, byteCode, helpers, encoding};
+  Assembler& a = e.a;
+
+  // push rbx; push r12; push r13; push r14; push r15, which also aligns the
+  // stack for the helpers
+  a.emit({0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});
+  a.move(Register::Rbx, Register::Rdi);
+  a.move(Register::R15, Register::Rsi);
+  a.load(Register::R13, Register::R15, offsetof(TraceState, locals));
+  a.load(Register::R12, Register::R15, offsetof(TraceState, stackTop));
+  // jmp rdx
+  a.emit({0xFF, 0xE2});
+
+  for (std::size_t i = 0; i < byteCode.size(); i++) {
+    e.offsets[i] = static_cast<std::uint32_t>(a.code.size());
+
+    if (!e.emitInline(i)) {
+      e.runHelper(i);
+    }
+  }
+
+  // verified code never runs past the end
+  e.offsets[byteCode.size()] = static_cast<std::uint32_t>(a.code.size());
+  e.leaves.push_back(a.jump());
+
+  // the slow paths run the helper instead, the op stack is as it was before
+  // the instruction
+  for (std::size_t i = 0; i < e.slowPaths.size(); i++) {
+    std::size_t programCounter = e.slowPaths[i].second;
+    std::size_t start = a.code.size();
+
+    // guards of the same instruction share the slow path
+    for (; i < e.slowPaths.size() && e.slowPaths[i].second == programCounter; i++) {
+      a.patch(e.slowPaths[i].first, start);
+    }
+    i--;
+
+    e.runHelper(programCounter);
+    e.jumpTo(a.jump(), programCounter + 1);
+  }
+
+  // leave: xor eax, eax
+  std::size_t leave = a.code.size();
+  a.emit({0x31, 0xC0});
+  emitEpilogue(a);
+
+  // interpret: the program counter is stored already; mov eax, 1
+  std::size_t interpret = a.code.size();
+  a.store(Register::R15, offsetof(TraceState, stackTop), Register::R12);
+  a.emit({0xB8, 0x01, 0x00, 0x00, 0x00});
+  emitEpilogue(a);
+
+  for (const auto& jump : e.jumps) {
+    // verified code only jumps within the function
+    if (jump.second >= e.offsets.size()) {
+      return nullptr;
+    }
+    a.patch(jump.first, e.offsets[jump.second]);
+  }
+
+  for (std::size_t at : e.leaves) {
+    a.patch(at, leave);
+  }
+
+  for (std::size_t at : e.interprets) {
+    a.patch(at, interpret);
+  }
+
+  void* memory = mapExecutable(a.code);
+
+  if (memory == nullptr) {
+    return nullptr;
+  }
+
+  return std::make_unique<NativeCode>(memory, a.code.size(), std::move(e.offsets));
+#else
+  static_cast<void>(file);
+  static_cast<void>(byteCode);
+  static_cast<void>(helpers);
+  static_cast<void>(encoding);
+  return nullptr;
+#endif
+}
+
+NativeTrace::NativeTrace(void* memory, std::size_t size) noexcept
+: memory{memory}
+, size{size}
+{}
+
+NativeTrace::~NativeTrace() {
+#if FLANG_JIT
+  munmap(this->memory, this->size);
+#endif
+}
+
+void NativeTrace::run(runtime::VirtualMachine* vm, TraceState* state) const noexcept {
+  using Entry = void (*)(runtime::VirtualMachine* vm, TraceState* state);
+
+  reinterpret_cast<Entry>(this->memory)(vm, state);
+}
+
+#if FLANG_JIT
+
+// where a value on the op stack of a trace is, values are only written to
+// their slot once something needs the op stack in memory
+struct StackEntry {
+  enum class Kind {
+    Slot,
+    Local,
+    Constant,
+  };
+
+  Kind kind;
+  // the index of a local or the bits of a constant
+  std::uint64_t value;
+};
+
+// a guard which leaves the trace before the instruction at programCounter,
+// with the op stack as it was then
+struct SideExit {
+  std::size_t jump;
+  std::vector<StackEntry> entries;
+  std::size_t programCounter;
+};
+
+// Emits the code of one trace, keeping track of where the values of the op
+// stack are while it goes.
+class TraceEmitter {
+public:
+  Assembler a;
+  const TraceHelpers& helpers;
+  const ValueEncoding& encoding;
+
+  std::vector<StackEntry> entries;
+  // false after a helper ran, the op stack is then all in memory and its
+  // depth is taken from the next step
+  bool isStackKnown;
+  bool hasHelperCalls;
+
+  std::vector<SideExit> sideExits;
+  // jumps to the epilogue, taken after a helper went somewhere else
+  std::vector<std::size_t> leaves;
+
+  explicit TraceEmitter(const TraceHelpers& helpers, const ValueEncoding& encoding) noexcept
+  : a{}
+  , helpers{helpers}
+  , encoding{encoding}
+  , entries{}
+  , isStackKnown{false}
+  , hasHelperCalls{false}
+  , sideExits{}
+  , leaves{}
+  {}
+
+  static std::int32_t slot(std::size_t index) {
+    return static_cast<std::int32_t>(index) * variableSize;
+  }
+
+  void begin(const TraceStep& step) {
+    if (!this->isStackKnown) {
+      this->entries.assign(step.stackDepth, StackEntry{StackEntry::Kind::Slot, 0});
+      this->isStackKnown = true;
+    }
+  }
+
+  void loadEntry(Register reg, std::size_t index) {
+    const StackEntry& entry = this->entries[index];
+
+    switch (entry.kind) {
+      case StackEntry::Kind::Slot: {
+        this->a.load(reg, Register::R14, slot(index));
+        break;
+      }
+      case StackEntry::Kind::Local: {
+        this->a.load(reg, Register::R13, slot(entry.value));
+        break;
+      }
+      case StackEntry::Kind::Constant: {
+        this->a.moveImmediate(reg, entry.value);
+        break;
+      }
+    }
+  }
+
+  static void materialize(Assembler& a, const StackEntry& entry, std::size_t index) {
+    switch (entry.kind) {
+      case StackEntry::Kind::Slot: {
+        return;
+      }
+      case StackEntry::Kind::Local: {
+        a.load(Register::Rdx, Register::R13, slot(entry.value));
+        break;
+      }
+      case StackEntry::Kind::Constant: {
+        a.moveImmediate(Register::Rdx, entry.value);
+        break;
+      }
+    }
+    a.store(Register::R14, slot(index), Register::Rdx);
+  }
+
+  void materializeAll() {
+    for (std::size_t i = 0; i < this->entries.size(); i++) {
+      materialize(this->a, this->entries[i], i);
+      this->entries[i] = StackEntry{StackEntry::Kind::Slot, 0};
+    }
+  }
+
+  // before local is written, values still read from it have to be copied
+  void materializeLocal(std::size_t local) {
+    for (std::size_t i = 0; i < this->entries.size(); i++) {
+      if (this->entries[i].kind == StackEntry::Kind::Local && this->entries[i].value == local) {
+        materialize(this->a, this->entries[i], i);
+        this->entries[i] = StackEntry{StackEntry::Kind::Slot, 0};
+      }
+    }
+  }
+
+  void exitIf(Condition condition, const TraceStep& step) {
+    this->exitAt(this->a.jumpIf(condition), step);
+  }
+
+  void exitAt(std::size_t jump, const TraceStep& step) {
+    this->sideExits.push_back(SideExit{jump, this->entries, step.programCounter});
+  }
+
+  void push(StackEntry entry) {
+    this->entries.push_back(entry);
+  }
+
+  void pop(std::size_t count) {
+    this->entries.resize(this->entries.size() - count);
+  }
+
+  // leaves unless reg holds a Variable of type, constants are known already
+  void guardType(Register reg, std::size_t index, TraceType type, const TraceStep& step) {
+    if (index < this->entries.size() && this->entries[index].kind == StackEntry::Kind::Constant) {
+      return;
+    }
+
+    this->exitAt(jumpUnlessType(this->a, this->encoding, reg, type), step);
+  }
+
+  // rax and rcx hold two doubles, xmm0 and xmm1 get them
+  void moveToFloats() {
+    // movq xmm0, rax; movq xmm1, rcx
+    this->a.emit({0x66, 0x48, 0x0F, 0x6E, 0xC0, 0x66, 0x48, 0x0F, 0x6E, 0xC9});
+  }
+
+  // loads the two operands of the instruction on top of the op stack into
+  // rax and rcx and checks their types
+  void loadOperands(const TraceStep& step) {
+    std::size_t first = this->entries.size() - 2;
+    this->loadEntry(Register::Rax, first);
+    this->loadEntry(Register::Rcx, first + 1);
+    this->guardType(Register::Rax, first, step.operands[0], step);
+    this->guardType(Register::Rcx, first + 1, step.operands[1], step);
+  }
+
+  // stores the result into local when it is not -1, for a SetLocal right
+  // after the instruction
+  void arithmetic(const TraceStep& step, ByteCodeInstruction instruction, std::int64_t local) {
+    this->loadOperands(step);
+
+    if (step.operands[0] == TraceType::Integer) {
+      unboxInteger(this->a, Register::Rax);
+      unboxInteger(this->a, Register::Rcx);
+
+      switch (instruction) {
+        case ByteCodeInstruction::Add: {
+          // add rax, rcx
+          this->a.registers(0x01, Register::Rcx, Register::Rax);
+          break;
+        }
+        case ByteCodeInstruction::Subtract: {
+          // sub rax, rcx
+          this->a.registers(0x29, Register::Rcx, Register::Rax);
+          break;
+        }
+        default: {
+          // imul rax, rcx
+          this->a.emit({0x48, 0x0F, 0xAF, 0xC1});
+          this->exitIf(Condition::Overflow, step);
+        }
+      }
+
+      this->exitAt(boxInteger(this->a, this->encoding), step);
+
+    } else {
+      this->moveToFloats();
+
+      switch (instruction) {
+        case ByteCodeInstruction::Add: this->a.emit({0xF2, 0x0F, 0x58, 0xC1}); break;
+        case ByteCodeInstruction::Subtract: this->a.emit({0xF2, 0x0F, 0x5C, 0xC1}); break;
+        case ByteCodeInstruction::Multiply: this->a.emit({0xF2, 0x0F, 0x59, 0xC1}); break;
+        default: this->a.emit({0xF2, 0x0F, 0x5E, 0xC1});
+      }
+
+      // movq rax, xmm0, then NaNs which look like tags become canonical
+      this->a.emit({0x66, 0x48, 0x0F, 0x7E, 0xC0});
+      this->a.move(Register::Rdx, Register::Rax);
+      this->a.shift(5, Register::Rdx, tagShift);
+      this->a.compare32(Register::Rdx, static_cast<std::uint32_t>(this->encoding.lastFloatTag));
+      std::size_t isFloat = this->a.jumpIf(Condition::BelowOrEqual);
+      this->a.moveImmediate(Register::Rax, this->encoding.canonicalNan);
+      this->a.patch(isFloat, this->a.code.size());
+    }
+
+    this->pop(2);
+
+    if (local >= 0) {
+      this->materializeLocal(static_cast<std::size_t>(local));
+      this->a.store(Register::R13, slot(static_cast<std::size_t>(local)), Register::Rax);
+      return;
+    }
+
+    this->a.store(Register::R14, slot(this->entries.size()), Register::Rax);
+    this->push(StackEntry{StackEntry::Kind::Slot, 0});
+  }
+
+  // compares the operands and returns the condition under which the
+  // comparison is true
+  Condition compare(const TraceStep& step, ByteCodeInstruction instruction) {
+    this->loadOperands(step);
+
+    if (step.operands[0] == TraceType::Integer) {
+      unboxInteger(this->a, Register::Rax);
+      unboxInteger(this->a, Register::Rcx);
+      // cmp rax, rcx
+      this->a.registers(0x39, Register::Rcx, Register::Rax);
+      return conditionOf(instruction);
+    }
+
+    // ucomisd leaves above and above or equal false for NaNs, so less than
+    // compares the operands the other way around
+    this->moveToFloats();
+
+    switch (instruction) {
+      case ByteCodeInstruction::Less: {
+        this->a.emit({0x66, 0x0F, 0x2E, 0xC8});
+        return Condition::Above;
+      }
+      case ByteCodeInstruction::LessOrEqual: {
+        this->a.emit({0x66, 0x0F, 0x2E, 0xC8});
+        return Condition::AboveOrEqual;
+      }
+      case ByteCodeInstruction::Greater: {
+        this->a.emit({0x66, 0x0F, 0x2E, 0xC1});
+        return Condition::Above;
+      }
+      default: {
+        this->a.emit({0x66, 0x0F, 0x2E, 0xC1});
+        return Condition::AboveOrEqual;
+      }
+    }
+  }
+
+  // pushes the boolean for condition
+  void pushBoolean(Condition condition) {
+    // setcc cl; movzx ecx, cl
+    this->a.emit({0x0F, static_cast<std::uint8_t>(0x90 | static_cast<std::uint8_t>(condition)), 0xC1, 0x0F, 0xB6, 0xC9});
+    this->a.moveImmediate(Register::Rax, this->encoding.falseBits);
+    // or rax, rcx
+    this->a.registers(0x09, Register::Rcx, Register::Rax);
+
+    this->a.store(Register::R14, slot(this->entries.size() - 2), Register::Rax);
+    this->pop(2);
+    this->push(StackEntry{StackEntry::Kind::Slot, 0});
+  }
+
+  // runs helper with the op stack in memory, and leaves unless the vm then
+  // is at nextProgramCounter
+  void callHelper(Helper helper, std::size_t programCounter, std::size_t nextProgramCounter) {
+    this->materializeAll();
+
+    this->a.lea(Register::Rax, Register::R14, slot(this->entries.size()));
+    this->a.store(Register::R15, offsetof(TraceState, stackTop), Register::Rax);
+    this->a.storeImmediate(Register::R15, offsetof(TraceState, programCounter), static_cast<std::int32_t>(programCounter));
+
+    this->a.move(Register::Rdi, Register::Rbx);
+    this->a.moveImmediate(Register::Rsi, reinterpret_cast<std::uint64_t>(helper));
+    this->a.moveImmediate(Register::Rax, reinterpret_cast<std::uint64_t>(this->helpers.call));
+    // call rax
+    this->a.emit({0xFF, 0xD0});
+
+    // the helper may have called or returned into another frame
+    this->a.load(Register::R13, Register::R15, offsetof(TraceState, locals));
+    this->a.load(Register::R14, Register::R15, offsetof(TraceState, stack));
+
+    // cmp rax, nextProgramCounter; jne leave
+    this->a.emit({0x48, 0x3D});
+    this->a.emit32(static_cast<std::uint32_t>(nextProgramCounter));
+    this->leaves.push_back(this->a.jumpIf(Condition::NotEqual));
+
+    this->isStackKnown = false;
+    this->hasHelperCalls = true;
+  }
+};
+
+static bool isTaken(const TraceStep& step) {
+  return step.nextProgramCounter != step.programCounter + 1;
+}
+
+// whether the step after index is the next instruction of the same function
+static bool isFollowedBy(const std::vector<TraceStep>& steps, std::size_t index, ByteCodeInstruction instruction) {
+  return index + 1 < steps.size()
+    && steps[index + 1].instruction == instruction
+    && steps[index + 1].programCounter == steps[index].programCounter + 1
+    && steps[index].nextProgramCounter == steps[index].programCounter + 1;
+}
+
+std::unique_ptr<NativeTrace> TraceCompiler::compile(
+  const std::vector<TraceStep>& steps,
+  const TraceHelpers& helpers,
+  const ValueEncoding& encoding
+) noexcept {
+  constexpr auto limit = static_cast<std::size_t>(std::numeric_limits<std::int32_t>::max() / variableSize);
+
+  // booleans are pushed by setting the lowest bit of false
+  if (steps.empty() || encoding.trueBits != (encoding.falseBits | 1)) {
+    return nullptr;
+  }
+
+  for (const auto& step : steps) {
+    bool isLocal = step.instruction == ByteCodeInstruction::LoadLocal || step.instruction == ByteCodeInstruction::SetLocal;
+
+    if (step.programCounter >= limit || step.nextProgramCounter >= limit || step.stackDepth >= limit || (isLocal && step.parameter >= limit)) {
+      return nullptr;
+    }
+  }
+
+  TraceEmitter e{helpers, encoding};
+  Assembler& a = e.a;
+
+  // push rbx; push r12; push r13; push r14; push r15, which also aligns the
+  // stack for the helpers
+  a.emit({0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});
+  // rbx keeps the vm, r15 the state, r13 the locals and r14 the op stack
+  a.move(Register::Rbx, Register::Rdi);
+  a.move(Register::R15, Register::Rsi);
+  a.load(Register::R13, Register::R15, offsetof(TraceState, locals));
+  a.load(Register::R14, Register::R15, offsetof(TraceState, stack));
+
+  std::size_t loop = a.code.size();
+
+  for (std::size_t i = 0; i < steps.size(); i++) {
+    const TraceStep& step = steps[i];
+    ByteCodeInstruction instruction = genericOf(step.instruction);
+    bool isInteger = step.operands[0] == TraceType::Integer && step.operands[1] == TraceType::Integer;
+    bool isFloat = step.operands[0] == TraceType::Float && step.operands[1] == TraceType::Float;
+
+    // the recording and the stack effects seen here have to agree
+    if (e.isStackKnown && e.entries.size() != step.stackDepth) {
+      return nullptr;
+    }
+
+    e.begin(step);
+
+    switch (instruction) {
+      case ByteCodeInstruction::Jump:
+      case ByteCodeInstruction::NoOp: {
+        continue;
+      }
+      case ByteCodeInstruction::LoadLocal: {
+        e.push(StackEntry{StackEntry::Kind::Local, step.parameter});
+        continue;
+      }
+      case ByteCodeInstruction::LoadIntegerConstant:
+      case ByteCodeInstruction::LoadFloatConstant:
+      case ByteCodeInstruction::LoadUndefinedConstant:
+      case ByteCodeInstruction::LoadBooleanTrueConstant:
+      case ByteCodeInstruction::LoadBooleanFalseConstant: {
+        // boxed integer constants are left to the helper
+        if (instruction == ByteCodeInstruction::LoadIntegerConstant && step.operands[0] != TraceType::Integer) {
+          break;
+        }
+        e.push(StackEntry{StackEntry::Kind::Constant, step.constant});
+        continue;
+      }
+      case ByteCodeInstruction::Pop: {
+        e.pop(1);
+        continue;
+      }
+      case ByteCodeInstruction::SetLocal: {
+        e.loadEntry(Register::Rax, e.entries.size() - 1);
+        e.pop(1);
+        e.materializeLocal(step.parameter);
+        a.store(Register::R13, TraceEmitter::slot(step.parameter), Register::Rax);
+        continue;
+      }
+      case ByteCodeInstruction::Add:
+      case ByteCodeInstruction::Subtract:
+      case ByteCodeInstruction::Multiply:
+      case ByteCodeInstruction::Divide: {
+        // integer division is left to the helper
+        if (isFloat || (isInteger && instruction != ByteCodeInstruction::Divide)) {
+          // the result goes straight into the local of a SetLocal
+          if (isFollowedBy(steps, i, ByteCodeInstruction::SetLocal)) {
+            e.arithmetic(step, instruction, static_cast<std::int64_t>(steps[++i].parameter));
+          } else {
+            e.arithmetic(step, instruction, -1);
+          }
+          continue;
+        }
+        break;
+      }
+      case ByteCodeInstruction::Less:
+      case ByteCodeInstruction::LessOrEqual:
+      case ByteCodeInstruction::Greater:
+      case ByteCodeInstruction::GreaterOrEqual: {
+        if (!isInteger && !isFloat) {
+          break;
+        }
+
+        bool isBranch = isFollowedBy(steps, i, ByteCodeInstruction::JumpIfFalse);
+
+        // the exit of a comparison and branch goes back before the
+        // comparison, which has no effects
+        std::vector<StackEntry> before = e.entries;
+        Condition condition = e.compare(step, instruction);
+
+        if (isBranch) {
+          const TraceStep& branch = steps[++i];
+          e.sideExits.push_back(SideExit{
+            a.jumpIf(isTaken(branch) ? condition : negate(condition)),
+            std::move(before),
+            step.programCounter
+          });
+          e.pop(2);
+          continue;
+        }
+
+        e.pushBoolean(condition);
+        continue;
+      }
+      case ByteCodeInstruction::JumpIfFalse: {
+        if (step.operands[0] != TraceType::Boolean) {
+          break;
+        }
+
+        e.loadEntry(Register::Rax, e.entries.size() - 1);
+        a.moveImmediate(Register::Rcx, isTaken(step) ? encoding.falseBits : encoding.trueBits);
+        // cmp rax, rcx
+        a.registers(0x39, Register::Rcx, Register::Rax);
+        e.exitIf(Condition::NotEqual, step);
+        e.pop(1);
+        continue;
+      }
+      case ByteCodeInstruction::JumpUnlessLocalLessInteger:
+      case ByteCodeInstruction::AddIntegerToLocal: {
+        if (step.operands[0] != TraceType::Integer) {
+          break;
+        }
+
+        auto operands = bytecode::FusedOperands::Unpack(step.parameter);
+
+        a.load(Register::Rax, Register::R13, TraceEmitter::slot(operands.first));
+        e.guardType(Register::Rax, e.entries.size(), TraceType::Integer, step);
+        unboxInteger(a, Register::Rax);
+        a.moveImmediate(Register::Rcx, step.constant);
+
+        if (instruction == ByteCodeInstruction::JumpUnlessLocalLessInteger) {
+          // cmp rax, rcx
+          a.registers(0x39, Register::Rcx, Register::Rax);
+          e.exitIf(isTaken(step) ? Condition::Less : Condition::GreaterOrEqual, step);
+          continue;
+        }
+
+        // add rax, rcx
+        a.registers(0x01, Register::Rcx, Register::Rax);
+        e.exitAt(boxInteger(a, encoding), step);
+        e.materializeLocal(operands.first);
+        a.store(Register::R13, TraceEmitter::slot(operands.first), Register::Rax);
+        continue;
+      }
+      default: {
+        break;
+      }
+    }
+
+    if (instruction == ByteCodeInstruction::Invoke) {
+      a.moveImmediate(Register::Rax, reinterpret_cast<std::uint64_t>(step.callee));
+      a.store(Register::R15, offsetof(TraceState, callee), Register::Rax);
+      e.callHelper(helpers.invoke, step.programCounter, step.nextProgramCounter);
+    } else {
+      Helper helper = (*helpers.instructions)[static_cast<std::size_t>(step.instruction)];
+
+      if (helper == nullptr) {
+        return nullptr;
+      }
+
+      e.callHelper(helper, step.programCounter, step.nextProgramCounter);
+    }
+  }
+
+  // back at the loop header, the first step starts from an op stack in
+  // memory again
+  e.begin(steps.front());
+  e.materializeAll();
+
+  if (e.hasHelperCalls) {
+    // helpers may allocate, so the back edge collects like the interpreter's
+    e.callHelper(helpers.backEdge, steps.front().programCounter, steps.front().programCounter);
+  }
+
+  a.patch(a.jump(), loop);
+
+  for (const auto& exit : e.sideExits) {
+    a.patch(exit.jump, a.code.size());
+
+    for (std::size_t i = 0; i < exit.entries.size(); i++) {
+      TraceEmitter::materialize(a, exit.entries[i], i);
+    }
+
+    a.lea(Register::Rax, Register::R14, TraceEmitter::slot(exit.entries.size()));
+    a.store(Register::R15, offsetof(TraceState, stackTop), Register::Rax);
+    a.storeImmediate(Register::R15, offsetof(TraceState, programCounter), static_cast<std::int32_t>(exit.programCounter));
+    e.leaves.push_back(a.jump());
+  }
+
+  std::size_t epilogue = a.code.size();
+  emitEpilogue(a);
+
+  for (std::size_t at : e.leaves) {
+    a.patch(at, epilogue);
+  }
+
+  void* memory = mapExecutable(a.code);
+
+  if (memory == nullptr) {
+    return nullptr;
+  }
+
+  return std::make_unique<NativeTrace>(memory, a.code.size());
+}
+
+#else
+
+std::unique_ptr<NativeTrace> TraceCompiler::compile(
+  const std::vector<TraceStep>& steps,
+  const TraceHelpers& helpers,
+  const ValueEncoding& encoding
+) noexcept {
+  static_cast<void>(steps);
+  static_cast<void>(helpers);
+  static_cast<void>(encoding);
+  return nullptr;
+}
+
+#endif
+
+}
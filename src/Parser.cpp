@@ -272,24 +272,12 @@ Parser::parseBlockStatement() noexcept {
   return std::make_shared<BlockStatementAstNode>(statements);
 }
 
-const std::optional<std::shared_ptr<ExpressionStatementAstNode>>
-Parser::parseExpressionStatement() noexcept {
-  auto expr = this->parseExpression();
-  bool error = false;
-  this->expect(TokenType::SemiColon, error, "Expected a semicolon following expression statement");
-
-  if (error || !expr) {
-    return std::nullopt;
-  }
-
-  return std::make_shared<ExpressionStatementAstNode>(expr.value());
-}
-
 const std::optional<std::shared_ptr<StatementAstNode>>
 Parser::parseAssignOrExpressionStatement() noexcept {
 
+  // anything else may still be indexed and assigned to
   if (this->tokenBuffer->currentToken()->tokenType != TokenType::Identifier) {
-    return this->parseExpressionStatement();
+    return this->parseIndexAssignOrExpressionStatement();
   }
 
   std::size_t lookAhead = 1;
@@ -301,7 +289,40 @@ Parser::parseAssignOrExpressionStatement() noexcept {
     return this->parseAssignStatement();
   }
 
-  return this->parseExpressionStatement();
+  return this->parseIndexAssignOrExpressionStatement();
+}
+
+const std::optional<std::shared_ptr<StatementAstNode>>
+Parser::parseIndexAssignOrExpressionStatement() noexcept {
+  auto expr = this->parseExpression();
+  bool error = false;
+
+  // only once the index expression has been parsed is it known whether it
+  // is being assigned to
+  auto index = expr ? std::dynamic_pointer_cast<IndexExpressionAstNode>(expr.value()) : nullptr;
+
+  if (index == nullptr || this->tokenBuffer->currentToken()->tokenType != TokenType::Assign) {
+    this->expect(TokenType::SemiColon, error, "Expected a semicolon following expression statement");
+
+    if (error || !expr) {
+      return std::nullopt;
+    }
+
+    return std::make_shared<ExpressionStatementAstNode>(expr.value());
+  }
+
+  this->expect(TokenType::Assign, error, "Expected an equals following index");
+
+  auto expression = this->parseExpression();
+
+  this->expect(TokenType::SemiColon, error,
+    "Expected a semicolon following expression of index assignment");
+
+  error = error || !expression;
+
+  if (error) { return std::nullopt; }
+
+  return std::make_shared<IndexAssignStatementAstNode>(index->array, index->index, expression.value());
 }
 
 const std::optional<std::shared_ptr<ExpressionAstNode>>
@@ -313,29 +334,33 @@ Parser::parseExpression() noexcept {
   switch (this->tokenBuffer->currentToken()->tokenType)  {
     case TokenType::LeftCurly:
       e = this->parseObjectDeclarationExpression();
-      this->skipWhiteSpace();
-      return e;
+      break;
+    case TokenType::LeftBracket:
+      e = this->parseArrayDeclarationExpression();
+      break;
     case TokenType::Function:
       e = this->parseFunctionDeclarationExpression();
-      this->skipWhiteSpace();
-      return e;
+      break;
     case TokenType::BooleanLiteral:
     case TokenType::StringLiteral:
     case TokenType::IntegerLiteral:
     case TokenType::FloatLiteral:
     case TokenType::UndefinedLiteral:
       e = this->parseLiteralExpression();
-      this->skipWhiteSpace();
-      return e;
+      break;
     case TokenType::BuiltInFunctionName:
       e = this->parseBuiltInFunctionInvocationExpression();
-      this->skipWhiteSpace();
-      return e;
+      break;
     default:
       e = this->parseIdentifierOrFunctionInvocationExpression();
-      this->skipWhiteSpace();
-      return e;
   }
+
+  if (!e) { return std::nullopt; }
+
+  // any expression can be indexed
+  e = this->parseIndexExpression(e.value());
+  this->skipWhiteSpace();
+  return e;
 }
 
 const std::optional<std::shared_ptr<LiteralExpressionAstNode>>
@@ -384,6 +409,33 @@ Parser::parseIdentifierOrFunctionInvocationExpression() noexcept {
   return this->parseIdentiferExpression();
 }
 
+const std::optional<std::shared_ptr<ExpressionAstNode>>
+Parser::parseIndexExpression(std::shared_ptr<ExpressionAstNode> array) noexcept {
+  bool error = false;
+
+  while (true) {
+    this->skipWhiteSpace();
+
+    if (this->tokenBuffer->currentToken()->tokenType != TokenType::LeftBracket) {
+      break;
+    }
+
+    this->expect(TokenType::LeftBracket, error, "Expected a left bracket to begin index");
+
+    auto index = this->parseExpression();
+
+    this->expect(TokenType::RightBracket, error, "Expected a right bracket to end index");
+
+    error = error || !index;
+
+    if (error) { return std::nullopt; }
+
+    array = std::make_shared<IndexExpressionAstNode>(array, index.value());
+  }
+
+  return array;
+}
+
 template<typename T>
 const std::optional<std::shared_ptr<T>> parseFunctionInvocationLike(Parser* parser, TokenType tokenTypeToExpect) {
   bool error = false;
@@ -587,6 +639,52 @@ Parser::parseObjectDeclarationExpression() noexcept {
   return std::make_shared<ObjectDeclarationExpressionAstNode>(keyValues);
 }
 
+const std::optional<std::shared_ptr<ArrayDeclarationExpressionAstNode>>
+Parser::parseArrayDeclarationExpression() noexcept {
+  bool error = false;
+  this->expect(TokenType::LeftBracket, error,
+    "Expected a left bracket to begin array declaration");
+
+  std::vector<std::shared_ptr<ExpressionAstNode>> expressions;
+
+  while (true) {
+    this->skipWhiteSpace();
+
+    if (this->tokenBuffer->currentToken()->tokenType == TokenType::EndOfFile) {
+      this->expect(TokenType::RightBracket, error,
+        "Expected a right bracket to end array declaration");
+      return std::nullopt;
+    }
+
+    if (this->tokenBuffer->currentToken()->tokenType == TokenType::RightBracket) {
+      this->expect(TokenType::RightBracket, error,
+        "Expected a right bracket to end array declaration");
+      break;
+    }
+
+    auto value = this->parseExpression();
+
+    if (!value) {
+      error = true;
+
+    } else {
+      expressions.push_back(value.value());
+    }
+
+    if (this->tokenBuffer->currentToken()->tokenType == TokenType::RightBracket) {
+      this->expect(TokenType::RightBracket, error,
+        "Expected a right bracket to end array declaration");
+      break;
+    }
+
+    this->expect(TokenType::Comma, error, "Expected a comma between array elements");
+  }
+
+  if (error) { return std::nullopt; }
+
+  return std::make_shared<ArrayDeclarationExpressionAstNode>(expressions);
+}
+
 void Parser::skipWhiteSpace() noexcept {
   while (
       this->tokenBuffer->currentToken()->tokenType != TokenType::EndOfFile
@@ -0,0 +1,293 @@
+#include "PeepholeOptimizer.hpp"
+
+namespace compiler {
+
+using bytecode::ByteCode;
+using bytecode::ByteCodeInstruction;
+
+// a mutable copy of a bytecode::ByteCode, removed instructions stay in place
+// until the end of each pass so that jump targets keep their meaning
+struct Instruction {
+  ByteCodeInstruction instruction;
+  std::size_t parameter;
+  bool isRemoved;
+};
+
+static bool isJump(ByteCodeInstruction instruction) {
+  return instruction == ByteCodeInstruction::Jump || instruction == ByteCodeInstruction::JumpIfFalse;
+}
+
+// pushes a value without any other effect
+static bool isPurePush(ByteCodeInstruction instruction) {
+  switch (instruction) {
+    case ByteCodeInstruction::LoadIntegerConstant:
+    case ByteCodeInstruction::LoadFloatConstant:
+    case ByteCodeInstruction::LoadStringConstant:
+    case ByteCodeInstruction::LoadUndefinedConstant:
+    case ByteCodeInstruction::LoadBooleanTrueConstant:
+    case ByteCodeInstruction::LoadBooleanFalseConstant:
+    case ByteCodeInstruction::LoadLocal:
+    case ByteCodeInstruction::LoadClosure: {
+      return true;
+    }
+    default: {
+      return false;
+    }
+  }
+}
+
+// follows target through unconditional jumps, a cycle of jumps is left alone
+static std::size_t threadJump(const std::vector<Instruction>& code, std::size_t target) {
+  for (std::size_t steps = 0; steps < code.size(); steps++) {
+    if (target >= code.size() || code[target].instruction != ByteCodeInstruction::Jump || code[target].parameter == target) {
+      return target;
+    }
+    target = code[target].parameter;
+  }
+
+  return target;
+}
+
+static void remove(Instruction& instruction) {
+  instruction.isRemoved = true;
+}
+
+static void replace(Instruction& instruction, ByteCodeInstruction replacement, std::size_t parameter) {
+  instruction.instruction = replacement;
+  instruction.parameter = parameter;
+}
+
+static bool simplify(
+  std::vector<Instruction>& code,
+  const std::vector<bytecode::Function>& functions,
+  std::size_t localsCount
+) {
+  bool changed = false;
+
+  for (auto& ins : code) {
+    if (isJump(ins.instruction)) {
+      std::size_t target = threadJump(code, ins.parameter);
+
+      if (target != ins.parameter) {
+        ins.parameter = target;
+        changed = true;
+      }
+    }
+  }
+
+  std::vector<bool> isJumpTarget(code.size(), false);
+  // how many instructions read each local, functions capturing a local count
+  // as reading it
+  std::vector<std::size_t> readers(localsCount, 0);
+
+  for (const auto& ins : code) {
+    if (isJump(ins.instruction) && ins.parameter < code.size()) {
+      isJumpTarget[ins.parameter] = true;
+    }
+
+    if (ins.instruction == ByteCodeInstruction::LoadLocal && ins.parameter < localsCount) {
+      readers[ins.parameter]++;
+    }
+
+    if (ins.instruction == ByteCodeInstruction::MakeFn && ins.parameter < functions.size()) {
+      for (const auto& closure : functions[ins.parameter].closures) {
+        if (closure.isLocal && closure.index < localsCount) {
+          readers[closure.index]++;
+        }
+      }
+    }
+  }
+
+  for (std::size_t i = 0; i < code.size(); i++) {
+    Instruction& ins = code[i];
+
+    // pairs are only rewritten when no jump lands on their second half
+    Instruction* next = i + 1 < code.size() && !isJumpTarget[i + 1] ? &code[i + 1] : nullptr;
+
+    switch (ins.instruction) {
+      case ByteCodeInstruction::Jump: {
+        if (ins.parameter == i + 1) {
+          remove(ins);
+          changed = true;
+        }
+        break;
+      }
+      case ByteCodeInstruction::JumpIfFalse: {
+        if (ins.parameter == i + 1) {
+          replace(ins, ByteCodeInstruction::Pop, 0);
+          changed = true;
+        }
+        break;
+      }
+      case ByteCodeInstruction::SetLocal: {
+        if (ins.parameter >= localsCount) {
+          break;
+        }
+
+        if (readers[ins.parameter] == 0) {
+          // nothing reads the local
+          replace(ins, ByteCodeInstruction::Pop, 0);
+          changed = true;
+
+        } else if (
+          readers[ins.parameter] == 1
+          && next != nullptr
+          && next->instruction == ByteCodeInstruction::LoadLocal
+          && next->parameter == ins.parameter
+        ) {
+          // the load right after the store is the only read, so the value can
+          // stay on the op stack
+          remove(ins);
+          remove(*next);
+          changed = true;
+          i++;
+        }
+        break;
+      }
+      default: {
+        if (!isPurePush(ins.instruction) || next == nullptr) {
+          break;
+        }
+
+        if (next->instruction == ByteCodeInstruction::Pop) {
+          remove(ins);
+          remove(*next);
+          changed = true;
+          i++;
+
+        } else if (next->instruction == ByteCodeInstruction::JumpIfFalse) {
+          // while (true) and friends
+          if (ins.instruction == ByteCodeInstruction::LoadBooleanTrueConstant) {
+            remove(ins);
+            remove(*next);
+            changed = true;
+            i++;
+
+          } else if (ins.instruction == ByteCodeInstruction::LoadBooleanFalseConstant) {
+            remove(ins);
+            replace(*next, ByteCodeInstruction::Jump, next->parameter);
+            changed = true;
+            i++;
+          }
+        }
+      }
+    }
+  }
+
+  // removed instructions do nothing, so they fall through to the next one
+  std::vector<bool> isReachable(code.size(), false);
+  std::vector<std::size_t> workList;
+
+  auto reach = [&](std::size_t index) {
+    if (index < code.size() && !isReachable[index]) {
+      isReachable[index] = true;
+      workList.push_back(index);
+    }
+  };
+
+  reach(0);
+
+  while (!workList.empty()) {
+    std::size_t index = workList.back();
+    workList.pop_back();
+
+    const Instruction& ins = code[index];
+
+    if (ins.isRemoved) {
+      reach(index + 1);
+      continue;
+    }
+
+    switch (ins.instruction) {
+      case ByteCodeInstruction::Halt:
+      case ByteCodeInstruction::Return: {
+        break;
+      }
+      case ByteCodeInstruction::Jump: {
+        reach(ins.parameter);
+        break;
+      }
+      case ByteCodeInstruction::JumpIfFalse: {
+        reach(ins.parameter);
+        reach(index + 1);
+        break;
+      }
+      default: {
+        reach(index + 1);
+      }
+    }
+  }
+
+  for (std::size_t i = 0; i < code.size(); i++) {
+    if (!isReachable[i] && !code[i].isRemoved) {
+      remove(code[i]);
+      changed = true;
+    }
+  }
+
+  // a jump to a removed instruction goes on to the next one that is kept
+  std::vector<std::size_t> newIndex(code.size() + 1, 0);
+  std::vector<Instruction> kept;
+  kept.reserve(code.size());
+
+  for (std::size_t i = 0; i < code.size(); i++) {
+    newIndex[i] = kept.size();
+
+    if (!code[i].isRemoved) {
+      kept.push_back(code[i]);
+    }
+  }
+  newIndex[code.size()] = kept.size();
+
+  for (auto& ins : kept) {
+    if (isJump(ins.instruction) && ins.parameter < newIndex.size()) {
+      ins.parameter = newIndex[ins.parameter];
+    }
+  }
+
+  code = std::move(kept);
+
+  return changed;
+}
+
+bytecode::Function PeepholeOptimizer::optimize(
+  const std::vector<bytecode::Function>& functions,
+  const std::vector<bytecode::ObjectConstructor>& objects,
+  const bytecode::Function& fn
+) noexcept {
+
+  std::vector<Instruction> code;
+  code.reserve(fn.byteCode.size());
+
+  for (const auto& bc : fn.byteCode) {
+    code.push_back(Instruction{bc.instruction, bc.parameter, false});
+  }
+
+  while (simplify(code, functions, fn.localsCount)) {}
+
+  std::vector<ByteCode> byteCode;
+  byteCode.reserve(code.size());
+
+  // every statement still leaves the op stack empty, so the depth can be
+  // followed in order the same way the compiler does
+  std::size_t stackDepth = 0;
+  std::size_t maxStack = 0;
+
+  for (const auto& ins : code) {
+    byteCode.emplace_back(ins.instruction, ins.parameter);
+
+    bytecode::StackEffect effect = bytecode::stackEffect(objects, byteCode.back());
+    stackDepth = stackDepth - effect.pops + effect.pushes;
+    maxStack = std::max(maxStack, stackDepth);
+  }
+
+  return bytecode::Function{
+    fn.argumentCount,
+    fn.localsCount,
+    maxStack,
+    fn.closures,
+    std::move(byteCode)
+  };
+}
+
+}
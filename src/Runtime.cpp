@@ -6,986 +6,3551 @@ enum class VariableType {
   Undefined,
   Integer,
   Boolean,
-  Float,
   String,
   Object,
   Function,
+  Array,
+  Float,
 };
 
-struct Object;
-
-struct ClosureContext {
-  const StackFrame* stackFrame;
-  std::size_t scopeIndex;
+// the names type() returns, in the order of VariableType
+static constexpr std::array<std::string_view, 8> typeNames{
+  "undefined",
+  "integer",
+  "boolean",
+  "string",
+  "object",
+  "function",
+  "array",
+  "float",
 };
 
-struct Function {
-  std::vector<runtime::ClosureContext> captures;
-  std::shared_ptr<StackFrame> scopeOuter;
-  const bytecode::Function* fn;
-};
+struct Object;
+struct Array;
 
-struct Variable {
-  VariableType type;
+enum class HeapObjectType {
+  String,
+  Function,
+  Object,
+  Upvalue,
+  Integer,
+  Rope,
+  Array,
+};
 
-  union {
-    std::int64_t integerValue;
-    double doubleValue;
-    bool boolValue;
-    Object* objectValue;
-    Function* functionValue;
-    const std::string* stringValue;
-  };
+// Every allocation made by the Heap starts with this header. Old objects are
+// linked into the list of all old allocations through nextObject and hold
+// their mark for the major collector. Young objects live in the nursery,
+// their nextObject is the promoted copy once a minor collection moved them.
+struct HeapObject {
+  HeapObjectType heapObjectType;
+  bool isMarked;
+  bool isYoung;
+  bool isRemembered;
+  HeapObject* nextObject;
 };
 
-struct Object {
-  std::unordered_map<std::string, Variable> properties;
+// Heap objects keep their own memory in pmr containers, young objects are
+// given the nursery's resource so that all of their memory goes away with
+// the nursery and dead young objects never need their destructors run.
+
+// Strings are never modified once they have been filled in. Interned strings
+// are the canonical copy of their contents, they are always old and equal
+// interned strings are the same object.
+struct String : HeapObject {
+  std::pmr::string value;
+  std::size_t hash;
+  bool hasHash;
+  bool isInterned;
+
+  explicit String(std::pmr::memory_resource* resource) noexcept
+  : HeapObject{}
+  , value{resource}
+  , hash{0}
+  , hasHash{false}
+  , isInterned{false}
+  {}
 };
 
-struct StackFrame {
-  std::size_t programCounter;
-  std::vector<Variable> locals;
-  const runtime::Function* function;
-  std::shared_ptr<StackFrame> outer;
-  std::vector<Variable> opStack;
+// Appending long strings makes a rope which only points at its two halves.
+// value is filled in by flattenString when the contents are first needed and
+// the halves are let go.
+struct Rope : String {
+  String* left;
+  String* right;
+  std::size_t length;
+
+  explicit Rope(std::pmr::memory_resource* resource) noexcept
+  : String{resource}
+  , left{nullptr}
+  , right{nullptr}
+  , length{0}
+  {}
 };
 
-void runtime::VirtualMachine::run() noexcept {
+// appends shorter than this are copied rather than made into ropes
+static constexpr std::size_t minRopeLength = 32;
 
-  runtime::Function* fn = this->heap.NewFunction();
-  fn->captures.clear();
-  fn->scopeOuter = nullptr;
-  fn->fn = &this->file->entrypoint;
-  this->pushStackFrame(fn);
+// ropes are never empty, so one without a value has not been flattened
+static bool isRope(const String* str) noexcept {
+  return str->heapObjectType == HeapObjectType::Rope && str->value.empty();
+}
 
-  this->heap.StartGc();
+static std::size_t stringLength(const String* str) noexcept {
+  return isRope(str) ? static_cast<const Rope*>(str)->length : str->value.size();
+}
 
-  while (true) {
-    if (this->isDebug) {
-      this->out << "BEGIN DEBUG\n";
-      this->print();
-      this->out << "END DEBUG\n";
+static void flattenRope(Rope* str) {
+  // ropes built by appending in a loop are as deep as they are long, so
+  // they are walked with an explicit stack
+  std::pmr::string value{str->value.get_allocator()};
+  value.reserve(str->length);
 
-      std::string ignore;
-      std::getline(std::cin, ignore);
-    }
+  std::vector<const String*> pending{str};
 
-    if (this->stackFrame->programCounter >= this->stackFrame->function->fn->byteCode.size()) {
-      this->panic("Program counter overran bytecode!");
-      return;
-    }
+  while (!pending.empty()) {
+    const String* current = pending.back();
+    pending.pop_back();
 
-    auto instruction = this->stackFrame->function->fn->byteCode.at(this->stackFrame->programCounter).instruction;
-
-    switch (instruction) {
-      case bytecode::ByteCodeInstruction::Halt: { this->heap.EndGc(); return; }
-      case bytecode::ByteCodeInstruction::Add: { this->Add(); break; }
-      case bytecode::ByteCodeInstruction::Subtract: { this->Subtract(); break; }
-      case bytecode::ByteCodeInstruction::Multiply: { this->Multiply(); break; }
-      case bytecode::ByteCodeInstruction::Divide: { this->Divide(); break; }
-      case bytecode::ByteCodeInstruction::Print: { this->Print(); break; }
-      case bytecode::ByteCodeInstruction::Read: { this->Read(); break; }
-      case bytecode::ByteCodeInstruction::Jump: { this->Jump(); break; }
-      case bytecode::ByteCodeInstruction::JumpIfFalse: { this->JumpIfFalse(); break; }
-      case bytecode::ByteCodeInstruction::LoadIntegerConstant: { this->LoadIntegerConstant(); break; }
-      case bytecode::ByteCodeInstruction::LoadFloatConstant: { this->LoadFloatConstant(); break; }
-      case bytecode::ByteCodeInstruction::LoadStringConstant: { this->LoadStringConstant(); break; }
-      case bytecode::ByteCodeInstruction::LoadUndefinedConstant: { this->LoadUndefinedConstant(); break; }
-      case bytecode::ByteCodeInstruction::LoadBooleanTrueConstant: { this->LoadBooleanTrueConstant(); break; }
-      case bytecode::ByteCodeInstruction::LoadBooleanFalseConstant: { this->LoadBooleanFalseConstant(); break; }
-      case bytecode::ByteCodeInstruction::LoadLocal: { this->LoadLocal(); break; }
-      case bytecode::ByteCodeInstruction::SetLocal: { this->SetLocal(); break; }
-      case bytecode::ByteCodeInstruction::Return: { this->Return(); break; }
-      case bytecode::ByteCodeInstruction::Invoke: { this->Invoke(); break; }
-      case bytecode::ByteCodeInstruction::NoOp: { break; }
-      case bytecode::ByteCodeInstruction::MakeFn: { this->MakeFn(); break; }
-      case bytecode::ByteCodeInstruction::MakeObj: { this->MakeObj(); break; }
-      case bytecode::ByteCodeInstruction::Less: { this->Less(); break; }
-      case bytecode::ByteCodeInstruction::LessOrEqual: { this->LessOrEqual(); break; }
-      case bytecode::ByteCodeInstruction::Greater: { this->Greater(); break; }
-      case bytecode::ByteCodeInstruction::GreaterOrEqual: { this->GreaterOrEqual(); break; }
-      case bytecode::ByteCodeInstruction::Not: { this->Not(); break; }
-      case bytecode::ByteCodeInstruction::Equal: { this->Equal(); break; }
-      case bytecode::ByteCodeInstruction::NotEqual: { this->NotEqual(); break; }
-      case bytecode::ByteCodeInstruction::And: { this->And(); break; }
-      case bytecode::ByteCodeInstruction::Or: { this->Or(); break; }
-      case bytecode::ByteCodeInstruction::GetType: { this->GetType(); break; }
-      case bytecode::ByteCodeInstruction::CastToInt: { this->CastToInt(); break; }
-      case bytecode::ByteCodeInstruction::CastToFloat: { this->CastToFloat(); break; }
-      case bytecode::ByteCodeInstruction::Length: { this->Length(); break; }
-      case bytecode::ByteCodeInstruction::ChatAt: { this->ChatAt(); break; }
-      case bytecode::ByteCodeInstruction::StringAppend: { this->StringAppend(); break; }
-      case bytecode::ByteCodeInstruction::ObjectGet: { this->ObjectGet(); break; }
-      case bytecode::ByteCodeInstruction::ObjectSet: { this->ObjectSet(); break; }
-      case bytecode::ByteCodeInstruction::GetEnv: { this->GetEnv(); break; }
-      case bytecode::ByteCodeInstruction::LoadClosure: { this->LoadClosure(); break; }
-      case bytecode::ByteCodeInstruction::Pop: { this->Pop(); break; }
-      default: {
-        this->panic("Unknown bytecode found in instructions!");
-        return;
-      }
+    if (isRope(current)) {
+      pending.push_back(static_cast<const Rope*>(current)->right);
+      pending.push_back(static_cast<const Rope*>(current)->left);
+    } else {
+      value.append(current->value);
     }
   }
 
-  this->heap.EndGc();
-
-  return;
+  str->value.swap(value);
+  str->left = nullptr;
+  str->right = nullptr;
 }
 
-void runtime::VirtualMachine::popStackFrame() {
-  auto currentFrame = this->stackFrame;
-
-  if (currentFrame == nullptr) {
-    this->panic("No current stack frame found!");
-    return;
-  }
-
-  auto outer = currentFrame->outer;
-
-  if (outer == nullptr) {
-    this->panic("No outer stack frame found!");
-    return;
+static const std::pmr::string& flattenString(String* str) {
+  if (isRope(str)) {
+    flattenRope(static_cast<Rope*>(str));
   }
 
-  this->stackFrame = outer;
+  return str->value;
 }
 
-void runtime::VirtualMachine::pushStackFrame(const runtime::Function* function) {
-  auto newFrame = std::make_shared<StackFrame>();
+struct Function : HeapObject {
+  std::pmr::vector<runtime::Upvalue*> captures;
+  const bytecode::Function* fn;
+  Prototype* prototype;
+
+  explicit Function(std::pmr::memory_resource* resource) noexcept
+  : HeapObject{}
+  , captures{resource}
+  , fn{nullptr}
+  , prototype{nullptr}
+  {}
+};
 
-  for (std::size_t i = 0; i < function->fn->localsCount; i++) {
-    Variable undefined{};
-    undefined.type = VariableType::Undefined;
-    newFrame->locals.push_back(undefined);
-  }
+// Small integers are stored inline, integers that do not fit are boxed on the
+// heap so that the language keeps full 64 bit integers.
+struct BoxedInteger : HeapObject {
+  std::int64_t value;
 
-  newFrame->outer = this->stackFrame;
-  newFrame->programCounter = 0;
-  newFrame->function = function;
+  explicit BoxedInteger(std::pmr::memory_resource* /*resource*/) noexcept
+  : HeapObject{}
+  , value{0}
+  {}
+};
 
-  this->stackFrame = newFrame;
-}
+// Variables are packed into 64 bits when the platform's pointers fit into 48
+// bits, see FLANG_NAN_BOXING in flang.h.
+#if FLANG_NAN_BOXING
 
-Variable runtime::VirtualMachine::popOpStack() {
-  if (this->stackFrame == nullptr) {
-    this->panic("No active stack frame found to pop op stack from!");
+// Doubles are stored as themselves. Every other value is a negative NaN with
+// the tag in the top 16 bits and the payload in the low 48 bits, so the only
+// doubles which have to be rewritten are NaNs carrying a payload which would
+// collide with a tag. They become the NaN with lastFloatTag, which keeps the
+// sign of the NaNs arithmetic produces.
+struct Variable {
+private:
+  static constexpr int tagShift = 48;
+  static constexpr std::uint64_t payloadMask = (std::uint64_t{1} << tagShift) - 1;
+
+  // the tags of values other than doubles follow VariableType, boxed
+  // integers take the last tag and tags from stringTag up point to the heap
+  static constexpr std::uint64_t lastFloatTag = 0xFFF7;
+  static constexpr std::uint64_t undefinedTag = 0xFFF8;
+  static constexpr std::uint64_t integerTag = undefinedTag + static_cast<std::uint64_t>(VariableType::Integer);
+  static constexpr std::uint64_t booleanTag = undefinedTag + static_cast<std::uint64_t>(VariableType::Boolean);
+  static constexpr std::uint64_t stringTag = undefinedTag + static_cast<std::uint64_t>(VariableType::String);
+  static constexpr std::uint64_t objectTag = undefinedTag + static_cast<std::uint64_t>(VariableType::Object);
+  static constexpr std::uint64_t functionTag = undefinedTag + static_cast<std::uint64_t>(VariableType::Function);
+  static constexpr std::uint64_t arrayTag = undefinedTag + static_cast<std::uint64_t>(VariableType::Array);
+  static constexpr std::uint64_t boxedIntegerTag = 0xFFFF;
+
+  // code emitted by compiler::CEmitter works on the same bits
+  static_assert(tagShift == FLANG_TAG_SHIFT, "flang.h must match Variable");
+  static_assert(lastFloatTag == FLANG_LAST_FLOAT_TAG, "flang.h must match Variable");
+  static_assert(undefinedTag == FLANG_UNDEFINED_TAG, "flang.h must match Variable");
+  static_assert(integerTag == FLANG_INTEGER_TAG, "flang.h must match Variable");
+  static_assert(booleanTag == FLANG_BOOLEAN_TAG, "flang.h must match Variable");
+
+  std::uint64_t bits;
+
+  static Variable tagged(std::uint64_t tag, std::uint64_t payload) noexcept {
+    Variable ret;
+    ret.bits = (tag << tagShift) | (payload & payloadMask);
+    return ret;
   }
 
-  auto opStack = &this->stackFrame->opStack;
-
-  if (opStack->empty()) {
-    this->panic("Could not pop op stack, it is empty!");
+  static Variable pointer(std::uint64_t tag, const HeapObject* object) noexcept {
+    return tagged(tag, reinterpret_cast<std::uintptr_t>(object));
+  }
 
-  } else {
-    Variable topOfStack = opStack->at(opStack->size() - 1);
-    opStack->pop_back();
+  std::uint64_t tag() const noexcept {
+    return this->bits >> tagShift;
+  }
 
-    return topOfStack;
+  HeapObject* payloadPointer() const noexcept {
+    return reinterpret_cast<HeapObject*>(this->bits & payloadMask);
   }
-}
 
-void runtime::VirtualMachine::pushOpStack(Variable v) {
-  if (this->stackFrame == nullptr) {
-    this->panic("No active stack frame found to push op stack!");
+public:
+  static bool FitsInline(std::int64_t val) noexcept {
+    constexpr std::int64_t limit = std::int64_t{1} << (tagShift - 1);
+    return val >= -limit && val < limit;
   }
 
-  this->stackFrame->opStack.push_back(v);
-}
+  static Variable MakeUndefined() noexcept {
+    return tagged(undefinedTag, 0);
+  }
 
-void runtime::VirtualMachine::Add() {
-  Variable second = this->popOpStack();
-  Variable first = this->popOpStack();
+  static Variable MakeInteger(std::int64_t val) noexcept {
+    return tagged(integerTag, static_cast<std::uint64_t>(val));
+  }
 
-  if (!this->protectDifferentTypes(first, second)) {
-    this->advance();
-    return;
+  static Variable MakeBoxedInteger(const BoxedInteger* val) noexcept {
+    return pointer(boxedIntegerTag, val);
   }
 
-  if (first.type == VariableType::Integer) {
-    this->pushInteger(first.integerValue + second.integerValue);
+  static Variable MakeFloat(double val) noexcept {
+    Variable ret;
+    std::memcpy(&ret.bits, &val, sizeof(double));
+    if (ret.tag() > lastFloatTag) {
+      ret.bits = lastFloatTag << tagShift;
+    }
+    return ret;
+  }
 
-  } else if (first.type == VariableType::Float) {
-    this->pushFloat(first.doubleValue + second.doubleValue);
+  static Variable MakeBoolean(bool val) noexcept {
+    return tagged(booleanTag, val ? 1 : 0);
+  }
 
-  } else {
-    this->pushUndefined();
+  static Variable MakeString(const String* val) noexcept {
+    return pointer(stringTag, val);
   }
 
-  this->advance();
-}
+  static Variable MakeObject(const Object* val) noexcept;
 
-void runtime::VirtualMachine::Subtract() {
-  Variable second = this->popOpStack();
-  Variable first = this->popOpStack();
+  static Variable MakeArray(const Array* val) noexcept;
 
-  if (!this->protectDifferentTypes(first, second)) {
-    this->advance();
-    return;
+  static Variable MakeFunction(const Function* val) noexcept {
+    return pointer(functionTag, val);
   }
 
-  if (first.type == VariableType::Integer) {
-    this->pushInteger(first.integerValue - second.integerValue);
+  VariableType type() const noexcept {
+    std::uint64_t tag = this->tag();
 
-  } else if (first.type == VariableType::Float) {
-    this->pushFloat(first.doubleValue - second.doubleValue);
+    if (tag <= lastFloatTag) {
+      return VariableType::Float;
+    }
 
-  } else {
-    this->pushUndefined();
-  }
+    if (tag == boxedIntegerTag) {
+      return VariableType::Integer;
+    }
 
-  this->advance();
-}
+    return static_cast<VariableType>(tag - undefinedTag);
+  }
 
-void runtime::VirtualMachine::Multiply() {
-  Variable second = this->popOpStack();
-  Variable first = this->popOpStack();
+  static bool HaveSameType(Variable v1, Variable v2) noexcept {
+    // values with equal tags always have the same type, only doubles and
+    // boxed integers need a closer look
+    return v1.tag() == v2.tag() || v1.type() == v2.type();
+  }
 
-  if (!this->protectDifferentTypes(first, second)) {
-    this->advance();
-    return;
+  std::int64_t integerValue() const noexcept {
+    if (this->tag() == integerTag) {
+      // sign extend the 48 bit payload
+      return static_cast<std::int64_t>(this->bits << (64 - tagShift)) >> (64 - tagShift);
+    }
+    return static_cast<const BoxedInteger*>(this->payloadPointer())->value;
   }
 
-  if (first.type == VariableType::Integer) {
-    this->pushInteger(first.integerValue * second.integerValue);
+  double doubleValue() const noexcept {
+    double ret;
+    std::memcpy(&ret, &this->bits, sizeof(double));
+    return ret;
+  }
 
-  } else if (first.type == VariableType::Float) {
-    this->pushFloat(first.doubleValue * second.doubleValue);
+  bool boolValue() const noexcept {
+    return (this->bits & payloadMask) != 0;
+  }
 
-  } else {
-    this->pushUndefined();
+  String* stringValue() const noexcept {
+    return static_cast<String*>(this->payloadPointer());
   }
 
-  this->advance();
-}
+  Object* objectValue() const noexcept;
 
-void runtime::VirtualMachine::Divide() {
-  Variable second = this->popOpStack();
-  Variable first = this->popOpStack();
+  Array* arrayValue() const noexcept;
 
-  if (!this->protectDifferentTypes(first, second)) {
-    this->advance();
-    return;
+  Function* functionValue() const noexcept {
+    return static_cast<Function*>(this->payloadPointer());
   }
 
-  if (first.type == VariableType::Integer) {
-    if (second.integerValue == 0) {
-      this->pushUndefined();
-
-    } else {
-      this->pushInteger(first.integerValue / second.integerValue);
-    }
-
-  } else if (first.type == VariableType::Float) {
-    this->pushFloat(first.doubleValue / second.doubleValue);
+  HeapObject* heapReference() const noexcept {
+    return this->tag() >= stringTag ? this->payloadPointer() : nullptr;
+  }
 
-  } else {
-    this->pushUndefined();
+  void replaceHeapReference(const HeapObject* object) noexcept {
+    *this = pointer(this->tag(), object);
   }
+};
 
-  this->advance();
-}
+static_assert(sizeof(Variable) == sizeof(std::uint64_t), "Variable must pack into 64 bits");
 
-void runtime::VirtualMachine::Print() {
-  Variable var = this->popOpStack();
-  this->out << this->variableToString(var, true);
-  this->pushUndefined();
-  this->advance();
-}
+#else
 
-void runtime::VirtualMachine::Read() {
-  std::string read;
-  std::getline(this->in, read);
-  auto ret = this->heap.NewString();
-  ret->assign(read);
-  this->pushString(ret);
-  this->advance();
-}
+struct Variable {
+private:
+  VariableType variableType;
 
-void runtime::VirtualMachine::Jump() {
-  this->stackFrame->programCounter = this->getByteCodeParameter();
-}
-void runtime::VirtualMachine::JumpIfFalse() {
-  Variable top{this->popOpStack()};
+  union {
+    std::int64_t integer;
+    double floating;
+    bool boolean;
+    HeapObject* object;
+  };
 
-  if (!this->booleanValueOfVariable(top)) {
-    this->Jump();
-  } else {
-    this->advance();
+  static Variable make(VariableType type) noexcept {
+    Variable ret;
+    ret.variableType = type;
+    return ret;
   }
-}
-
-void runtime::VirtualMachine::LoadIntegerConstant() {
-
-  std::size_t index = this->getByteCodeParameter();
 
-  if (index >= this->file->intConstants.size()) {
-    this->panic("Index out of bounds in LoadIntegerConstant");
-    return;
+public:
+  static bool FitsInline(std::int64_t /*val*/) noexcept {
+    return true;
   }
 
-  this->pushInteger(this->file->intConstants.at(index));
+  static Variable MakeUndefined() noexcept {
+    return make(VariableType::Undefined);
+  }
 
-  this->advance();
-}
+  static Variable MakeInteger(std::int64_t val) noexcept {
+    Variable ret = make(VariableType::Integer);
+    ret.integer = val;
+    return ret;
+  }
 
-void runtime::VirtualMachine::LoadFloatConstant() {
-  std::size_t index = this->getByteCodeParameter();
+  static Variable MakeFloat(double val) noexcept {
+    Variable ret = make(VariableType::Float);
+    ret.floating = val;
+    return ret;
+  }
 
-  if (index >= this->file->floatConstants.size()) {
-    this->panic("Index out of bounds in LoadFloatConstant");
-    return;
+  static Variable MakeBoolean(bool val) noexcept {
+    Variable ret = make(VariableType::Boolean);
+    ret.boolean = val;
+    return ret;
   }
 
-  this->pushFloat(this->file->floatConstants.at(index));
+  static Variable MakeString(const String* val) noexcept {
+    Variable ret = make(VariableType::String);
+    ret.object = const_cast<String*>(val);
+    return ret;
+  }
 
-  this->advance();
-}
+  static Variable MakeObject(const Object* val) noexcept;
 
-void runtime::VirtualMachine::LoadStringConstant() {
-  std::size_t index = this->getByteCodeParameter();
+  static Variable MakeArray(const Array* val) noexcept;
 
-  if (index >= this->file->stringConstants.size()) {
-    this->panic("Index out of bounds in LoadStringConstant");
-    return;
+  static Variable MakeFunction(const Function* val) noexcept {
+    Variable ret = make(VariableType::Function);
+    ret.object = const_cast<Function*>(val);
+    return ret;
   }
 
-  this->pushString(&this->file->stringConstants.at(index));
-
-  this->advance();
-}
+  VariableType type() const noexcept {
+    return this->variableType;
+  }
 
-void runtime::VirtualMachine::LoadUndefinedConstant() {
-  this->pushUndefined();
-  this->advance();
-}
+  static bool HaveSameType(Variable v1, Variable v2) noexcept {
+    return v1.variableType == v2.variableType;
+  }
 
-void runtime::VirtualMachine::LoadBooleanTrueConstant() {
-  this->pushBoolean(true);
-  this->advance();
-}
+  std::int64_t integerValue() const noexcept {
+    return this->integer;
+  }
 
-void runtime::VirtualMachine::LoadBooleanFalseConstant() {
-  this->pushBoolean(false);
-  this->advance();
-}
+  double doubleValue() const noexcept {
+    return this->floating;
+  }
 
-void runtime::VirtualMachine::LoadLocal() {
-  if (this->stackFrame == nullptr) {
-    this->panic("No stack frame found in LoadLocal");
-    return;
+  bool boolValue() const noexcept {
+    return this->boolean;
   }
 
-  auto stackFrame = this->stackFrame;
+  String* stringValue() const noexcept {
+    return static_cast<String*>(this->object);
+  }
 
-  auto locals = &stackFrame->locals;
+  Object* objectValue() const noexcept;
 
-  auto index = this->getByteCodeParameter();
+  Array* arrayValue() const noexcept;
 
-  if (index >= locals->size()) {
-    this->panic("Index out of bounds in LoadLocal");
-    return;
+  Function* functionValue() const noexcept {
+    return static_cast<Function*>(this->object);
   }
 
-  Variable local = locals->at(index);
+  HeapObject* heapReference() const noexcept {
+    switch (this->variableType) {
+      case VariableType::String:
+      case VariableType::Object:
+      case VariableType::Function:
+      case VariableType::Array: {
+        return this->object;
+      }
+      default: {
+        return nullptr;
+      }
+    }
+  }
 
-  this->pushOpStack(local);
+  void replaceHeapReference(const HeapObject* object) noexcept {
+    this->object = const_cast<HeapObject*>(object);
+  }
+};
 
-  this->advance();
-}
+#endif
+
+// A captured variable. While the frame which declared the variable is still
+// live the upvalue is open and points at the local's slot in the value stack,
+// when that frame returns the value is copied into closed and location is
+// redirected to it.
+struct Upvalue : HeapObject {
+  Variable* location;
+  Variable closed;
+  Upvalue* nextOpen;
+
+  explicit Upvalue(std::pmr::memory_resource* /*resource*/) noexcept
+  : HeapObject{}
+  , location{nullptr}
+  , closed{}
+  , nextOpen{nullptr}
+  {}
+};
 
-void runtime::VirtualMachine::LoadClosure() {
-  if (this->stackFrame == nullptr) {
-    this->panic("No stack frame found in LoadClosure");
-    return;
+static std::size_t hashString(String* str) {
+  if (!str->hasHash) {
+    str->hash = std::hash<std::string_view>{}(flattenString(str));
+    str->hasHash = true;
   }
 
-  this->pushOpStack(
-    this->loadClosureValue(this->stackFrame->function, this->getByteCodeParameter())
-  );
-
-  this->advance();
+  return str->hash;
 }
 
-void runtime::VirtualMachine::SetLocal() {
-  if (this->stackFrame == nullptr) {
-    this->panic("No stack frame found in SetLocal");
-    return;
+static bool stringEquals(String* str1, String* str2) {
+  if (str1 == str2) {
+    return true;
   }
 
-  auto stackFrame = this->stackFrame;
-
-  auto locals = &stackFrame->locals;
-
-  auto index = this->getByteCodeParameter();
-
-  if (index >= locals->size()) {
-    this->panic("Index out of bounds in SetLocal");
-    return;
+  // equal interned strings are the same object and hashes, where both are
+  // known, tell most other strings apart without reading them
+  if ((str1->isInterned && str2->isInterned) || (str1->hasHash && str2->hasHash && str1->hash != str2->hash)) {
+    return false;
   }
 
-  Variable top = this->popOpStack();
-
-  locals->at(index) = top;
+  if (stringLength(str1) != stringLength(str2)) {
+    return false;
+  }
 
-  this->advance();
+  return flattenString(str1) == flattenString(str2);
 }
 
-runtime::Variable runtime::VirtualMachine::loadClosureValue(const runtime::Function* fn, std::size_t index) {
-  auto& closures = fn->captures;
-
-  if (index >= closures.size()) {
-    this->panic("Index out of bounds in loadClosureValue");
-  }
+static constexpr std::size_t maxElementIndexDigits = 9;
 
-  const auto& closure = closures.at(index);
+// Whether the key is a canonical non-negative integer such as "0" or "12",
+// which objects keep in their elements. Ropes are longer than any index so
+// they are never read.
+static bool elementIndex(const String* key, std::size_t& index) noexcept {
+  const std::pmr::string& value = key->value;
 
-  if (closure.scopeIndex >= closure.stackFrame->locals.size()) {
-    this->panic("Scope index >= closure.stackFrame->locals.size()");
+  if (value.empty() || value.size() > maxElementIndexDigits || (value[0] == '0' && value.size() > 1)) {
+    return false;
   }
 
-  return closure.stackFrame->locals.at(closure.scopeIndex);
-}
-
-runtime::ClosureContext runtime::VirtualMachine::loadClosure(const bytecode::ClosureContext& closure) {
-  // we start at offset of 1 because those offsets are determined from within the function scope
-  // are we are not technically within the function scope also offset of zero means local
-  auto scope = this->stackFrame;
-  for (std::size_t i = 1; i < closure.scopeOffsets; i++) {
-    auto outer = scope->function->scopeOuter;
-    if (outer == nullptr) {
-      this->panic("No outer scope found for closure");
+  index = 0;
+  for (char c : value) {
+    if (c < '0' || c > '9') {
+      return false;
     }
-    scope = outer;
+    index = index * 10 + static_cast<std::size_t>(c - '0');
   }
 
-  if (closure.localIndex >= scope->locals.size()) {
-    this->panic("closure.localIndex out of bounds for scope when trying to find closure value");
-  }
-
-  runtime::ClosureContext cc;
-  cc.stackFrame = scope.get();
-  cc.scopeIndex = closure.localIndex;
-  return cc;
+  return true;
 }
 
-void runtime::VirtualMachine::MakeFn() {
-  std::size_t index = this->getByteCodeParameter();
+// The key of a dictionary property. The collector moves young keys in
+// place, which leaves the map intact as their contents do not change.
+struct PropertyKey {
+  mutable String* str;
+};
 
-  if (index >= this->file->functions.size()) {
-    this->panic("Index out of bounds in MakeFn");
-    return;
+// Property keys are hashed by their contents with the hash cached in the
+// string, so any string can be used to look up a key.
+struct StringHash {
+  std::size_t operator()(String* str) const {
+    return hashString(str);
   }
 
-  runtime::Function* fn = this->heap.NewFunction();
-  fn->fn = &this->file->functions.at(index);
-  fn->captures.clear();
+  std::size_t operator()(const PropertyKey& key) const {
+    return hashString(key.str);
+  }
+};
 
-  for (const auto& closure : fn->fn->closures) {
-    fn->captures.push_back(this->loadClosure(closure));
+struct StringEqual {
+  bool operator()(String* str1, String* str2) const {
+    return stringEquals(str1, str2);
   }
 
-  fn->scopeOuter = this->stackFrame;
+  bool operator()(const PropertyKey& key1, const PropertyKey& key2) const {
+    return stringEquals(key1.str, key2.str);
+  }
+};
 
-  this->pushFunction(fn);
+// Objects built the same way share a shape which maps their keys to indices
+// in the objects' slots. Adding a key moves an object on to a child shape,
+// shapes belong to the VirtualMachine and live as long as it does.
+struct Shape {
+  // the interned key this shape added to its parent
+  String* const key;
+  std::unordered_map<String*, std::size_t, StringHash, StringEqual> slots;
+  std::unordered_map<String*, Shape*, StringHash, StringEqual> transitions;
+
+  explicit Shape(String* key) noexcept
+  : key{key}
+  {}
+};
 
-  this->advance();
-}
+// The shape an object literal starts out with and the slot each of its
+// interned keys is stored in, a null shape means the literal makes a
+// dictionary.
+struct ConstructorShape {
+  Shape* shape;
+  std::vector<String*> keys;
+  std::vector<std::size_t> slots;
+};
 
-void runtime::VirtualMachine::Return() {
-  Variable top = this->popOpStack();
-  this->popStackFrame();
-  this->pushOpStack(top);
+// Objects either have a shape and keep their values in slots, or they have
+// gone into dictionary mode after growing too many keys or reaching a shape
+// with too many transitions and keep their values in properties. Keys of
+// properties need not be interned and may be young.
+//
+// Keys "0" up to "n - 1" which were set in order are kept apart from both in
+// elements. An index key set out of order is stored like any other key and
+// marks the object as having sparse elements, after which an index is only
+// appended to elements if it is not already stored by name.
+struct Object : HeapObject {
+  Shape* shape;
+  std::pmr::vector<Variable> slots;
+  std::pmr::unordered_map<PropertyKey, Variable, StringHash, StringEqual> properties;
+  std::pmr::vector<Variable> elements;
+  bool hasSparseElements;
+
+  explicit Object(std::pmr::memory_resource* resource) noexcept
+  : HeapObject{}
+  , shape{nullptr}
+  , slots{resource}
+  , properties{resource}
+  , elements{resource}
+  , hasSparseElements{false}
+  {}
+};
 
-  this->advance();
-}
+struct Array : HeapObject {
+  std::pmr::vector<Variable> elements;
 
-void runtime::VirtualMachine::Invoke() {
+  explicit Array(std::pmr::memory_resource* resource) noexcept
+  : HeapObject{}
+  , elements{resource}
+  {}
+};
 
-  std::size_t argCount = this->getByteCodeParameter();
+static constexpr std::size_t maxShapeSlots = 64;
+static constexpr std::size_t maxShapeTransitions = 64;
+
+// An entry remembers where the interned key lives in objects of shape. For
+// sets which add the key next is the shape the object moves to, otherwise it
+// is shape. Keys which are not interned are compared by their contents.
+struct InlineCacheEntry {
+  Shape* shape;
+  Shape* next;
+  std::size_t slot;
+  String* key;
+};
 
-  std::vector<runtime::Variable> args;
-  args.reserve(argCount);
+static constexpr std::size_t inlineCacheSize = 4;
 
-  if (this->stackFrame == nullptr) {
-    this->panic("No stack frame found in Invoke");
-    return;
-  }
+// The shapes seen by one ObjectGet, ObjectSet or LoadLocalProperty instruction. Once all of the
+// entries are taken the instruction only uses the slow path.
+struct InlineCache {
+  std::size_t count;
+  std::array<InlineCacheEntry, inlineCacheSize> entries;
+};
+
+static constexpr std::size_t maxProfiledVariants = 8;
+
+// What one instruction saw while the vm was profiling, see
+// VirtualMachine::profileStep. Arithmetic and comparisons record the types of
+// their two operands, property reads the type of the receiver and the key
+// and the shapes of receiving objects, calls the type of the callee and the
+// functions called. Past maxProfiledVariants shapes or functions the site is
+// only marked megamorphic.
+struct SiteProfile {
+  std::size_t count;
+  // one bit per VariableType for each operand
+  std::array<std::uint32_t, 2> operandTypes;
+  // null for objects in dictionary mode
+  std::vector<const Shape*> shapes;
+  std::vector<const Prototype*> callees;
+  bool isMegamorphic;
+};
+
+static constexpr std::size_t maxTraceLength = 1024;
+// frames a trace may call into below the loop's own
+static constexpr std::size_t maxTraceDepth = 8;
+// recordings of a loop which may fail before it is left to the interpreter
+static constexpr std::size_t maxTraceAborts = 4;
+
+// A loop header, counted by its back edges until the loop is traced, see
+// VirtualMachine::traceLoop.
+struct LoopTrace {
+  std::size_t backEdges;
+  std::size_t aborts;
+  std::unique_ptr<jit::NativeTrace> trace;
+};
+
+// Runtime data for a bytecode::Function, shared by all of its closures.
+struct Prototype {
+  const bytecode::Function* fn;
+  // indexed by program counter, only set for the property instructions
+  std::vector<std::size_t> inlineCacheIndex;
+  std::vector<InlineCache> inlineCaches;
+
+  // the function's instructions as the vm runs them, arithmetic and
+  // comparisons are quickened in place for the operand types they see until
+  // a guard fails at that site, see VirtualMachine::quicken
+  std::vector<bytecode::ByteCode> byteCode;
+  std::vector<bool> isPolymorphic;
+
+  // indexed by program counter, empty unless the vm is profiling
+  std::vector<SiteProfile> profile;
+
+  // calls so far and the native code once the function is compiled, see
+  // VirtualMachine::runNative
+  std::size_t invocations;
+  bool isNativeTried;
+  std::unique_ptr<jit::NativeCode> nativeCode;
+  // null unless the function was compiled ahead of time
+  jit::Precompiled precompiled;
+
+  // indexed by program counter, empty unless the vm traces loops
+  std::vector<LoopTrace> loops;
+
+  explicit Prototype(const bytecode::Function* fn) noexcept
+  : fn{fn}
+  , inlineCacheIndex(fn->byteCode.size(), 0)
+  , byteCode{fn->byteCode}
+  , isPolymorphic(fn->byteCode.size(), false)
+  , invocations{0}
+  , isNativeTried{false}
+  , precompiled{nullptr}
+  {
+    for (std::size_t i = 0; i < fn->byteCode.size(); i++) {
+      switch (fn->byteCode[i].instruction) {
+        case bytecode::ByteCodeInstruction::ObjectGet:
+        case bytecode::ByteCodeInstruction::ObjectSet:
+        case bytecode::ByteCodeInstruction::LoadLocalProperty: {
+          this->inlineCacheIndex[i] = this->inlineCaches.size();
+          this->inlineCaches.push_back(InlineCache{});
+          break;
+        }
+        default: {
+          break;
+        }
+      }
+    }
+  }
+};
+
+#if FLANG_NAN_BOXING
+
+runtime::Variable runtime::Variable::MakeObject(const runtime::Object* val) noexcept {
+  return pointer(objectTag, val);
+}
+
+runtime::Object* runtime::Variable::objectValue() const noexcept {
+  return static_cast<runtime::Object*>(this->payloadPointer());
+}
+
+runtime::Variable runtime::Variable::MakeArray(const runtime::Array* val) noexcept {
+  return pointer(arrayTag, val);
+}
+
+runtime::Array* runtime::Variable::arrayValue() const noexcept {
+  return static_cast<runtime::Array*>(this->payloadPointer());
+}
+
+#else
+
+runtime::Variable runtime::Variable::MakeObject(const runtime::Object* val) noexcept {
+  Variable ret = make(VariableType::Object);
+  ret.object = const_cast<HeapObject*>(static_cast<const HeapObject*>(val));
+  return ret;
+}
+
+runtime::Object* runtime::Variable::objectValue() const noexcept {
+  return static_cast<runtime::Object*>(this->object);
+}
+
+runtime::Variable runtime::Variable::MakeArray(const runtime::Array* val) noexcept {
+  Variable ret = make(VariableType::Array);
+  ret.object = const_cast<HeapObject*>(static_cast<const HeapObject*>(val));
+  return ret;
+}
+
+runtime::Array* runtime::Variable::arrayValue() const noexcept {
+  return static_cast<runtime::Array*>(this->object);
+}
+
+#endif
+
+// Frames are windows into the value stack, locals start at locals and the
+// frame's temporaries start at opStackBase. Frame metadata lives in its own
+// array running parallel to the value stack.
+struct StackFrame {
+  std::size_t programCounter;
+  const runtime::Function* function;
+  Variable* locals;
+  Variable* opStackBase;
+};
+
+// the stacks double whenever a call needs more room than they have left
+static constexpr std::size_t initialValueStackSize = 1 << 16;
+static constexpr std::size_t initialStackFrames = 1 << 12;
+// the innermost frames print dumps
+static constexpr int maxPrintedFrames = 32;
+static constexpr std::size_t outputBufferSize = 1 << 16;
+static constexpr std::size_t inputBufferSize = 1 << 16;
+
+// room for the longest integer or fixed point double print writes
+static constexpr std::size_t maxNumberLength = 512;
+
+#if FLANG_NAN_BOXING
+
+static std::uint64_t bitsOf(Variable variable) {
+  std::uint64_t bits;
+  std::memcpy(&bits, &variable, sizeof(bits));
+  return bits;
+}
+
+static jit::ValueEncoding makeValueEncoding() {
+  // a NaN whose payload collides with every tag
+  double nan;
+  std::uint64_t nanBits = ~std::uint64_t{0};
+  std::memcpy(&nan, &nanBits, sizeof(nan));
+
+  std::uint64_t canonicalNan = bitsOf(Variable::MakeFloat(nan));
+
+  return jit::ValueEncoding{
+    bitsOf(Variable::MakeInteger(0)) >> 48,
+    canonicalNan >> 48,
+    canonicalNan,
+    bitsOf(Variable::MakeBoolean(true)),
+    bitsOf(Variable::MakeBoolean(false)),
+    bitsOf(Variable::MakeUndefined())
+  };
+}
+
+#else
+
+static jit::ValueEncoding makeValueEncoding() {
+  return jit::ValueEncoding{};
+}
+
+static std::uint64_t bitsOf(Variable /*variable*/) {
+  return 0;
+}
+
+#endif
+
+static jit::TraceType traceTypeOf(Variable variable) {
+  switch (variable.type()) {
+    case VariableType::Integer: {
+      return Variable::FitsInline(variable.integerValue()) ? jit::TraceType::Integer : jit::TraceType::Other;
+    }
+    case VariableType::Float: {
+      return jit::TraceType::Float;
+    }
+    case VariableType::Boolean: {
+      return jit::TraceType::Boolean;
+    }
+    default: {
+      return jit::TraceType::Other;
+    }
+  }
+}
+
+runtime::VirtualMachine::VirtualMachine(
+  bool isDebug,
+  runtime::GcOptions gcOptions,
+  runtime::StackOptions stackOptions,
+  runtime::JitOptions jitOptions,
+  std::ostream* profile,
+  std::ostream & out,
+  std::istream & in,
+  std::shared_ptr<const bytecode::CompiledFile> file
+) noexcept
+: file{std::move(file)}
+, valueStack{new Variable[initialValueStackSize]}
+, stackTop{valueStack.get()}
+, stackEnd{valueStack.get() + initialValueStackSize}
+, frames{new StackFrame[initialStackFrames]}
+, stackFrame{nullptr}
+, framesEnd{frames.get() + initialStackFrames}
+, maxStackFrames{stackOptions.maxFrames}
+, openUpvalues{nullptr}
+, heap{this, gcOptions}
+, out{out}
+, in{in}
+, outputBuffer{new char[outputBufferSize]}
+, outputTop{outputBuffer.get()}
+, outputEnd{outputBuffer.get() + outputBufferSize}
+, inputBuffer{new char[inputBufferSize]}
+, inputTop{inputBuffer.get()}
+, inputEnd{inputBuffer.get()}
+, jitOptions{jitOptions}
+, nativeHelpers{}
+, profile{profile}
+, traceHelpers{}
+, valueEncoding{}
+, traceState{nullptr}
+, traceSteps{}
+, tracePrototype{nullptr}
+, traceFrame{nullptr}
+, traceLastFrame{nullptr}
+, traceHeader{0}
+, isPanicing{false}
+, isDebug{isDebug}
+, isVerified{false}
+, isJit{false}
+, hasNativeFunctions{false}
+, isProfiling{profile != nullptr}
+, isTracing{false}
+, isRecording{false}
+{}
+
+runtime::VirtualMachine::~VirtualMachine() = default;
+
+// Labels-as-values is a GNU extension, when it is available the interpreter
+// jumps directly from one instruction handler to the next, otherwise it falls
+// back to a portable switch. Build with -DFLANG_THREADED_DISPATCH=0 to force
+// the switch.
+#ifndef FLANG_THREADED_DISPATCH
+#if defined(__GNUC__) || defined(__clang__)
+#define FLANG_THREADED_DISPATCH 1
+#else
+#define FLANG_THREADED_DISPATCH 0
+#endif
+#endif
+
+#if FLANG_THREADED_DISPATCH
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+void runtime::VirtualMachine::run() noexcept {
+
+  // the entrypoint's prototype comes after those of the other functions
+  this->prototypes.reserve(this->file->functions.size() + 1);
+  for (const auto& function : this->file->functions) {
+    this->prototypes.emplace_back(&function);
+  }
+  this->prototypes.emplace_back(&this->file->entrypoint);
+
+  if (this->isProfiling) {
+    for (auto& prototype : this->prototypes) {
+      prototype.profile.resize(prototype.byteCode.size());
+    }
+  }
+
+  // verified code runs without the checks of checkInstruction, anything else
+  // goes through them before every instruction
+  verifier::Verifier verifier;
+  this->isVerified = verifier.isValid(*this->file);
+
+  // native code calls the handlers without any of the checks, and would not
+  // be profiled
+  bool hasNativeCode = (FLANG_JIT && this->jitOptions.isEnabled) || this->jitOptions.precompiled != nullptr;
+  this->isJit = hasNativeCode && this->isVerified && !this->isDebug && !this->isProfiling;
+  if (this->isJit) {
+    this->nativeHelpers = makeNativeHelpers();
+    this->traceHelpers = jit::TraceHelpers{
+      &callFromTrace,
+      &this->nativeHelpers,
+      &invokeFromTrace,
+      &backEdgeFromTrace
+    };
+    this->valueEncoding = makeValueEncoding();
+  }
+
+  if (this->isJit && this->jitOptions.precompiled != nullptr) {
+    for (std::size_t i = 0; i < this->prototypes.size(); i++) {
+      this->prototypes[i].precompiled = this->jitOptions.precompiled[i];
+    }
+  }
+
+  // with neither, calls and returns have nothing to look for and only loops
+  // leave the interpreter
+  this->hasNativeFunctions = this->isJit
+    && (this->jitOptions.precompiled != nullptr || (FLANG_JIT && this->jitOptions.threshold > 0));
+
+  // traces work on the bits of NaN-boxed Variables
+  this->isTracing = this->isJit && FLANG_JIT && this->jitOptions.isEnabled && FLANG_NAN_BOXING && this->jitOptions.traceThreshold > 0;
+  if (this->isTracing) {
+    for (auto& prototype : this->prototypes) {
+      prototype.loops.resize(prototype.byteCode.size());
+    }
+  }
+
+  runtime::Function* fn = this->heap.NewFunction();
+  fn->captures.clear();
+  fn->fn = &this->file->entrypoint;
+  fn->prototype = &this->prototypes.back();
+  this->pushStackFrame(fn, this->stackTop, 0);
+
+  this->stringConstants.reserve(this->file->stringConstants.size());
+  for (const auto& constant : this->file->stringConstants) {
+    this->stringConstants.push_back(this->intern(constant));
+  }
+
+  // charAt and type() hand out these instead of allocating
+  for (std::size_t i = 0; i < this->characterStrings.size(); i++) {
+    char c = static_cast<char>(i);
+    this->characterStrings[i] = this->intern(std::string_view{&c, 1});
+  }
+
+  for (std::size_t i = 0; i < typeNames.size(); i++) {
+    this->typeNameStrings[i] = this->intern(typeNames[i]);
+  }
+
+  this->shapes.clear();
+  Shape* rootShape = this->newShape(nullptr, nullptr);
+
+  this->constructorShapes.reserve(this->file->objects.size());
+  for (const auto& constructor : this->file->objects) {
+    ConstructorShape constructorShape{rootShape, {}, {}};
+
+    for (const auto& constant : constructor.keys) {
+      String* key = this->intern(constant);
+      constructorShape.keys.push_back(key);
+    }
+
+    for (String* key : constructorShape.keys) {
+      auto find = constructorShape.shape->slots.find(key);
+
+      if (find != constructorShape.shape->slots.end()) {
+        constructorShape.slots.push_back(find->second);
+        continue;
+      }
+
+      if (constructorShape.shape->slots.size() == maxShapeSlots) {
+        constructorShape.shape = nullptr;
+        break;
+      }
+
+      // literals are part of the program so they are not held to
+      // maxShapeTransitions
+      auto transition = constructorShape.shape->transitions.find(key);
+      if (transition != constructorShape.shape->transitions.end()) {
+        constructorShape.shape = transition->second;
+      } else {
+        constructorShape.shape = this->newShape(constructorShape.shape, key);
+      }
+      constructorShape.slots.push_back(constructorShape.shape->slots.size() - 1);
+    }
+
+    this->constructorShapes.push_back(std::move(constructorShape));
+  }
+
+  this->heap.StartGc();
+
+  if (this->hasNativeFunctions) {
+    this->runNative();
+  }
+
+#if FLANG_THREADED_DISPATCH
+
+  // must be kept in the same order as bytecode::ByteCodeInstruction
+  static const void* const dispatchTable[] = {
+    &&handleHalt,
+    &&handleAdd,
+    &&handleSubtract,
+    &&handleMultiply,
+    &&handleDivide,
+    &&handlePrint,
+    &&handleRead,
+    &&handleJump,
+    &&handleJumpIfFalse,
+    &&handleLoadIntegerConstant,
+    &&handleLoadFloatConstant,
+    &&handleLoadStringConstant,
+    &&handleLoadUndefinedConstant,
+    &&handleLoadBooleanTrueConstant,
+    &&handleLoadBooleanFalseConstant,
+    &&handleLoadLocal,
+    &&handleSetLocal,
+    &&handleReturn,
+    &&handleInvoke,
+    &&handleNoOp,
+    &&handleMakeFn,
+    &&handleMakeObj,
+    &&handleLess,
+    &&handleLessOrEqual,
+    &&handleGreater,
+    &&handleGreaterOrEqual,
+    &&handleNot,
+    &&handleEqual,
+    &&handleNotEqual,
+    &&handleAnd,
+    &&handleOr,
+    &&handleGetType,
+    &&handleCastToInt,
+    &&handleCastToFloat,
+    &&handleLength,
+    &&handleChatAt,
+    &&handleStringAppend,
+    &&handleObjectGet,
+    &&handleObjectSet,
+    &&handleGetEnv,
+    &&handleLoadClosure,
+    &&handlePop,
+    &&handleTailCall,
+    &&handleMakeArray,
+    &&handleIndexGet,
+    &&handleIndexSet,
+    &&handleArrayPush,
+    &&handleAddIntegerToLocal,
+    &&handleJumpUnlessLocalLessInteger,
+    &&handleLoadLocalProperty,
+    &&handleAddInt,
+    &&handleAddFloat,
+    &&handleSubtractInt,
+    &&handleSubtractFloat,
+    &&handleMultiplyInt,
+    &&handleMultiplyFloat,
+    &&handleDivideInt,
+    &&handleDivideFloat,
+    &&handleLessInt,
+    &&handleLessFloat,
+    &&handleLessOrEqualInt,
+    &&handleLessOrEqualFloat,
+    &&handleGreaterInt,
+    &&handleGreaterFloat,
+    &&handleGreaterOrEqualInt,
+    &&handleGreaterOrEqualFloat,
+  };
+
+  static_assert(
+    sizeof(dispatchTable) / sizeof(dispatchTable[0]) == bytecode::instructionCount,
+    "dispatchTable is out of sync with bytecode::ByteCodeInstruction");
+
+  // in debug mode every instruction first goes through handleDebug, which then
+  // jumps to the real handler, so the non debug path never checks isDebug
+  const void* debugDispatchTable[sizeof(dispatchTable) / sizeof(dispatchTable[0])];
+  for (auto& entry : debugDispatchTable) {
+    entry = &&handleDebug;
+  }
+
+  // unverified code is checked the same way
+  const void* checkedDispatchTable[sizeof(dispatchTable) / sizeof(dispatchTable[0])];
+  for (auto& entry : checkedDispatchTable) {
+    entry = &&handleCheck;
+  }
+
+  // profiling goes through handleProfile the same way, so it costs nothing
+  // when it is off
+  const void* profilingDispatchTable[sizeof(dispatchTable) / sizeof(dispatchTable[0])];
+  for (auto& entry : profilingDispatchTable) {
+    entry = &&handleProfile;
+  }
+
+  // recording a trace goes through handleRecord, it starts at a back edge
+  // and the handlers which may have run native code pick the table again
+  const void* recordingDispatchTable[sizeof(dispatchTable) / sizeof(dispatchTable[0])];
+  for (auto& entry : recordingDispatchTable) {
+    entry = &&handleRecord;
+  }
+
+  const void* const* table =
+    this->isDebug ? debugDispatchTable
+    : !this->isVerified ? checkedDispatchTable
+    : this->isProfiling ? profilingDispatchTable
+    : this->isRecording ? recordingDispatchTable
+    : dispatchTable;
+
+  #define DISPATCH() goto *table[static_cast<std::size_t>(this->fetchInstruction())]
+  #define HANDLER(name) handle##name:
+  #define SELECT_TABLE() table = this->isRecording ? recordingDispatchTable : dispatchTable
+
+  DISPATCH();
+
+  handleDebug: {
+    this->debugStep();
+    if (!this->isVerified) {
+      this->checkInstruction();
+    }
+    if (this->isProfiling) {
+      this->profileStep();
+    }
+    goto *dispatchTable[static_cast<std::size_t>(this->fetchInstruction())];
+  }
+
+  handleCheck: {
+    this->checkInstruction();
+    if (this->isProfiling) {
+      this->profileStep();
+    }
+    goto *dispatchTable[static_cast<std::size_t>(this->fetchInstruction())];
+  }
+
+  handleProfile: {
+    this->profileStep();
+    goto *dispatchTable[static_cast<std::size_t>(this->fetchInstruction())];
+  }
+
+  handleRecord: {
+    this->recordStep();
+    if (!this->isRecording) {
+      table = dispatchTable;
+    }
+    goto *dispatchTable[static_cast<std::size_t>(this->fetchInstruction())];
+  }
+
+#else
+
+  #define DISPATCH() continue
+  #define HANDLER(name) case bytecode::ByteCodeInstruction::name:
+  #define SELECT_TABLE()
+
+  while (true) {
+    if (this->isDebug) {
+      this->debugStep();
+    }
+
+    if (!this->isVerified) {
+      this->checkInstruction();
+    }
+
+    if (this->isProfiling) {
+      this->profileStep();
+    }
+
+    if (this->isRecording) {
+      this->recordStep();
+    }
+
+    switch (this->fetchInstruction()) {
+
+#endif
+
+      HANDLER(Halt) { this->writeProfile(); this->heap.EndGc(); this->flushOutput(); return; }
+      HANDLER(Add) { this->Add(); DISPATCH(); }
+      HANDLER(Subtract) { this->Subtract(); DISPATCH(); }
+      HANDLER(Multiply) { this->Multiply(); DISPATCH(); }
+      HANDLER(Divide) { this->Divide(); DISPATCH(); }
+      HANDLER(Print) { this->Print(); DISPATCH(); }
+      HANDLER(Read) { this->Read(); DISPATCH(); }
+      HANDLER(Jump) { this->Jump(); if (this->isJit) { SELECT_TABLE(); } DISPATCH(); }
+      HANDLER(JumpIfFalse) { this->JumpIfFalse(); DISPATCH(); }
+      HANDLER(LoadIntegerConstant) { this->LoadIntegerConstant(); DISPATCH(); }
+      HANDLER(LoadFloatConstant) { this->LoadFloatConstant(); DISPATCH(); }
+      HANDLER(LoadStringConstant) { this->LoadStringConstant(); DISPATCH(); }
+      HANDLER(LoadUndefinedConstant) { this->LoadUndefinedConstant(); DISPATCH(); }
+      HANDLER(LoadBooleanTrueConstant) { this->LoadBooleanTrueConstant(); DISPATCH(); }
+      HANDLER(LoadBooleanFalseConstant) { this->LoadBooleanFalseConstant(); DISPATCH(); }
+      HANDLER(LoadLocal) { this->LoadLocal(); DISPATCH(); }
+      HANDLER(SetLocal) { this->SetLocal(); DISPATCH(); }
+      HANDLER(Return) { this->Return(); if (this->hasNativeFunctions) { this->runNative(); SELECT_TABLE(); } DISPATCH(); }
+      HANDLER(Invoke) { this->Invoke(); if (this->hasNativeFunctions) { this->runNative(); SELECT_TABLE(); } DISPATCH(); }
+      HANDLER(NoOp) { this->advance(); DISPATCH(); }
+      HANDLER(MakeFn) { this->MakeFn(); DISPATCH(); }
+      HANDLER(MakeObj) { this->MakeObj(); DISPATCH(); }
+      HANDLER(Less) { this->Less(); DISPATCH(); }
+      HANDLER(LessOrEqual) { this->LessOrEqual(); DISPATCH(); }
+      HANDLER(Greater) { this->Greater(); DISPATCH(); }
+      HANDLER(GreaterOrEqual) { this->GreaterOrEqual(); DISPATCH(); }
+      HANDLER(Not) { this->Not(); DISPATCH(); }
+      HANDLER(Equal) { this->Equal(); DISPATCH(); }
+      HANDLER(NotEqual) { this->NotEqual(); DISPATCH(); }
+      HANDLER(And) { this->And(); DISPATCH(); }
+      HANDLER(Or) { this->Or(); DISPATCH(); }
+      HANDLER(GetType) { this->GetType(); DISPATCH(); }
+      HANDLER(CastToInt) { this->CastToInt(); DISPATCH(); }
+      HANDLER(CastToFloat) { this->CastToFloat(); DISPATCH(); }
+      HANDLER(Length) { this->Length(); DISPATCH(); }
+      HANDLER(ChatAt) { this->ChatAt(); DISPATCH(); }
+      HANDLER(StringAppend) { this->StringAppend(); DISPATCH(); }
+      HANDLER(ObjectGet) { this->ObjectGet(); DISPATCH(); }
+      HANDLER(ObjectSet) { this->ObjectSet(); DISPATCH(); }
+      HANDLER(GetEnv) { this->GetEnv(); DISPATCH(); }
+      HANDLER(LoadClosure) { this->LoadClosure(); DISPATCH(); }
+      HANDLER(Pop) { this->Pop(); DISPATCH(); }
+      HANDLER(TailCall) { this->TailCall(); if (this->hasNativeFunctions) { this->runNative(); SELECT_TABLE(); } DISPATCH(); }
+      HANDLER(MakeArray) { this->MakeArray(); DISPATCH(); }
+      HANDLER(IndexGet) { this->IndexGet(); DISPATCH(); }
+      HANDLER(IndexSet) { this->IndexSet(); DISPATCH(); }
+      HANDLER(ArrayPush) { this->ArrayPush(); DISPATCH(); }
+      HANDLER(AddIntegerToLocal) { this->AddIntegerToLocal(); DISPATCH(); }
+      HANDLER(JumpUnlessLocalLessInteger) { this->JumpUnlessLocalLessInteger(); DISPATCH(); }
+      HANDLER(LoadLocalProperty) { this->LoadLocalProperty(); DISPATCH(); }
+      HANDLER(AddInt) { this->AddInt(); DISPATCH(); }
+      HANDLER(AddFloat) { this->AddFloat(); DISPATCH(); }
+      HANDLER(SubtractInt) { this->SubtractInt(); DISPATCH(); }
+      HANDLER(SubtractFloat) { this->SubtractFloat(); DISPATCH(); }
+      HANDLER(MultiplyInt) { this->MultiplyInt(); DISPATCH(); }
+      HANDLER(MultiplyFloat) { this->MultiplyFloat(); DISPATCH(); }
+      HANDLER(DivideInt) { this->DivideInt(); DISPATCH(); }
+      HANDLER(DivideFloat) { this->DivideFloat(); DISPATCH(); }
+      HANDLER(LessInt) { this->LessInt(); DISPATCH(); }
+      HANDLER(LessFloat) { this->LessFloat(); DISPATCH(); }
+      HANDLER(LessOrEqualInt) { this->LessOrEqualInt(); DISPATCH(); }
+      HANDLER(LessOrEqualFloat) { this->LessOrEqualFloat(); DISPATCH(); }
+      HANDLER(GreaterInt) { this->GreaterInt(); DISPATCH(); }
+      HANDLER(GreaterFloat) { this->GreaterFloat(); DISPATCH(); }
+      HANDLER(GreaterOrEqualInt) { this->GreaterOrEqualInt(); DISPATCH(); }
+      HANDLER(GreaterOrEqualFloat) { this->GreaterOrEqualFloat(); DISPATCH(); }
+
+#if !FLANG_THREADED_DISPATCH
+
+      default: {
+        this->panic("Unknown bytecode found in instructions!");
+      }
+    }
+  }
+
+#endif
+
+  #undef HANDLER
+  #undef DISPATCH
+  #undef SELECT_TABLE
+}
+
+#if FLANG_THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
+
+void runtime::VirtualMachine::runNative() {
+  while (true) {
+    // traces are recorded by the interpreter
+    if (this->isRecording) {
+      return;
+    }
+
+    Prototype* prototype = this->stackFrame->function->prototype;
+
+    // only calls come through here at the first instruction, the rest are
+    // returns into the middle of a function
+    if (this->stackFrame->programCounter == 0) {
+      prototype->invocations++;
+    }
+
+    if (prototype->precompiled != nullptr) {
+      if (prototype->precompiled(reinterpret_cast<flang_vm*>(this), this->stackFrame->programCounter) != 0) {
+        return;
+      }
+      continue;
+    }
+
+    if (prototype->nativeCode == nullptr) {
+      if (!this->jitOptions.isEnabled || this->jitOptions.threshold == 0 || prototype->isNativeTried || prototype->invocations < this->jitOptions.threshold) {
+        return;
+      }
+
+      prototype->isNativeTried = true;
+
+      jit::Compiler compiler;
+      prototype->nativeCode = compiler.compile(
+        *this->file,
+        prototype->byteCode,
+        this->traceHelpers,
+        FLANG_NAN_BOXING ? &this->valueEncoding : nullptr
+      );
+
+      if (prototype->nativeCode == nullptr) {
+        return;
+      }
+    }
+
+    jit::TraceState state{
+      reinterpret_cast<std::uint64_t*>(this->stackFrame->locals),
+      reinterpret_cast<std::uint64_t*>(this->stackFrame->opStackBase),
+      reinterpret_cast<std::uint64_t*>(this->stackTop),
+      this->stackFrame->programCounter,
+      nullptr
+    };
+
+    this->traceState = &state;
+    bool hasLeft = prototype->nativeCode->run(this, &state);
+    this->traceState = nullptr;
+
+    // the code's helpers already left the vm where it went on, except
+    // before an instruction for the interpreter
+    this->stackTop = reinterpret_cast<Variable*>(state.stackTop);
+    this->stackFrame->programCounter = state.programCounter;
+
+    // false leaves the instruction at the program counter to the interpreter
+    if (!hasLeft) {
+      return;
+    }
+  }
+}
+
+template <void (runtime::VirtualMachine::*handler)()>
+std::size_t runtime::VirtualMachine::callFromNative(VirtualMachine* vm) noexcept {
+  (vm->*handler)();
+  return vm->stackFrame->programCounter;
+}
+
+std::size_t runtime::VirtualMachine::jumpFromNative(VirtualMachine* vm) noexcept {
+  // the frames move when a trace's calls grow them
+  std::ptrdiff_t depth = vm->stackFrame - vm->frames.get();
+
+  vm->Jump();
+
+  // a trace which ran at the back edge may have left the vm in another frame,
+  // and a recording which started there needs the interpreter
+  if (vm->stackFrame - vm->frames.get() != depth || vm->isRecording) {
+    return std::numeric_limits<std::size_t>::max();
+  }
+
+  return vm->stackFrame->programCounter;
+}
+
+bool runtime::VirtualMachine::traceLoop(std::size_t header) {
+  Prototype* prototype = this->stackFrame->function->prototype;
+  LoopTrace& loop = prototype->loops[header];
+
+  if (this->isRecording) {
+    return false;
+  }
+
+  if (loop.trace == nullptr) {
+    if (loop.aborts < maxTraceAborts && ++loop.backEdges >= this->jitOptions.traceThreshold) {
+      // the recording starts with the header, the next instruction to run
+      this->isRecording = true;
+      this->traceSteps.clear();
+      this->tracePrototype = prototype;
+      this->traceFrame = this->stackFrame;
+      this->traceLastFrame = this->stackFrame;
+      this->traceHeader = header;
+    }
+    return false;
+  }
+
+  this->jumpTo(header);
+
+  jit::TraceState state{
+    reinterpret_cast<std::uint64_t*>(this->stackFrame->locals),
+    reinterpret_cast<std::uint64_t*>(this->stackFrame->opStackBase),
+    reinterpret_cast<std::uint64_t*>(this->stackTop),
+    header,
+    nullptr
+  };
+
+  // the back edge may be a helper of a function's native code
+  jit::TraceState* outer = this->traceState;
+
+  this->traceState = &state;
+  loop.trace->run(this, &state);
+  this->traceState = outer;
+
+  // the trace left before an instruction of whichever frame it was in
+  this->stackTop = reinterpret_cast<Variable*>(state.stackTop);
+  this->stackFrame->programCounter = state.programCounter;
+
+  return true;
+}
+
+void runtime::VirtualMachine::recordStep() {
+  using bytecode::ByteCodeInstruction;
+
+  StackFrame* frame = this->stackFrame;
+  std::size_t programCounter = frame->programCounter;
+
+  if (!this->traceSteps.empty()) {
+    jit::TraceStep& previous = this->traceSteps.back();
+    previous.nextProgramCounter = programCounter;
+
+    if (frame == this->traceFrame && programCounter == this->traceHeader) {
+      this->finishTrace();
+      return;
+    }
+
+    // inner loops, returns out of the loop's function and deep calls are
+    // not traced
+    bool isBackEdge = frame == this->traceLastFrame && programCounter <= previous.programCounter;
+
+    if (isBackEdge || frame < this->traceFrame || frame > this->traceFrame + maxTraceDepth) {
+      this->abortTrace();
+      return;
+    }
+  }
+
+  bytecode::ByteCode bc = frame->function->prototype->byteCode[programCounter];
+
+  if (this->traceSteps.size() == maxTraceLength
+    || bc.instruction == ByteCodeInstruction::Halt
+    || bc.instruction == ByteCodeInstruction::TailCall) {
+    this->abortTrace();
+    return;
+  }
+
+  jit::TraceStep step{
+    bc.instruction,
+    bc.parameter,
+    programCounter,
+    programCounter + 1,
+    static_cast<std::size_t>(this->stackTop - frame->opStackBase),
+    {jit::TraceType::Other, jit::TraceType::Other},
+    0,
+    nullptr
+  };
+
+  switch (bytecode::stackEffect(this->file->objects, bc).pops) {
+    case 0: {
+      break;
+    }
+    case 1: {
+      step.operands[0] = traceTypeOf(this->stackTop[-1]);
+      break;
+    }
+    default: {
+      step.operands[0] = traceTypeOf(this->stackTop[-2]);
+      step.operands[1] = traceTypeOf(this->stackTop[-1]);
+    }
+  }
+
+  switch (bc.instruction) {
+    case ByteCodeInstruction::LoadIntegerConstant: {
+      std::int64_t value = this->file->intConstants[bc.parameter];
+      if (Variable::FitsInline(value)) {
+        step.operands[0] = jit::TraceType::Integer;
+        step.constant = bitsOf(Variable::MakeInteger(value));
+      }
+      break;
+    }
+    case ByteCodeInstruction::LoadFloatConstant: {
+      step.constant = bitsOf(Variable::MakeFloat(this->file->floatConstants[bc.parameter]));
+      break;
+    }
+    case ByteCodeInstruction::LoadUndefinedConstant: {
+      step.constant = bitsOf(Variable::MakeUndefined());
+      break;
+    }
+    case ByteCodeInstruction::LoadBooleanTrueConstant:
+    case ByteCodeInstruction::LoadBooleanFalseConstant: {
+      step.constant = bitsOf(Variable::MakeBoolean(bc.instruction == ByteCodeInstruction::LoadBooleanTrueConstant));
+      break;
+    }
+    case ByteCodeInstruction::AddIntegerToLocal:
+    case ByteCodeInstruction::JumpUnlessLocalLessInteger: {
+      auto operands = bytecode::FusedOperands::Unpack(bc.parameter);
+      std::int64_t value = this->file->intConstants[operands.second];
+
+      // the sum of two inline integers can not overflow
+      if (Variable::FitsInline(value)) {
+        step.operands[0] = traceTypeOf(frame->locals[operands.first]);
+        step.constant = static_cast<std::uint64_t>(value);
+      }
+      break;
+    }
+    case ByteCodeInstruction::Invoke: {
+      Variable callee = this->stackTop[-static_cast<std::ptrdiff_t>(bc.parameter) - 1];
+      if (callee.type() == VariableType::Function) {
+        step.callee = callee.functionValue()->prototype;
+      }
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+
+  this->traceSteps.push_back(step);
+  this->traceLastFrame = frame;
+}
+
+void runtime::VirtualMachine::finishTrace() {
+  LoopTrace& loop = this->tracePrototype->loops[this->traceHeader];
+
+  jit::TraceCompiler compiler;
+  loop.trace = compiler.compile(this->traceSteps, this->traceHelpers, this->valueEncoding);
+
+  if (loop.trace == nullptr) {
+    loop.aborts = maxTraceAborts;
+  }
+
+  this->isRecording = false;
+  this->traceSteps.clear();
+}
+
+void runtime::VirtualMachine::abortTrace() {
+  LoopTrace& loop = this->tracePrototype->loops[this->traceHeader];
+
+  // counted again from the start before the next attempt
+  loop.aborts++;
+  loop.backEdges = 0;
+
+  this->isRecording = false;
+  this->traceSteps.clear();
+}
+
+std::size_t runtime::VirtualMachine::callFromTrace(VirtualMachine* vm, jit::Helper helper) noexcept {
+  jit::TraceState* state = vm->traceState;
+
+  vm->stackTop = reinterpret_cast<Variable*>(state->stackTop);
+  vm->stackFrame->programCounter = state->programCounter;
+
+  std::size_t programCounter = helper(vm);
+
+  state->locals = reinterpret_cast<std::uint64_t*>(vm->stackFrame->locals);
+  state->stack = reinterpret_cast<std::uint64_t*>(vm->stackFrame->opStackBase);
+  state->stackTop = reinterpret_cast<std::uint64_t*>(vm->stackTop);
+  state->programCounter = vm->stackFrame->programCounter;
+
+  return programCounter;
+}
+
+std::size_t runtime::VirtualMachine::invokeFromTrace(VirtualMachine* vm) noexcept {
+  std::size_t argCount = vm->getByteCodeParameter();
+  Variable callee = vm->stackTop[-static_cast<std::ptrdiff_t>(argCount) - 1];
+
+  // another function than the recorded one leaves the trace before the call
+  if (callee.type() == VariableType::Function && callee.functionValue()->prototype != vm->traceState->callee) {
+    return std::numeric_limits<std::size_t>::max();
+  }
+
+  vm->Invoke();
+  return vm->stackFrame->programCounter;
+}
+
+std::size_t runtime::VirtualMachine::backEdgeFromTrace(VirtualMachine* vm) noexcept {
+  vm->collectGarbageIfNeeded();
+  return vm->stackFrame->programCounter;
+}
+
+jit::Helpers runtime::VirtualMachine::makeNativeHelpers() {
+  using bytecode::ByteCodeInstruction;
+
+  jit::Helpers helpers{};
+
+  auto set = [&](ByteCodeInstruction instruction, jit::Helper helper) {
+    helpers[static_cast<std::size_t>(instruction)] = helper;
+  };
+
+  // Halt stays with the interpreter, which ends run()
+  set(ByteCodeInstruction::Add, &callFromNative<&VirtualMachine::Add>);
+  set(ByteCodeInstruction::Subtract, &callFromNative<&VirtualMachine::Subtract>);
+  set(ByteCodeInstruction::Multiply, &callFromNative<&VirtualMachine::Multiply>);
+  set(ByteCodeInstruction::Divide, &callFromNative<&VirtualMachine::Divide>);
+  set(ByteCodeInstruction::Print, &callFromNative<&VirtualMachine::Print>);
+  set(ByteCodeInstruction::Read, &callFromNative<&VirtualMachine::Read>);
+  set(ByteCodeInstruction::Jump, &jumpFromNative);
+  set(ByteCodeInstruction::JumpIfFalse, &callFromNative<&VirtualMachine::JumpIfFalse>);
+  set(ByteCodeInstruction::LoadIntegerConstant, &callFromNative<&VirtualMachine::LoadIntegerConstant>);
+  set(ByteCodeInstruction::LoadFloatConstant, &callFromNative<&VirtualMachine::LoadFloatConstant>);
+  set(ByteCodeInstruction::LoadStringConstant, &callFromNative<&VirtualMachine::LoadStringConstant>);
+  set(ByteCodeInstruction::LoadUndefinedConstant, &callFromNative<&VirtualMachine::LoadUndefinedConstant>);
+  set(ByteCodeInstruction::LoadBooleanTrueConstant, &callFromNative<&VirtualMachine::LoadBooleanTrueConstant>);
+  set(ByteCodeInstruction::LoadBooleanFalseConstant, &callFromNative<&VirtualMachine::LoadBooleanFalseConstant>);
+  set(ByteCodeInstruction::LoadLocal, &callFromNative<&VirtualMachine::LoadLocal>);
+  set(ByteCodeInstruction::SetLocal, &callFromNative<&VirtualMachine::SetLocal>);
+  set(ByteCodeInstruction::Return, &callFromNative<&VirtualMachine::Return>);
+  set(ByteCodeInstruction::Invoke, &callFromNative<&VirtualMachine::Invoke>);
+  set(ByteCodeInstruction::NoOp, &callFromNative<&VirtualMachine::advance>);
+  set(ByteCodeInstruction::MakeFn, &callFromNative<&VirtualMachine::MakeFn>);
+  set(ByteCodeInstruction::MakeObj, &callFromNative<&VirtualMachine::MakeObj>);
+  set(ByteCodeInstruction::Less, &callFromNative<&VirtualMachine::Less>);
+  set(ByteCodeInstruction::LessOrEqual, &callFromNative<&VirtualMachine::LessOrEqual>);
+  set(ByteCodeInstruction::Greater, &callFromNative<&VirtualMachine::Greater>);
+  set(ByteCodeInstruction::GreaterOrEqual, &callFromNative<&VirtualMachine::GreaterOrEqual>);
+  set(ByteCodeInstruction::Not, &callFromNative<&VirtualMachine::Not>);
+  set(ByteCodeInstruction::Equal, &callFromNative<&VirtualMachine::Equal>);
+  set(ByteCodeInstruction::NotEqual, &callFromNative<&VirtualMachine::NotEqual>);
+  set(ByteCodeInstruction::And, &callFromNative<&VirtualMachine::And>);
+  set(ByteCodeInstruction::Or, &callFromNative<&VirtualMachine::Or>);
+  set(ByteCodeInstruction::GetType, &callFromNative<&VirtualMachine::GetType>);
+  set(ByteCodeInstruction::CastToInt, &callFromNative<&VirtualMachine::CastToInt>);
+  set(ByteCodeInstruction::CastToFloat, &callFromNative<&VirtualMachine::CastToFloat>);
+  set(ByteCodeInstruction::Length, &callFromNative<&VirtualMachine::Length>);
+  set(ByteCodeInstruction::ChatAt, &callFromNative<&VirtualMachine::ChatAt>);
+  set(ByteCodeInstruction::StringAppend, &callFromNative<&VirtualMachine::StringAppend>);
+  set(ByteCodeInstruction::ObjectGet, &callFromNative<&VirtualMachine::ObjectGet>);
+  set(ByteCodeInstruction::ObjectSet, &callFromNative<&VirtualMachine::ObjectSet>);
+  set(ByteCodeInstruction::GetEnv, &callFromNative<&VirtualMachine::GetEnv>);
+  set(ByteCodeInstruction::LoadClosure, &callFromNative<&VirtualMachine::LoadClosure>);
+  set(ByteCodeInstruction::Pop, &callFromNative<&VirtualMachine::Pop>);
+  set(ByteCodeInstruction::TailCall, &callFromNative<&VirtualMachine::TailCall>);
+  set(ByteCodeInstruction::MakeArray, &callFromNative<&VirtualMachine::MakeArray>);
+  set(ByteCodeInstruction::IndexGet, &callFromNative<&VirtualMachine::IndexGet>);
+  set(ByteCodeInstruction::IndexSet, &callFromNative<&VirtualMachine::IndexSet>);
+  set(ByteCodeInstruction::ArrayPush, &callFromNative<&VirtualMachine::ArrayPush>);
+  set(ByteCodeInstruction::AddIntegerToLocal, &callFromNative<&VirtualMachine::AddIntegerToLocal>);
+  set(ByteCodeInstruction::JumpUnlessLocalLessInteger, &callFromNative<&VirtualMachine::JumpUnlessLocalLessInteger>);
+  set(ByteCodeInstruction::LoadLocalProperty, &callFromNative<&VirtualMachine::LoadLocalProperty>);
+  set(ByteCodeInstruction::AddInt, &callFromNative<&VirtualMachine::AddInt>);
+  set(ByteCodeInstruction::AddFloat, &callFromNative<&VirtualMachine::AddFloat>);
+  set(ByteCodeInstruction::SubtractInt, &callFromNative<&VirtualMachine::SubtractInt>);
+  set(ByteCodeInstruction::SubtractFloat, &callFromNative<&VirtualMachine::SubtractFloat>);
+  set(ByteCodeInstruction::MultiplyInt, &callFromNative<&VirtualMachine::MultiplyInt>);
+  set(ByteCodeInstruction::MultiplyFloat, &callFromNative<&VirtualMachine::MultiplyFloat>);
+  set(ByteCodeInstruction::DivideInt, &callFromNative<&VirtualMachine::DivideInt>);
+  set(ByteCodeInstruction::DivideFloat, &callFromNative<&VirtualMachine::DivideFloat>);
+  set(ByteCodeInstruction::LessInt, &callFromNative<&VirtualMachine::LessInt>);
+  set(ByteCodeInstruction::LessFloat, &callFromNative<&VirtualMachine::LessFloat>);
+  set(ByteCodeInstruction::LessOrEqualInt, &callFromNative<&VirtualMachine::LessOrEqualInt>);
+  set(ByteCodeInstruction::LessOrEqualFloat, &callFromNative<&VirtualMachine::LessOrEqualFloat>);
+  set(ByteCodeInstruction::GreaterInt, &callFromNative<&VirtualMachine::GreaterInt>);
+  set(ByteCodeInstruction::GreaterFloat, &callFromNative<&VirtualMachine::GreaterFloat>);
+  set(ByteCodeInstruction::GreaterOrEqualInt, &callFromNative<&VirtualMachine::GreaterOrEqualInt>);
+  set(ByteCodeInstruction::GreaterOrEqualFloat, &callFromNative<&VirtualMachine::GreaterOrEqualFloat>);
+
+  return helpers;
+}
+
+void runtime::VirtualMachine::profileStep() {
+  using bytecode::ByteCodeInstruction;
+
+  Prototype* prototype = this->stackFrame->function->prototype;
+  std::size_t programCounter = this->stackFrame->programCounter;
+  bytecode::ByteCode bc = prototype->byteCode[programCounter];
+  SiteProfile& site = prototype->profile[programCounter];
+
+  // the operands are still on the op stack or in locals, the instruction has
+  // not run yet
+  Variable first;
+  Variable second;
+
+  switch (bc.instruction) {
+    case ByteCodeInstruction::Add:
+    case ByteCodeInstruction::Subtract:
+    case ByteCodeInstruction::Multiply:
+    case ByteCodeInstruction::Divide:
+    case ByteCodeInstruction::Less:
+    case ByteCodeInstruction::LessOrEqual:
+    case ByteCodeInstruction::Greater:
+    case ByteCodeInstruction::GreaterOrEqual:
+    case ByteCodeInstruction::Equal:
+    case ByteCodeInstruction::NotEqual:
+    case ByteCodeInstruction::AddInt:
+    case ByteCodeInstruction::AddFloat:
+    case ByteCodeInstruction::SubtractInt:
+    case ByteCodeInstruction::SubtractFloat:
+    case ByteCodeInstruction::MultiplyInt:
+    case ByteCodeInstruction::MultiplyFloat:
+    case ByteCodeInstruction::DivideInt:
+    case ByteCodeInstruction::DivideFloat:
+    case ByteCodeInstruction::LessInt:
+    case ByteCodeInstruction::LessFloat:
+    case ByteCodeInstruction::LessOrEqualInt:
+    case ByteCodeInstruction::LessOrEqualFloat:
+    case ByteCodeInstruction::GreaterInt:
+    case ByteCodeInstruction::GreaterFloat:
+    case ByteCodeInstruction::GreaterOrEqualInt:
+    case ByteCodeInstruction::GreaterOrEqualFloat:
+    case ByteCodeInstruction::ObjectGet: {
+      first = this->stackTop[-2];
+      second = this->stackTop[-1];
+      break;
+    }
+    case ByteCodeInstruction::AddIntegerToLocal:
+    case ByteCodeInstruction::JumpUnlessLocalLessInteger: {
+      auto operands = bytecode::FusedOperands::Unpack(bc.parameter);
+      first = this->stackFrame->locals[operands.first];
+      second = Variable::MakeInteger(0);
+      break;
+    }
+    case ByteCodeInstruction::LoadLocalProperty: {
+      auto operands = bytecode::FusedOperands::Unpack(bc.parameter);
+      first = this->stackFrame->locals[operands.first];
+      second = Variable::MakeString(this->stringConstants[operands.second]);
+      break;
+    }
+    case ByteCodeInstruction::Invoke:
+    case ByteCodeInstruction::TailCall: {
+      first = *(this->stackTop - bc.parameter - 1);
+      second = Variable::MakeUndefined();
+      break;
+    }
+    default: {
+      return;
+    }
+  }
+
+  site.count++;
+  site.operandTypes[0] |= std::uint32_t{1} << static_cast<std::uint32_t>(first.type());
+  site.operandTypes[1] |= std::uint32_t{1} << static_cast<std::uint32_t>(second.type());
+
+  bool isPropertyRead = bc.instruction == ByteCodeInstruction::ObjectGet || bc.instruction == ByteCodeInstruction::LoadLocalProperty;
+  bool isCall = bc.instruction == ByteCodeInstruction::Invoke || bc.instruction == ByteCodeInstruction::TailCall;
+
+  if (isPropertyRead && first.type() == VariableType::Object) {
+    const Shape* shape = first.objectValue()->shape;
+
+    if (std::find(site.shapes.begin(), site.shapes.end(), shape) == site.shapes.end()) {
+      if (site.shapes.size() < maxProfiledVariants) {
+        site.shapes.push_back(shape);
+      } else {
+        site.isMegamorphic = true;
+      }
+    }
+  }
+
+  if (isCall && first.type() == VariableType::Function) {
+    const Prototype* callee = first.functionValue()->prototype;
+
+    if (std::find(site.callees.begin(), site.callees.end(), callee) == site.callees.end()) {
+      if (site.callees.size() < maxProfiledVariants) {
+        site.callees.push_back(callee);
+      } else {
+        site.isMegamorphic = true;
+      }
+    }
+  }
+}
+
+static void writeJsonString(std::ostream& out, std::string_view str) {
+  out << '"';
+
+  for (char c : str) {
+    switch (c) {
+      case '"': out << "\\\""; break;
+      case '\\': out << "\\\\"; break;
+      case '\n': out << "\\n"; break;
+      case '\t': out << "\\t"; break;
+      case '\r': out << "\\r"; break;
+      default: {
+        if (static_cast<unsigned char>(c) < 0x20) {
+          std::array<char, 7> escaped{};
+          std::snprintf(escaped.data(), escaped.size(), "\\u%04x", static_cast<unsigned>(c));
+          out << escaped.data();
+        } else {
+          out << c;
+        }
+      }
+    }
+  }
+
+  out << '"';
+}
+
+void runtime::VirtualMachine::writeProfile() {
+  // nothing ran before the prototypes were made
+  if (!this->isProfiling || this->prototypes.empty()) {
+    return;
+  }
+
+  std::ostream& out = *this->profile;
+
+  auto writeTypes = [&](std::uint32_t types) {
+    out << '[';
+    bool isFirst = true;
+    for (std::size_t i = 0; i < typeNames.size(); i++) {
+      if ((types & (std::uint32_t{1} << i)) != 0) {
+        out << (isFirst ? "" : ", ");
+        writeJsonString(out, typeNames[i]);
+        isFirst = false;
+      }
+    }
+    out << ']';
+  };
+
+  // the entrypoint's prototype is the last one
+  out << "{\n  \"entrypoint\": " << (this->prototypes.size() - 1) << ",\n  \"functions\": [";
+
+  for (std::size_t index = 0; index < this->prototypes.size(); index++) {
+    const Prototype& prototype = this->prototypes[index];
+
+    out << (index == 0 ? "\n" : ",\n") << "    {\"function\": " << index << ", \"sites\": [";
+
+    bool isFirstSite = true;
+
+    for (std::size_t programCounter = 0; programCounter < prototype.profile.size(); programCounter++) {
+      const SiteProfile& site = prototype.profile[programCounter];
+
+      if (site.count == 0) {
+        continue;
+      }
+
+      bytecode::ByteCode bc = prototype.fn->byteCode[programCounter];
+
+      out << (isFirstSite ? "\n" : ",\n") << "      {\"pc\": " << programCounter << ", \"instruction\": ";
+      writeJsonString(out, this->byteCodeToString(bc, false));
+      out << ", \"count\": " << site.count;
+
+      switch (bc.instruction) {
+        case bytecode::ByteCodeInstruction::Invoke:
+        case bytecode::ByteCodeInstruction::TailCall: {
+          out << ", \"callee\": ";
+          writeTypes(site.operandTypes[0]);
+          out << ", \"functions\": [";
+          for (std::size_t i = 0; i < site.callees.size(); i++) {
+            out << (i == 0 ? "" : ", ") << (site.callees[i] - this->prototypes.data());
+          }
+          out << ']';
+          break;
+        }
+        case bytecode::ByteCodeInstruction::ObjectGet:
+        case bytecode::ByteCodeInstruction::LoadLocalProperty: {
+          out << ", \"receiver\": ";
+          writeTypes(site.operandTypes[0]);
+          out << ", \"key\": ";
+          writeTypes(site.operandTypes[1]);
+
+          // each shape as the keys of its slots, null for dictionaries
+          out << ", \"shapes\": [";
+          for (std::size_t i = 0; i < site.shapes.size(); i++) {
+            out << (i == 0 ? "" : ", ");
+
+            if (site.shapes[i] == nullptr) {
+              out << "null";
+              continue;
+            }
+
+            std::vector<std::string_view> keys(site.shapes[i]->slots.size());
+            for (const auto& slot : site.shapes[i]->slots) {
+              if (slot.second < keys.size()) {
+                keys[slot.second] = slot.first->value;
+              }
+            }
+
+            out << '[';
+            for (std::size_t k = 0; k < keys.size(); k++) {
+              out << (k == 0 ? "" : ", ");
+              writeJsonString(out, keys[k]);
+            }
+            out << ']';
+          }
+          out << ']';
+          break;
+        }
+        default: {
+          out << ", \"operands\": [";
+          writeTypes(site.operandTypes[0]);
+          out << ", ";
+          writeTypes(site.operandTypes[1]);
+          out << ']';
+        }
+      }
+
+      if (site.isMegamorphic) {
+        out << ", \"megamorphic\": true";
+      }
+
+      out << '}';
+      isFirstSite = false;
+    }
+
+    out << (isFirstSite ? "]}" : "\n    ]}");
+  }
+
+  out << "\n  ]\n}\n";
+  out.flush();
+}
+
+bytecode::ByteCodeInstruction runtime::VirtualMachine::fetchInstruction() {
+  // verified code never runs off its end, other code is checked first
+  return this->stackFrame->function->prototype->byteCode[this->stackFrame->programCounter].instruction;
+}
+
+void runtime::VirtualMachine::checkInstruction() {
+  const bytecode::Function* fn = this->stackFrame->function->fn;
+  std::size_t depth = static_cast<std::size_t>(this->stackTop - this->stackFrame->opStackBase);
+
+  auto problem = verifier::checkInstruction(*this->file, *fn, fn == &this->file->entrypoint, this->stackFrame->programCounter, depth);
+
+  if (problem) {
+    this->panic(*problem);
+  }
+
+  if (bytecode::stackEffect(this->file->objects, fn->byteCode[this->stackFrame->programCounter]).pushes > static_cast<std::size_t>(this->stackEnd - this->stackTop)) {
+    this->panic("Stack overflow, op stack is full!");
+  }
+}
+
+void runtime::VirtualMachine::debugStep() {
+  this->flushOutput();
+  this->out << "BEGIN DEBUG\n";
+  this->print();
+  this->out << "END DEBUG\n";
+
+  std::string ignore;
+  std::getline(std::cin, ignore);
+
+  if (this->stackFrame->programCounter >= this->stackFrame->function->fn->byteCode.size()) {
+    this->panic("Program counter overran bytecode!");
+  }
+}
+
+void runtime::VirtualMachine::popStackFrame() {
+  auto currentFrame = this->stackFrame;
+
+  this->closeUpvalues(currentFrame->locals);
+
+  // the slot below the locals held the invoked function, the return value
+  // is pushed in its place
+  this->stackTop = currentFrame->locals - 1;
+  this->stackFrame = currentFrame - 1;
+}
+
+void runtime::VirtualMachine::pushStackFrame(const runtime::Function* function, Variable* locals, std::size_t argumentCount) {
+  if (this->stackFrame != nullptr) {
+    if (static_cast<std::size_t>(this->stackFrame - this->frames.get()) + 1 >= this->maxStackFrames) {
+      this->panic("Stack overflow, too many stack frames!");
+    }
+
+    if (this->stackFrame + 1 == this->framesEnd) {
+      this->growFrames();
+    }
+  }
+
+  StackFrame* newFrame = this->stackFrame == nullptr ? this->frames.get() : this->stackFrame + 1;
+
+  std::size_t localsCount = function->fn->localsCount;
+
+  // the op stack is reserved along with the locals, verified code never
+  // pushes past it
+  if (localsCount + function->fn->maxStack > static_cast<std::size_t>(this->stackEnd - locals)) {
+    std::size_t offset = static_cast<std::size_t>(locals - this->valueStack.get());
+    this->growValueStack(offset + localsCount + function->fn->maxStack);
+    locals = this->valueStack.get() + offset;
+  }
+
+  // the arguments already sit in the parameter slots, missing parameters and
+  // the remaining locals start out undefined and extra arguments are dropped
+  for (std::size_t i = std::min(argumentCount, function->fn->argumentCount); i < localsCount; i++) {
+    locals[i] = Variable::MakeUndefined();
+  }
+
+  newFrame->programCounter = 0;
+  newFrame->function = function;
+  newFrame->locals = locals;
+  newFrame->opStackBase = locals + localsCount;
+
+  this->stackTop = newFrame->opStackBase;
+  this->stackFrame = newFrame;
+}
+
+void runtime::VirtualMachine::growFrames() {
+  StackFrame* base = this->frames.get();
+  std::size_t size = static_cast<std::size_t>(this->framesEnd - base);
+
+  // pushStackFrame panics before the frames outgrow maxStackFrames
+  std::size_t grownSize = std::min(size * 2, this->maxStackFrames);
+  std::unique_ptr<StackFrame[]> grown{new (std::nothrow) StackFrame[grownSize]};
+
+  if (grown == nullptr) {
+    this->panic("Stack overflow, out of memory for stack frames!");
+  }
+
+  std::copy(base, this->framesEnd, grown.get());
+
+  auto move = [&](StackFrame*& frame) {
+    if (frame != nullptr) {
+      frame = grown.get() + (frame - base);
+    }
+  };
+
+  move(this->stackFrame);
+  move(this->traceFrame);
+  move(this->traceLastFrame);
+
+  this->frames = std::move(grown);
+  this->framesEnd = this->frames.get() + grownSize;
+}
+
+void runtime::VirtualMachine::growValueStack(std::size_t size) {
+  Variable* base = this->valueStack.get();
+  std::size_t grownSize = static_cast<std::size_t>(this->stackEnd - base) * 2;
+
+  while (grownSize < size) {
+    grownSize *= 2;
+  }
+
+  std::unique_ptr<Variable[]> grown{new (std::nothrow) Variable[grownSize]};
+
+  if (grown == nullptr) {
+    this->panic("Stack overflow, out of memory for the value stack!");
+  }
+
+  // everything above the top is dead
+  std::copy(base, this->stackTop, grown.get());
+
+  auto move = [&](auto*& pointer) {
+    using Pointer = std::remove_reference_t<decltype(pointer)>;
+    pointer = reinterpret_cast<Pointer>(grown.get() + (reinterpret_cast<Variable*>(pointer) - base));
+  };
+
+  move(this->stackTop);
+
+  if (this->stackFrame != nullptr) {
+    for (StackFrame* frame = this->frames.get(); frame <= this->stackFrame; frame++) {
+      move(frame->locals);
+      move(frame->opStackBase);
+    }
+  }
+
+  for (Upvalue* upvalue = this->openUpvalues; upvalue != nullptr; upvalue = upvalue->nextOpen) {
+    move(upvalue->location);
+  }
+
+  // a running trace syncs its state from the vm after every helper anyway
+  if (this->traceState != nullptr) {
+    move(this->traceState->locals);
+    move(this->traceState->stack);
+    move(this->traceState->stackTop);
+  }
+
+  this->valueStack = std::move(grown);
+  this->stackEnd = this->valueStack.get() + grownSize;
+}
+
+Variable runtime::VirtualMachine::popOpStack() {
+  this->stackTop--;
+
+  return *this->stackTop;
+}
+
+void runtime::VirtualMachine::pushOpStack(Variable v) {
+  *this->stackTop = v;
+  this->stackTop++;
+}
+
+runtime::Upvalue* runtime::VirtualMachine::captureUpvalue(Variable* local) {
+  // open upvalues are kept sorted from the top of the stack down so that
+  // closing a frame only has to look at the front of the list
+  Upvalue* previous = nullptr;
+  Upvalue* current = this->openUpvalues;
+
+  while (current != nullptr && current->location > local) {
+    previous = current;
+    current = current->nextOpen;
+  }
+
+  if (current != nullptr && current->location == local) {
+    return current;
+  }
+
+  Upvalue* upvalue = this->heap.NewUpvalue();
+  upvalue->location = local;
+  upvalue->nextOpen = current;
+
+  if (previous == nullptr) {
+    this->openUpvalues = upvalue;
+  } else {
+    previous->nextOpen = upvalue;
+    this->heap.WriteBarrier(previous, upvalue);
+  }
+
+  return upvalue;
+}
+
+void runtime::VirtualMachine::closeUpvalues(Variable* last) {
+  while (this->openUpvalues != nullptr && this->openUpvalues->location >= last) {
+    Upvalue* upvalue = this->openUpvalues;
+    upvalue->closed = *upvalue->location;
+    upvalue->location = &upvalue->closed;
+    this->heap.WriteBarrier(upvalue, upvalue->closed);
+    this->openUpvalues = upvalue->nextOpen;
+    upvalue->nextOpen = nullptr;
+  }
+}
+
+void runtime::VirtualMachine::Add() {
+  Variable second = this->popOpStack();
+  Variable first = this->popOpStack();
+
+  this->quicken(first, second, bytecode::ByteCodeInstruction::AddInt, bytecode::ByteCodeInstruction::AddFloat);
+
+  if (!this->protectDifferentTypes(first, second)) {
+    this->advance();
+    return;
+  }
+
+  if (first.type() == VariableType::Integer) {
+    this->pushInteger(first.integerValue() + second.integerValue());
+
+  } else if (first.type() == VariableType::Float) {
+    this->pushFloat(first.doubleValue() + second.doubleValue());
+
+  } else {
+    this->pushUndefined();
+  }
+
+  this->advance();
+}
+
+void runtime::VirtualMachine::Subtract() {
+  Variable second = this->popOpStack();
+  Variable first = this->popOpStack();
+
+  this->quicken(first, second, bytecode::ByteCodeInstruction::SubtractInt, bytecode::ByteCodeInstruction::SubtractFloat);
+
+  if (!this->protectDifferentTypes(first, second)) {
+    this->advance();
+    return;
+  }
+
+  if (first.type() == VariableType::Integer) {
+    this->pushInteger(first.integerValue() - second.integerValue());
+
+  } else if (first.type() == VariableType::Float) {
+    this->pushFloat(first.doubleValue() - second.doubleValue());
+
+  } else {
+    this->pushUndefined();
+  }
+
+  this->advance();
+}
+
+void runtime::VirtualMachine::Multiply() {
+  Variable second = this->popOpStack();
+  Variable first = this->popOpStack();
+
+  this->quicken(first, second, bytecode::ByteCodeInstruction::MultiplyInt, bytecode::ByteCodeInstruction::MultiplyFloat);
+
+  if (!this->protectDifferentTypes(first, second)) {
+    this->advance();
+    return;
+  }
+
+  if (first.type() == VariableType::Integer) {
+    this->pushInteger(first.integerValue() * second.integerValue());
+
+  } else if (first.type() == VariableType::Float) {
+    this->pushFloat(first.doubleValue() * second.doubleValue());
+
+  } else {
+    this->pushUndefined();
+  }
+
+  this->advance();
+}
+
+void runtime::VirtualMachine::Divide() {
+  Variable second = this->popOpStack();
+  Variable first = this->popOpStack();
+
+  this->quicken(first, second, bytecode::ByteCodeInstruction::DivideInt, bytecode::ByteCodeInstruction::DivideFloat);
+
+  if (!this->protectDifferentTypes(first, second)) {
+    this->advance();
+    return;
+  }
+
+  if (first.type() == VariableType::Integer) {
+    if (second.integerValue() == 0) {
+      this->pushUndefined();
+
+    } else {
+      this->pushInteger(first.integerValue() / second.integerValue());
+    }
+
+  } else if (first.type() == VariableType::Float) {
+    this->pushFloat(first.doubleValue() / second.doubleValue());
+
+  } else {
+    this->pushUndefined();
+  }
+
+  this->advance();
+}
+
+void runtime::VirtualMachine::Print() {
+  Variable var = this->popOpStack();
+
+  switch (var.type()) {
+    case VariableType::String: {
+      this->writeOutput(flattenString(var.stringValue()));
+      break;
+    }
+    case VariableType::Integer: {
+      this->writeInteger(var.integerValue());
+      break;
+    }
+    case VariableType::Float: {
+      this->writeFloat(var.doubleValue());
+      break;
+    }
+    default: {
+      this->writeOutput(this->variableToString(var, true));
+    }
+  }
+
+  this->pushUndefined();
+  this->advance();
+}
+
+void runtime::VirtualMachine::flushOutput() {
+  this->out.write(this->outputBuffer.get(), this->outputTop - this->outputBuffer.get());
+  this->outputTop = this->outputBuffer.get();
+}
+
+void runtime::VirtualMachine::writeOutput(std::string_view text) {
+  if (text.size() > static_cast<std::size_t>(this->outputEnd - this->outputTop)) {
+    this->flushOutput();
+
+    if (text.size() > outputBufferSize) {
+      this->out.write(text.data(), static_cast<std::streamsize>(text.size()));
+      return;
+    }
+  }
+
+  std::memcpy(this->outputTop, text.data(), text.size());
+  this->outputTop += text.size();
+}
+
+// numbers are formatted straight into the buffer, floats the same way as
+// std::to_string does
+void runtime::VirtualMachine::writeInteger(std::int64_t val) {
+  if (static_cast<std::size_t>(this->outputEnd - this->outputTop) < maxNumberLength) {
+    this->flushOutput();
+  }
+
+  this->outputTop = std::to_chars(this->outputTop, this->outputEnd, val).ptr;
+}
+
+void runtime::VirtualMachine::writeFloat(double val) {
+  if (static_cast<std::size_t>(this->outputEnd - this->outputTop) < maxNumberLength) {
+    this->flushOutput();
+  }
+
+  this->outputTop = std::to_chars(this->outputTop, this->outputEnd, val, std::chars_format::fixed, 6).ptr;
+}
+
+void runtime::VirtualMachine::Read() {
+  // prompts printed before reading have to be visible
+  this->flushOutput();
+
+  auto ret = this->heap.NewString();
+  ret->value.clear();
+
+  // the line is copied once, from the input buffer into the new string,
+  // without its newline. At the end of the input the rest is returned.
+  while (this->inputTop != this->inputEnd || this->fillInput()) {
+    auto length = static_cast<std::size_t>(this->inputEnd - this->inputTop);
+    auto newline = static_cast<char*>(std::memchr(this->inputTop, '\n', length));
+
+    if (newline != nullptr) {
+      ret->value.append(this->inputTop, newline);
+      this->inputTop = newline + 1;
+      break;
+    }
+
+    ret->value.append(this->inputTop, this->inputEnd);
+    this->inputTop = this->inputEnd;
+  }
+
+  this->pushString(ret);
+  this->advance();
+}
+
+bool runtime::VirtualMachine::fillInput() {
+  std::streamsize count = 0;
+
+  // standard input is read directly so that a block read returns as soon as
+  // a line is available on a terminal, other streams are read through their
+  // buffer
+  if (&this->in == &std::cin) {
+    ssize_t result = 0;
+    do {
+      result = ::read(STDIN_FILENO, this->inputBuffer.get(), inputBufferSize);
+    } while (result < 0 && errno == EINTR);
+    count = result < 0 ? 0 : result;
+
+  } else {
+    count = this->in.rdbuf()->sgetn(this->inputBuffer.get(), inputBufferSize);
+  }
+
+  this->inputTop = this->inputBuffer.get();
+  this->inputEnd = this->inputBuffer.get() + count;
+
+  return count > 0;
+}
+
+void runtime::VirtualMachine::Jump() {
+  std::size_t target = this->getByteCodeParameter();
+
+  // hot loops run as traces from their back edge
+  if (this->isTracing && target <= this->stackFrame->programCounter && this->traceLoop(target)) {
+    return;
+  }
+
+  this->jumpTo(target);
+}
+
+void runtime::VirtualMachine::jumpTo(std::size_t target) {
+  // loop back edges are one of the points where the heap is collected, see
+  // collectGarbageIfNeeded
+  if (target <= this->stackFrame->programCounter) {
+    this->collectGarbageIfNeeded();
+  }
+
+  this->stackFrame->programCounter = target;
+}
+
+void runtime::VirtualMachine::JumpIfFalse() {
+  Variable top{this->popOpStack()};
+
+  if (!this->booleanValueOfVariable(top)) {
+    this->Jump();
+  } else {
+    this->advance();
+  }
+}
+
+void runtime::VirtualMachine::LoadIntegerConstant() {
+
+  std::size_t index = this->getByteCodeParameter();
+
+  this->pushInteger(this->file->intConstants[index]);
+
+  this->advance();
+}
+
+void runtime::VirtualMachine::LoadFloatConstant() {
+  std::size_t index = this->getByteCodeParameter();
+
+  this->pushFloat(this->file->floatConstants[index]);
+
+  this->advance();
+}
+
+void runtime::VirtualMachine::LoadStringConstant() {
+  std::size_t index = this->getByteCodeParameter();
+
+  this->pushString(this->stringConstants[index]);
+
+  this->advance();
+}
+
+void runtime::VirtualMachine::LoadUndefinedConstant() {
+  this->pushUndefined();
+  this->advance();
+}
+
+void runtime::VirtualMachine::LoadBooleanTrueConstant() {
+  this->pushBoolean(true);
+  this->advance();
+}
+
+void runtime::VirtualMachine::LoadBooleanFalseConstant() {
+  this->pushBoolean(false);
+  this->advance();
+}
+
+void runtime::VirtualMachine::LoadLocal() {
+  auto index = this->getByteCodeParameter();
+
+  Variable local = this->stackFrame->locals[index];
+
+  this->pushOpStack(local);
+
+  this->advance();
+}
+
+void runtime::VirtualMachine::LoadClosure() {
+  this->pushOpStack(
+    this->loadClosureValue(this->stackFrame->function, this->getByteCodeParameter())
+  );
+
+  this->advance();
+}
+
+void runtime::VirtualMachine::SetLocal() {
+  auto index = this->getByteCodeParameter();
+
+  Variable top = this->popOpStack();
+
+  this->stackFrame->locals[index] = top;
+
+  this->advance();
+}
+
+runtime::Variable runtime::VirtualMachine::loadClosureValue(const runtime::Function* fn, std::size_t index) {
+  return *fn->captures[index]->location;
+}
+
+runtime::Shape* runtime::VirtualMachine::newShape(runtime::Shape* parent, runtime::String* key) {
+  this->shapes.push_back(std::make_unique<Shape>(key));
+  Shape* shape = this->shapes.back().get();
+
+  if (parent != nullptr) {
+    shape->slots = parent->slots;
+    shape->slots.emplace(key, shape->slots.size());
+    parent->transitions.emplace(key, shape);
+  }
+
+  return shape;
+}
+
+runtime::Shape* runtime::VirtualMachine::shapeTransition(runtime::Shape* shape, runtime::String* key) {
+  auto find = shape->transitions.find(key);
+
+  if (find != shape->transitions.end()) {
+    return find->second;
+  }
+
+  // objects used as maps would otherwise make a shape for every key
+  if (shape->slots.size() == maxShapeSlots || shape->transitions.size() == maxShapeTransitions) {
+    return nullptr;
+  }
+
+  return this->newShape(shape, this->intern(key));
+}
+
+void runtime::VirtualMachine::makeDictionary(runtime::Object* obj) {
+  for (const auto& slot : obj->shape->slots) {
+    obj->properties.emplace(PropertyKey{slot.first}, obj->slots[slot.second]);
+  }
+
+  obj->shape = nullptr;
+  obj->slots.clear();
+}
+
+const runtime::Variable* runtime::VirtualMachine::findProperty(const runtime::Object* obj, runtime::String* key) {
+  if (obj->shape != nullptr) {
+    auto find = obj->shape->slots.find(key);
+    return find == obj->shape->slots.end() ? nullptr : &obj->slots[find->second];
+  }
+
+  auto find = obj->properties.find(PropertyKey{key});
+  return find == obj->properties.end() ? nullptr : &find->second;
+}
+
+void runtime::VirtualMachine::setProperty(runtime::Object* obj, runtime::String* key, runtime::Variable value) {
+  if (obj->shape != nullptr) {
+    auto find = obj->shape->slots.find(key);
+
+    if (find != obj->shape->slots.end()) {
+      obj->slots[find->second] = value;
+      return;
+    }
+
+    Shape* next = this->shapeTransition(obj->shape, key);
+
+    if (next != nullptr) {
+      obj->shape = next;
+      obj->slots.push_back(value);
+      return;
+    }
+
+    this->makeDictionary(obj);
+  }
+
+  auto find = obj->properties.find(PropertyKey{key});
+
+  if (find != obj->properties.end()) {
+    find->second = value;
+    return;
+  }
+
+  obj->properties.emplace(PropertyKey{key}, value);
+  this->heap.WriteBarrier(obj, key);
+}
+
+std::size_t runtime::VirtualMachine::propertyCount(const runtime::Object* obj) {
+  std::size_t named = obj->shape != nullptr ? obj->shape->slots.size() : obj->properties.size();
+  return named + obj->elements.size();
+}
+
+runtime::String* runtime::VirtualMachine::intern(std::string_view value) {
+  auto find = this->internTable.find(value);
+
+  if (find != this->internTable.end()) {
+    return find->second;
+  }
+
+  // canonical strings are allocated old so that the table, shapes and inline
+  // caches never see them move
+  String* interned = this->heap.NewOldString();
+  interned->value.assign(value.data(), value.size());
+  interned->isInterned = true;
+  hashString(interned);
+  this->internTable.emplace(interned->value, interned);
+  return interned;
+}
+
+runtime::String* runtime::VirtualMachine::intern(runtime::String* str) {
+  if (str->isInterned) {
+    return str;
+  }
+
+  if (str->isYoung) {
+    return this->intern(flattenString(str));
+  }
+
+  auto find = this->internTable.find(flattenString(str));
+
+  if (find != this->internTable.end()) {
+    return find->second;
+  }
+
+  str->isInterned = true;
+  hashString(str);
+  this->internTable.emplace(str->value, str);
+  return str;
+}
+
+void runtime::VirtualMachine::forgetInterned(runtime::String* str) {
+  this->internTable.erase(str->value);
+}
+
+runtime::InlineCache& runtime::VirtualMachine::inlineCache() {
+  Prototype* prototype = this->stackFrame->function->prototype;
+  return prototype->inlineCaches[prototype->inlineCacheIndex[this->stackFrame->programCounter]];
+}
+
+runtime::Upvalue* runtime::VirtualMachine::loadClosure(const bytecode::ClosureContext& closure) {
+  // a closure either captures a local of the function creating it, or one of
+  // the captures of that function when the variable lives further out
+  if (closure.isLocal) {
+    return this->captureUpvalue(this->stackFrame->locals + closure.index);
+  }
+
+  return this->stackFrame->function->captures[closure.index];
+}
+
+void runtime::VirtualMachine::MakeFn() {
+  std::size_t index = this->getByteCodeParameter();
+
+  runtime::Function* fn = this->heap.NewFunction();
+  fn->fn = &this->file->functions[index];
+  fn->prototype = &this->prototypes[index];
+  fn->captures.clear();
+
+  for (const auto& closure : fn->fn->closures) {
+    auto upvalue = this->loadClosure(closure);
+    fn->captures.push_back(upvalue);
+    this->heap.WriteBarrier(fn, upvalue);
+  }
+
+  this->pushFunction(fn);
+
+  this->advance();
+}
+
+void runtime::VirtualMachine::Return() {
+  Variable top = this->popOpStack();
+  this->popStackFrame();
+  this->pushOpStack(top);
+
+  this->advance();
+}
+
+void runtime::VirtualMachine::Invoke() {
+
+  std::size_t argCount = this->getByteCodeParameter();
+
+  // the function is followed by its arguments on the op stack, which become
+  // the first locals of the new frame without being copied
+  // index 0 <- function
+  // index 1 <- arg 0
+  // index n <- arg n - 1
+
+  this->collectGarbageIfNeeded();
+
+  Variable* callee = this->stackTop - argCount - 1;
+
+  if (callee->type() != VariableType::Function) {
+    this->stackTop = callee;
+    this->pushUndefined();
+    this->advance();
+    return;
+  }
+
+  this->pushStackFrame(callee->functionValue(), callee + 1, argCount);
+}
+
+void runtime::VirtualMachine::TailCall() {
+
+  std::size_t argCount = this->getByteCodeParameter();
+
+  if (this->stackFrame == this->frames.get()) {
+    // the entrypoint has no frame to give up, make a regular call instead
+    this->Invoke();
+    return;
+  }
+
+  this->collectGarbageIfNeeded();
+
+  Variable* callee = this->stackTop - argCount - 1;
+
+  if (callee->type() != VariableType::Function) {
+    // the Return following this instruction returns the undefined
+    this->stackTop = callee;
+    this->pushUndefined();
+    this->advance();
+    return;
+  }
+
+  // the function and its arguments replace the current frame's function slot
+  // and locals, then the frame is reused for the callee. The caller's program
+  // counter still points at its Invoke so the callee returns straight to it.
+  Variable* locals = this->stackFrame->locals;
+
+  this->closeUpvalues(locals);
+
+  std::copy(callee, this->stackTop, locals - 1);
+
+  this->stackFrame--;
+  this->pushStackFrame((locals - 1)->functionValue(), locals, argCount);
+}
+
+void runtime::VirtualMachine::MakeObj() {
+
+  std::size_t objIndex = this->getByteCodeParameter();
+
+  const auto& constructorShape = this->constructorShapes[objIndex];
+  std::size_t keyCount = constructorShape.keys.size();
+
+  auto ret = this->heap.NewObject();
+  Variable* values = this->stackTop - keyCount;
+
+  // values are assigned in key order so that the last of repeated keys wins
+  if (constructorShape.shape != nullptr) {
+    ret->shape = constructorShape.shape;
+    ret->slots.resize(constructorShape.shape->slots.size());
+
+    for (std::size_t i = 0; i < keyCount; i++) {
+      ret->slots[constructorShape.slots[i]] = values[i];
+      this->heap.WriteBarrier(ret, values[i]);
+    }
+
+  } else {
+    for (std::size_t i = 0; i < keyCount; i++) {
+      ret->properties[PropertyKey{constructorShape.keys[i]}] = values[i];
+      this->heap.WriteBarrier(ret, values[i]);
+    }
+  }
+
+  this->stackTop = values;
+
+  this->pushObject(ret);
+  this->advance();
+}
+
+void runtime::VirtualMachine::MakeArray() {
+  std::size_t count = this->getByteCodeParameter();
+
+  auto ret = this->heap.NewArray();
+  Variable* values = this->stackTop - count;
+
+  ret->elements.assign(values, this->stackTop);
+  for (std::size_t i = 0; i < count; i++) {
+    this->heap.WriteBarrier(ret, values[i]);
+  }
+
+  this->stackTop = values;
+
+  this->pushArray(ret);
+  this->advance();
+}
+
+void runtime::VirtualMachine::Less() {
+  Variable second = this->popOpStack();
+  Variable first = this->popOpStack();
+
+  this->quicken(first, second, bytecode::ByteCodeInstruction::LessInt, bytecode::ByteCodeInstruction::LessFloat);
+
+  if (!this->protectDifferentTypes(first, second)) {
+    this->advance();
+    return;
+  }
+
+  if (first.type() == VariableType::Integer) {
+    this->pushBoolean(first.integerValue() < second.integerValue());
+
+  } else if (first.type() == VariableType::Float) {
+    this->pushBoolean(first.doubleValue() < second.doubleValue());
+
+  } else {
+    this->pushUndefined();
+  }
+  this->advance();
+}
+
+void runtime::VirtualMachine::LessOrEqual() {
+  Variable second = this->popOpStack();
+  Variable first = this->popOpStack();
+
+  this->quicken(first, second, bytecode::ByteCodeInstruction::LessOrEqualInt, bytecode::ByteCodeInstruction::LessOrEqualFloat);
+
+  if (!this->protectDifferentTypes(first, second)) {
+    this->advance();
+    return;
+  }
+
+  if (first.type() == VariableType::Integer) {
+    this->pushBoolean(first.integerValue() <= second.integerValue());
+
+  } else if (first.type() == VariableType::Float) {
+    this->pushBoolean(first.doubleValue() <= second.doubleValue());
+
+  } else {
+    this->pushUndefined();
+  }
+  this->advance();
+}
+
+void runtime::VirtualMachine::Greater() {
+  Variable second = this->popOpStack();
+  Variable first = this->popOpStack();
+
+  this->quicken(first, second, bytecode::ByteCodeInstruction::GreaterInt, bytecode::ByteCodeInstruction::GreaterFloat);
+
+  if (!this->protectDifferentTypes(first, second)) {
+    this->advance();
+    return;
+  }
+
+  if (first.type() == VariableType::Integer) {
+    this->pushBoolean(first.integerValue() > second.integerValue());
+
+  } else if (first.type() == VariableType::Float) {
+    this->pushBoolean(first.doubleValue() > second.doubleValue());
+
+  } else {
+    this->pushUndefined();
+  }
+  this->advance();
+}
+
+void runtime::VirtualMachine::GreaterOrEqual() {
+  Variable second = this->popOpStack();
+  Variable first = this->popOpStack();
+
+  this->quicken(first, second, bytecode::ByteCodeInstruction::GreaterOrEqualInt, bytecode::ByteCodeInstruction::GreaterOrEqualFloat);
+
+  if (!this->protectDifferentTypes(first, second)) {
+    this->advance();
+    return;
+  }
+
+  if (first.type() == VariableType::Integer) {
+    this->pushBoolean(first.integerValue() >= second.integerValue());
+
+  } else if (first.type() == VariableType::Float) {
+    this->pushBoolean(first.doubleValue() >= second.doubleValue());
+
+  } else {
+    this->pushUndefined();
+  }
+  this->advance();
+}
+
+void runtime::VirtualMachine::Not() {
+  Variable top = this->popOpStack();
+  this->pushBoolean(!this->booleanValueOfVariable(top));
+  this->advance();
+}
+
+void runtime::VirtualMachine::Equal() {
+  Variable second = this->popOpStack();
+  Variable first = this->popOpStack();
+
+  this->pushBoolean(this->variableEquals(first, second));
+  this->advance();
+}
+
+void runtime::VirtualMachine::NotEqual() {
+  Variable second = this->popOpStack();
+  Variable first = this->popOpStack();
+
+  this->pushBoolean(!this->variableEquals(first, second));
+  this->advance();
+}
 
-  // index 0 <- arg n
-  // index 1 <- arg n - 1
-  // index n - 1 <- arg 1
-  // index n <- arg 0
+void runtime::VirtualMachine::And() {
+  Variable second = this->popOpStack();
+  Variable first = this->popOpStack();
+
+  this->pushBoolean(
+    this->booleanValueOfVariable(first)
+    &&
+    this->booleanValueOfVariable(second)
+  );
+  this->advance();
+}
+
+void runtime::VirtualMachine::Or() {
+ Variable second = this->popOpStack();
+  Variable first = this->popOpStack();
+
+  this->pushBoolean(
+    this->booleanValueOfVariable(first)
+    ||
+    this->booleanValueOfVariable(second)
+  );
+  this->advance();
+}
+
+void runtime::VirtualMachine::GetType() {
+  Variable top = this->popOpStack();
+  this->pushString(this->typeNameStrings[static_cast<std::size_t>(top.type())]);
+  this->advance();
+}
+
+void runtime::VirtualMachine::CastToInt() {
+  Variable top = this->popOpStack();
+
+  switch (top.type()) {
+    case VariableType::Integer: {
+      this->pushInteger(top.integerValue());
+      break;
+    }
+    case VariableType::Float: {
+      this->pushInteger(static_cast<std::int64_t>(top.doubleValue()));
+      break;
+    }
+    case VariableType::Function: {
+      this->pushUndefined();
+      break;
+    }
+    case VariableType::Object: {
+      this->pushUndefined();
+      break;
+    }
+    case VariableType::Array: {
+      this->pushUndefined();
+      break;
+    }
+    case VariableType::String: {
+      try {
+        std::int64_t val = std::stoll(std::string{flattenString(top.stringValue())});
+        this->pushInteger(val);
+
+      } catch (...) {
+        this->pushUndefined();
+      }
+      break;
+    }
+    case VariableType::Undefined: {
+      this->pushUndefined();
+      break;
+    }
+    case VariableType::Boolean: {
+      this->pushUndefined();
+      break;
+    }
+    default: {
+      this->panic("Unknown varible type at variableEquals");
+    }
+  }
+
+  this->advance();
+}
+
+void runtime::VirtualMachine::CastToFloat() {
+  Variable top = this->popOpStack();
+
+  switch (top.type()) {
+    case VariableType::Integer: {
+      this->pushFloat(static_cast<double>(top.integerValue()));
+      break;
+    }
+    case VariableType::Float: {
+      this->pushFloat(top.doubleValue());
+      break;
+    }
+    case VariableType::Function: {
+      this->pushUndefined();
+      break;
+    }
+    case VariableType::Object: {
+      this->pushUndefined();
+      break;
+    }
+    case VariableType::Array: {
+      this->pushUndefined();
+      break;
+    }
+    case VariableType::String: {
+      try {
+        double val = std::stod(std::string{flattenString(top.stringValue())});
+        this->pushFloat(val);
 
-  for (std::size_t i = 0; i < argCount; i++) {
-    args.push_back(this->popOpStack());
+      } catch (...) {
+        this->pushUndefined();
+      }
+      break;
+    }
+    case VariableType::Undefined: {
+      this->pushUndefined();
+      break;
+    }
+    case VariableType::Boolean: {
+      this->pushUndefined();
+      break;
+    }
+    default: {
+      this->panic("Unknown varible type at variableEquals");
+    }
   }
 
+  this->advance();
+}
+
+void runtime::VirtualMachine::Length() {
   Variable top = this->popOpStack();
 
-  if (top.type != VariableType::Function) {
+  switch (top.type()) {
+    case VariableType::Integer: {
+      this->pushUndefined();
+      break;
+    }
+    case VariableType::Float: {
+      this->pushUndefined();
+      break;
+    }
+    case VariableType::Function: {
+      this->pushUndefined();
+      break;
+    }
+    case VariableType::Object: {
+      this->pushInteger(this->propertyCount(top.objectValue()));
+      break;
+    }
+    case VariableType::Array: {
+      this->pushInteger(static_cast<std::int64_t>(top.arrayValue()->elements.size()));
+      break;
+    }
+    case VariableType::String: {
+      this->pushInteger(stringLength(top.stringValue()));
+      break;
+    }
+    case VariableType::Undefined: {
+      this->pushUndefined();
+      break;
+    }
+    case VariableType::Boolean: {
+      this->pushUndefined();
+      break;
+    }
+    default: {
+      this->panic("Unknown varible type at variableEquals");
+    }
+  }
+
+  this->advance();
+}
+
+void runtime::VirtualMachine::ChatAt() {
+  Variable second = this->popOpStack();
+  Variable first = this->popOpStack();
+
+  if (first.type() != VariableType::String) {
+    this->pushUndefined();
+    this->advance();
+    return;
+  }
+
+  if (second.type() != VariableType::Integer) {
     this->pushUndefined();
     this->advance();
     return;
   }
 
-  this->pushStackFrame(top.functionValue);
+  std::size_t index = static_cast<std::size_t>(second.integerValue());
 
-  for (
-    std::size_t stackFrameLocalIndex = 0, i = args.size();
-    i-- > 0 && stackFrameLocalIndex < this->stackFrame->locals.size();
-    stackFrameLocalIndex++
-  ) {
-    this->stackFrame->locals.at(stackFrameLocalIndex) = args.at(i);
+  if (index >= stringLength(first.stringValue())) {
+    this->pushUndefined();
+    this->advance();
+    return;
   }
+
+  char c = flattenString(first.stringValue())[index];
+  this->pushString(this->characterStrings[static_cast<unsigned char>(c)]);
+  this->advance();
 }
 
-void runtime::VirtualMachine::MakeObj() {
+void runtime::VirtualMachine::StringAppend() {
+  Variable second = this->popOpStack();
+  Variable first = this->popOpStack();
 
-  std::size_t objIndex = this->getByteCodeParameter();
+  String* left = this->appendOperand(first);
+  String* right = this->appendOperand(second);
 
-  if (objIndex >= this->file->objects.size()) {
-    this->panic("Index out of bounds in MakeObj");
+  // strings never change so an empty half lets the other be reused
+  if (stringLength(right) == 0) {
+    this->pushString(left);
+    this->advance();
     return;
   }
 
-  const auto& objProto = this->file->objects.at(objIndex);
+  if (stringLength(left) == 0) {
+    this->pushString(right);
+    this->advance();
+    return;
+  }
 
-  auto ret = this->heap.NewObject();
-  ret->properties.clear();
+  std::size_t length = stringLength(left) + stringLength(right);
 
-  for (std::size_t i = objProto.keys.size(); i-- > 0;) {
-    const std::string & key = objProto.keys.at(i);
-    const Variable value = this->popOpStack();
-    ret->properties.insert(std::make_pair(key, value));
+  if (length < minRopeLength) {
+    auto str = this->heap.NewString();
+    str->value.reserve(length);
+    str->value.append(flattenString(left));
+    str->value.append(flattenString(right));
+    this->pushString(str);
+    this->advance();
+    return;
   }
 
-  this->pushObject(ret);
+  auto rope = this->heap.NewRope();
+  rope->left = left;
+  rope->right = right;
+  rope->length = length;
+  this->heap.WriteBarrier(rope, left);
+  this->heap.WriteBarrier(rope, right);
+
+  this->pushString(rope);
   this->advance();
 }
 
-void runtime::VirtualMachine::Less() {
+void runtime::VirtualMachine::ObjectGet() {
   Variable second = this->popOpStack();
   Variable first = this->popOpStack();
 
-  if (!this->protectDifferentTypes(first, second)) {
+  this->pushOpStack(this->objectGet(first, second));
+  this->advance();
+}
+
+runtime::Variable runtime::VirtualMachine::objectGet(Variable first, Variable second) {
+  if (first.type() != VariableType::Object || second.type() != VariableType::String) {
+    return Variable::MakeUndefined();
+  }
+
+  Object* obj = first.objectValue();
+  String* key = second.stringValue();
+  InlineCache& cache = this->inlineCache();
+  std::size_t index = 0;
+
+  if (elementIndex(key, index) && index < obj->elements.size()) {
+    return obj->elements[index];
+  }
+
+  if (obj->shape != nullptr) {
+    for (std::size_t i = 0; i < cache.count; i++) {
+      const InlineCacheEntry& entry = cache.entries[i];
+
+      if (entry.shape == obj->shape && stringEquals(entry.key, key)) {
+        return obj->slots[entry.slot];
+      }
+    }
+
+    auto find = obj->shape->slots.find(key);
+
+    if (find == obj->shape->slots.end()) {
+      return Variable::MakeUndefined();
+    }
+
+    if (cache.count < inlineCacheSize) {
+      cache.entries[cache.count++] = InlineCacheEntry{obj->shape, obj->shape, find->second, find->first};
+    }
+    return obj->slots[find->second];
+  }
+
+  const Variable* value = this->findProperty(obj, key);
+
+  if (value == nullptr) {
+    return Variable::MakeUndefined();
+  }
+
+  return *value;
+}
+
+void runtime::VirtualMachine::ObjectSet() {
+  Variable third = this->popOpStack();
+  Variable second = this->popOpStack();
+  Variable first = this->popOpStack();
+
+  if (first.type() != VariableType::Object) {
+    this->pushUndefined();
+    this->advance();
+    return;
+  }
+
+  if (second.type() != VariableType::String) {
+    this->pushUndefined();
     this->advance();
     return;
   }
 
-  if (first.type == VariableType::Integer) {
-    this->pushBoolean(first.integerValue < second.integerValue);
+  Object* obj = first.objectValue();
+  String* key = second.stringValue();
+  InlineCache& cache = this->inlineCache();
+  Shape* shape = obj->shape;
+  std::size_t index = 0;
 
-  } else if (first.type == VariableType::Float) {
-    this->pushBoolean(first.doubleValue < second.doubleValue);
+  this->heap.WriteBarrier(obj, third);
 
-  } else {
+  if (elementIndex(key, index)) {
+    if (index < obj->elements.size()) {
+      obj->elements[index] = third;
+      this->pushUndefined();
+      this->advance();
+      return;
+    }
+
+    if (index == obj->elements.size() && (!obj->hasSparseElements || this->findProperty(obj, key) == nullptr)) {
+      obj->elements.push_back(third);
+      this->pushUndefined();
+      this->advance();
+      return;
+    }
+
+    obj->hasSparseElements = true;
+  }
+
+  if (shape != nullptr) {
+    for (std::size_t i = 0; i < cache.count; i++) {
+      const InlineCacheEntry& entry = cache.entries[i];
+
+      if (entry.shape != shape || !stringEquals(entry.key, key)) {
+        continue;
+      }
+
+      if (entry.next == shape) {
+        obj->slots[entry.slot] = third;
+      } else {
+        obj->shape = entry.next;
+        obj->slots.push_back(third);
+      }
+
+      this->pushUndefined();
+      this->advance();
+      return;
+    }
+  }
+
+  this->setProperty(obj, key, third);
+
+  if (shape != nullptr && obj->shape != nullptr && cache.count < inlineCacheSize) {
+    auto find = obj->shape->slots.find(key);
+    cache.entries[cache.count++] = InlineCacheEntry{shape, obj->shape, find->second, find->first};
+  }
+
+  this->pushUndefined();
+  this->advance();
+}
+
+void runtime::VirtualMachine::IndexGet() {
+  Variable second = this->popOpStack();
+  Variable first = this->popOpStack();
+
+  if (first.type() != VariableType::Array || second.type() != VariableType::Integer) {
+    this->pushUndefined();
+    this->advance();
+    return;
+  }
+
+  Array* arr = first.arrayValue();
+  std::int64_t index = second.integerValue();
+
+  if (index < 0 || static_cast<std::uint64_t>(index) >= arr->elements.size()) {
     this->pushUndefined();
+  } else {
+    this->pushOpStack(arr->elements[static_cast<std::size_t>(index)]);
   }
+
   this->advance();
 }
 
-void runtime::VirtualMachine::LessOrEqual() {
+void runtime::VirtualMachine::IndexSet() {
+  Variable third = this->popOpStack();
   Variable second = this->popOpStack();
   Variable first = this->popOpStack();
 
-  if (!this->protectDifferentTypes(first, second)) {
+  if (first.type() != VariableType::Array || second.type() != VariableType::Integer) {
     this->advance();
     return;
   }
 
-  if (first.type == VariableType::Integer) {
-    this->pushBoolean(first.integerValue <= second.integerValue);
+  Array* arr = first.arrayValue();
+  std::int64_t index = second.integerValue();
+
+  // writing one past the end appends, anything further out is dropped
+  if (index < 0 || static_cast<std::uint64_t>(index) > arr->elements.size()) {
+    this->advance();
+    return;
+  }
 
-  } else if (first.type == VariableType::Float) {
-    this->pushBoolean(first.doubleValue <= second.doubleValue);
+  this->heap.WriteBarrier(arr, third);
 
+  if (static_cast<std::size_t>(index) == arr->elements.size()) {
+    arr->elements.push_back(third);
   } else {
-    this->pushUndefined();
+    arr->elements[static_cast<std::size_t>(index)] = third;
   }
+
   this->advance();
 }
 
-void runtime::VirtualMachine::Greater() {
+void runtime::VirtualMachine::ArrayPush() {
   Variable second = this->popOpStack();
   Variable first = this->popOpStack();
 
-  if (!this->protectDifferentTypes(first, second)) {
+  if (first.type() != VariableType::Array) {
+    this->pushUndefined();
     this->advance();
     return;
   }
 
-  if (first.type == VariableType::Integer) {
-    this->pushBoolean(first.integerValue > second.integerValue);
+  Array* arr = first.arrayValue();
+
+  this->heap.WriteBarrier(arr, second);
+  arr->elements.push_back(second);
+
+  this->pushInteger(static_cast<std::int64_t>(arr->elements.size()));
+  this->advance();
+}
 
-  } else if (first.type == VariableType::Float) {
-    this->pushBoolean(first.doubleValue > second.doubleValue);
+void runtime::VirtualMachine::AddIntegerToLocal() {
+  auto operands = bytecode::FusedOperands::Unpack(this->getByteCodeParameter());
+  Variable& local = this->stackFrame->locals[operands.first];
 
+  // same as Add, which gives undefined for anything but two integers here
+  if (local.type() == VariableType::Integer) {
+    local = this->makeInteger(local.integerValue() + this->file->intConstants[operands.second]);
   } else {
-    this->pushUndefined();
+    local = Variable::MakeUndefined();
   }
+
   this->advance();
 }
 
-void runtime::VirtualMachine::GreaterOrEqual() {
-  Variable second = this->popOpStack();
-  Variable first = this->popOpStack();
+void runtime::VirtualMachine::JumpUnlessLocalLessInteger() {
+  auto operands = bytecode::FusedOperands::Unpack(this->getByteCodeParameter());
+  Variable local = this->stackFrame->locals[operands.first];
 
-  if (!this->protectDifferentTypes(first, second)) {
+  // Less gives undefined for anything but an integer here, which is falsy
+  bool less = local.type() == VariableType::Integer
+    && local.integerValue() < this->file->intConstants[operands.second];
+
+  if (!less) {
+    this->jumpTo(operands.third);
+  } else {
     this->advance();
-    return;
   }
+}
 
-  if (first.type == VariableType::Integer) {
-    this->pushBoolean(first.integerValue >= second.integerValue);
+void runtime::VirtualMachine::LoadLocalProperty() {
+  auto operands = bytecode::FusedOperands::Unpack(this->getByteCodeParameter());
+  Variable obj = this->stackFrame->locals[operands.first];
+  Variable key = Variable::MakeString(this->stringConstants[operands.second]);
 
-  } else if (first.type == VariableType::Float) {
-    this->pushBoolean(first.doubleValue >= second.doubleValue);
+  this->pushOpStack(this->objectGet(obj, key));
+  this->advance();
+}
 
-  } else {
-    this->pushUndefined();
+void runtime::VirtualMachine::quicken(
+  Variable first,
+  Variable second,
+  bytecode::ByteCodeInstruction integer,
+  bytecode::ByteCodeInstruction floating
+) {
+  Prototype* prototype = this->stackFrame->function->prototype;
+  std::size_t programCounter = this->stackFrame->programCounter;
+
+  // sites which failed a guard before stay generic
+  if (prototype->isPolymorphic[programCounter]) {
+    return;
+  }
+
+  if (first.type() == VariableType::Integer && second.type() == VariableType::Integer) {
+    prototype->byteCode[programCounter].instruction = integer;
+
+  } else if (first.type() == VariableType::Float && second.type() == VariableType::Float) {
+    prototype->byteCode[programCounter].instruction = floating;
   }
-  this->advance();
 }
 
-void runtime::VirtualMachine::Not() {
-  Variable top = this->popOpStack();
-  this->pushBoolean(!this->booleanValueOfVariable(top));
-  this->advance();
+void runtime::VirtualMachine::despecialize(Variable first, Variable second, bytecode::ByteCodeInstruction generic) {
+  Prototype* prototype = this->stackFrame->function->prototype;
+  std::size_t programCounter = this->stackFrame->programCounter;
+
+  prototype->byteCode[programCounter].instruction = generic;
+  prototype->isPolymorphic[programCounter] = true;
+
+  // the generic handler pops the operands again
+  this->pushOpStack(first);
+  this->pushOpStack(second);
 }
 
-void runtime::VirtualMachine::Equal() {
+void runtime::VirtualMachine::AddInt() {
   Variable second = this->popOpStack();
   Variable first = this->popOpStack();
 
-  this->pushBoolean(this->variableEquals(first, second));
+  if (first.type() != VariableType::Integer || second.type() != VariableType::Integer) {
+    this->despecialize(first, second, bytecode::ByteCodeInstruction::Add);
+    this->Add();
+    return;
+  }
+
+  this->pushInteger(first.integerValue() + second.integerValue());
   this->advance();
 }
 
-void runtime::VirtualMachine::NotEqual() {
+void runtime::VirtualMachine::AddFloat() {
   Variable second = this->popOpStack();
   Variable first = this->popOpStack();
 
-  this->pushBoolean(!this->variableEquals(first, second));
+  if (first.type() != VariableType::Float || second.type() != VariableType::Float) {
+    this->despecialize(first, second, bytecode::ByteCodeInstruction::Add);
+    this->Add();
+    return;
+  }
+
+  this->pushFloat(first.doubleValue() + second.doubleValue());
   this->advance();
 }
 
-void runtime::VirtualMachine::And() {
+void runtime::VirtualMachine::SubtractInt() {
   Variable second = this->popOpStack();
   Variable first = this->popOpStack();
 
-  this->pushBoolean(
-    this->booleanValueOfVariable(first)
-    &&
-    this->booleanValueOfVariable(second)
-  );
+  if (first.type() != VariableType::Integer || second.type() != VariableType::Integer) {
+    this->despecialize(first, second, bytecode::ByteCodeInstruction::Subtract);
+    this->Subtract();
+    return;
+  }
+
+  this->pushInteger(first.integerValue() - second.integerValue());
   this->advance();
 }
 
-void runtime::VirtualMachine::Or() {
- Variable second = this->popOpStack();
+void runtime::VirtualMachine::SubtractFloat() {
+  Variable second = this->popOpStack();
   Variable first = this->popOpStack();
 
-  this->pushBoolean(
-    this->booleanValueOfVariable(first)
-    ||
-    this->booleanValueOfVariable(second)
-  );
+  if (first.type() != VariableType::Float || second.type() != VariableType::Float) {
+    this->despecialize(first, second, bytecode::ByteCodeInstruction::Subtract);
+    this->Subtract();
+    return;
+  }
+
+  this->pushFloat(first.doubleValue() - second.doubleValue());
   this->advance();
 }
 
-void runtime::VirtualMachine::GetType() {
-  Variable top = this->popOpStack();
-
-  auto str = this->heap.NewString();
+void runtime::VirtualMachine::MultiplyInt() {
+  Variable second = this->popOpStack();
+  Variable first = this->popOpStack();
 
-  switch (top.type) {
-    case VariableType::Integer: {
-      str->assign("integer");
-      break;
-    }
-    case VariableType::Float: {
-      str->assign("float");
-      break;
-    }
-    case VariableType::Function: {
-      str->assign("function");
-      break;
-    }
-    case VariableType::Object: {
-      str->assign("object");
-      break;
-    }
-    case VariableType::String: {
-      str->assign("string");
-      break;
-    }
-    case VariableType::Undefined: {
-      str->assign("undefined");
-      break;
-    }
-    case VariableType::Boolean: {
-      str->assign("boolean");
-      break;
-    }
-    default: {
-      this->panic("Unknown varible type at variableEquals");
-    }
+  if (first.type() != VariableType::Integer || second.type() != VariableType::Integer) {
+    this->despecialize(first, second, bytecode::ByteCodeInstruction::Multiply);
+    this->Multiply();
+    return;
   }
 
-  this->pushString(str);
+  this->pushInteger(first.integerValue() * second.integerValue());
   this->advance();
 }
 
-void runtime::VirtualMachine::CastToInt() {
-  Variable top = this->popOpStack();
-
-  switch (top.type) {
-    case VariableType::Integer: {
-      this->pushInteger(top.integerValue);
-      break;
-    }
-    case VariableType::Float: {
-      this->pushInteger(static_cast<std::int64_t>(top.doubleValue));
-      break;
-    }
-    case VariableType::Function: {
-      this->pushUndefined();
-      break;
-    }
-    case VariableType::Object: {
-      this->pushUndefined();
-      break;
-    }
-    case VariableType::String: {
-      try {
-        std::int64_t val = std::stoll(*top.stringValue);
-        this->pushInteger(val);
+void runtime::VirtualMachine::MultiplyFloat() {
+  Variable second = this->popOpStack();
+  Variable first = this->popOpStack();
 
-      } catch (...) {
-        this->pushUndefined();
-      }
-      break;
-    }
-    case VariableType::Undefined: {
-      this->pushUndefined();
-      break;
-    }
-    case VariableType::Boolean: {
-      this->pushUndefined();
-      break;
-    }
-    default: {
-      this->panic("Unknown varible type at variableEquals");
-    }
+  if (first.type() != VariableType::Float || second.type() != VariableType::Float) {
+    this->despecialize(first, second, bytecode::ByteCodeInstruction::Multiply);
+    this->Multiply();
+    return;
   }
 
+  this->pushFloat(first.doubleValue() * second.doubleValue());
   this->advance();
 }
 
-void runtime::VirtualMachine::CastToFloat() {
-  Variable top = this->popOpStack();
-
-  switch (top.type) {
-    case VariableType::Integer: {
-      this->pushFloat(static_cast<double>(top.integerValue));
-      break;
-    }
-    case VariableType::Float: {
-      this->pushFloat(top.doubleValue);
-      break;
-    }
-    case VariableType::Function: {
-      this->pushUndefined();
-      break;
-    }
-    case VariableType::Object: {
-      this->pushUndefined();
-      break;
-    }
-    case VariableType::String: {
-      try {
-        double val = std::stod(*top.stringValue);
-        this->pushFloat(val);
+void runtime::VirtualMachine::DivideInt() {
+  Variable second = this->popOpStack();
+  Variable first = this->popOpStack();
 
-      } catch (...) {
-        this->pushUndefined();
-      }
-      break;
-    }
-    case VariableType::Undefined: {
-      this->pushUndefined();
-      break;
-    }
-    case VariableType::Boolean: {
-      this->pushUndefined();
-      break;
-    }
-    default: {
-      this->panic("Unknown varible type at variableEquals");
-    }
+  if (first.type() != VariableType::Integer || second.type() != VariableType::Integer) {
+    this->despecialize(first, second, bytecode::ByteCodeInstruction::Divide);
+    this->Divide();
+    return;
   }
 
+  if (second.integerValue() == 0) {
+    this->pushUndefined();
+  } else {
+    this->pushInteger(first.integerValue() / second.integerValue());
+  }
   this->advance();
 }
 
-void runtime::VirtualMachine::Length() {
-  Variable top = this->popOpStack();
+void runtime::VirtualMachine::DivideFloat() {
+  Variable second = this->popOpStack();
+  Variable first = this->popOpStack();
 
-  switch (top.type) {
-    case VariableType::Integer: {
-      this->pushUndefined();
-      break;
-    }
-    case VariableType::Float: {
-      this->pushUndefined();
-      break;
-    }
-    case VariableType::Function: {
-      this->pushUndefined();
-      break;
-    }
-    case VariableType::Object: {
-      this->pushInteger(top.objectValue->properties.size());
-      break;
-    }
-    case VariableType::String: {
-      this->pushInteger(top.stringValue->size());
-      break;
-    }
-    case VariableType::Undefined: {
-      this->pushUndefined();
-      break;
-    }
-    case VariableType::Boolean: {
-      this->pushUndefined();
-      break;
-    }
-    default: {
-      this->panic("Unknown varible type at variableEquals");
-    }
+  if (first.type() != VariableType::Float || second.type() != VariableType::Float) {
+    this->despecialize(first, second, bytecode::ByteCodeInstruction::Divide);
+    this->Divide();
+    return;
   }
 
+  this->pushFloat(first.doubleValue() / second.doubleValue());
   this->advance();
 }
 
-void runtime::VirtualMachine::ChatAt() {
+void runtime::VirtualMachine::LessInt() {
   Variable second = this->popOpStack();
   Variable first = this->popOpStack();
 
-  if (first.type != VariableType::String) {
-    this->pushUndefined();
-    this->advance();
+  if (first.type() != VariableType::Integer || second.type() != VariableType::Integer) {
+    this->despecialize(first, second, bytecode::ByteCodeInstruction::Less);
+    this->Less();
     return;
   }
 
-  if (second.type != VariableType::Integer) {
-    this->pushUndefined();
-    this->advance();
-    return;
-  }
+  this->pushBoolean(first.integerValue() < second.integerValue());
+  this->advance();
+}
 
-  std::size_t index = static_cast<std::size_t>(second.integerValue);
+void runtime::VirtualMachine::LessFloat() {
+  Variable second = this->popOpStack();
+  Variable first = this->popOpStack();
 
-  if (index >= first.stringValue->size()) {
-    this->pushUndefined();
-    this->advance();
+  if (first.type() != VariableType::Float || second.type() != VariableType::Float) {
+    this->despecialize(first, second, bytecode::ByteCodeInstruction::Less);
+    this->Less();
     return;
   }
 
-  char c = first.stringValue->at(index);
+  this->pushBoolean(first.doubleValue() < second.doubleValue());
+  this->advance();
+}
 
-  auto str = this->heap.NewString();
+void runtime::VirtualMachine::LessOrEqualInt() {
+  Variable second = this->popOpStack();
+  Variable first = this->popOpStack();
 
-  str->clear();
-  *str += c;
+  if (first.type() != VariableType::Integer || second.type() != VariableType::Integer) {
+    this->despecialize(first, second, bytecode::ByteCodeInstruction::LessOrEqual);
+    this->LessOrEqual();
+    return;
+  }
 
-  this->pushString(str);
+  this->pushBoolean(first.integerValue() <= second.integerValue());
   this->advance();
 }
 
-void runtime::VirtualMachine::StringAppend() {
+void runtime::VirtualMachine::LessOrEqualFloat() {
   Variable second = this->popOpStack();
   Variable first = this->popOpStack();
 
-  auto str = this->heap.NewString();
-
-  str->clear();
-
-  str->append(this->variableToString(first, true));
-  str->append(this->variableToString(second, true));
+  if (first.type() != VariableType::Float || second.type() != VariableType::Float) {
+    this->despecialize(first, second, bytecode::ByteCodeInstruction::LessOrEqual);
+    this->LessOrEqual();
+    return;
+  }
 
-  this->pushString(str);
+  this->pushBoolean(first.doubleValue() <= second.doubleValue());
   this->advance();
 }
 
-void runtime::VirtualMachine::ObjectGet() {
-
+void runtime::VirtualMachine::GreaterInt() {
   Variable second = this->popOpStack();
   Variable first = this->popOpStack();
 
-  if (first.type != VariableType::Object) {
-    this->pushUndefined();
-    this->advance();
+  if (first.type() != VariableType::Integer || second.type() != VariableType::Integer) {
+    this->despecialize(first, second, bytecode::ByteCodeInstruction::Greater);
+    this->Greater();
     return;
   }
 
-  if (second.type != VariableType::String) {
-    this->pushUndefined();
-    this->advance();
-    return;
-  }
+  this->pushBoolean(first.integerValue() > second.integerValue());
+  this->advance();
+}
 
-  auto find = first.objectValue->properties.find(*second.stringValue);
+void runtime::VirtualMachine::GreaterFloat() {
+  Variable second = this->popOpStack();
+  Variable first = this->popOpStack();
 
-  if (find == first.objectValue->properties.end()) {
-    this->pushUndefined();
-  } else {
-    this->pushOpStack(find->second);
+  if (first.type() != VariableType::Float || second.type() != VariableType::Float) {
+    this->despecialize(first, second, bytecode::ByteCodeInstruction::Greater);
+    this->Greater();
+    return;
   }
 
+  this->pushBoolean(first.doubleValue() > second.doubleValue());
   this->advance();
 }
 
-void runtime::VirtualMachine::ObjectSet() {
-  Variable third = this->popOpStack();
+void runtime::VirtualMachine::GreaterOrEqualInt() {
   Variable second = this->popOpStack();
   Variable first = this->popOpStack();
 
-  if (first.type != VariableType::Object) {
-    this->pushUndefined();
-    this->advance();
+  if (first.type() != VariableType::Integer || second.type() != VariableType::Integer) {
+    this->despecialize(first, second, bytecode::ByteCodeInstruction::GreaterOrEqual);
+    this->GreaterOrEqual();
     return;
   }
 
-  if (second.type != VariableType::String) {
-    this->pushUndefined();
-    this->advance();
+  this->pushBoolean(first.integerValue() >= second.integerValue());
+  this->advance();
+}
+
+void runtime::VirtualMachine::GreaterOrEqualFloat() {
+  Variable second = this->popOpStack();
+  Variable first = this->popOpStack();
+
+  if (first.type() != VariableType::Float || second.type() != VariableType::Float) {
+    this->despecialize(first, second, bytecode::ByteCodeInstruction::GreaterOrEqual);
+    this->GreaterOrEqual();
     return;
   }
 
-  first.objectValue->properties[*second.stringValue] = third;
-  this->pushUndefined();
+  this->pushBoolean(first.doubleValue() >= second.doubleValue());
   this->advance();
 }
 
 void runtime::VirtualMachine::GetEnv() {
   Variable first = this->popOpStack();
 
-  if (first.type != VariableType::String) {
+  if (first.type() != VariableType::String) {
     this->pushUndefined();
     this->advance();
     return;
   }
 
-  auto getEnvVal = std::getenv(first.stringValue->c_str());
+  auto getEnvVal = std::getenv(flattenString(first.stringValue()).c_str());
 
   if (getEnvVal == nullptr) {
     this->pushUndefined();
 
   } else {
-    std::string* newString = this->heap.NewString();
-    newString->clear();
-    newString->assign(getEnvVal);
+    String* newString = this->heap.NewString();
+    newString->value.clear();
+    newString->value.assign(getEnvVal);
     this->pushString(newString);
   }
 
@@ -998,31 +3563,34 @@ void runtime::VirtualMachine::Pop() {
 }
 
 bool VirtualMachine::variableEquals(Variable var1, Variable var2) {
-  if (var1.type != var2.type) {
+  if (!Variable::HaveSameType(var1, var2)) {
     return false;
   }
 
-  switch (var1.type) {
+  switch (var1.type()) {
     case VariableType::Integer: {
-      return var1.integerValue == var2.integerValue;
+      return var1.integerValue() == var2.integerValue();
     }
     case VariableType::Float: {
-      return var1.doubleValue == var2.doubleValue;
+      return var1.doubleValue() == var2.doubleValue();
     }
     case VariableType::Function: {
-      return var1.functionValue == var2.functionValue;
+      return var1.functionValue() == var2.functionValue();
     }
     case VariableType::Object: {
-      return var1.objectValue == var2.objectValue;
+      return var1.objectValue() == var2.objectValue();
+    }
+    case VariableType::Array: {
+      return var1.arrayValue() == var2.arrayValue();
     }
     case VariableType::String: {
-      return *var1.stringValue == *var2.stringValue;
+      return stringEquals(var1.stringValue(), var2.stringValue());
     }
     case VariableType::Undefined: {
       return true;
     }
     case VariableType::Boolean: {
-      return var1.boolValue == var2.boolValue;
+      return var1.boolValue() == var2.boolValue();
     }
     default: {
       this->panic("Unknown varible type at variableEquals");
@@ -1030,13 +3598,23 @@ bool VirtualMachine::variableEquals(Variable var1, Variable var2) {
   }
 }
 
+runtime::String* VirtualMachine::appendOperand(Variable var) {
+  if (var.type() == VariableType::String) {
+    return var.stringValue();
+  }
+
+  auto str = this->heap.NewString();
+  str->value.assign(this->variableToString(var, true));
+  return str;
+}
+
 std::string VirtualMachine::variableToString(Variable var, bool panic) {
-  switch (var.type) {
+  switch (var.type()) {
     case VariableType::Integer: {
-      return std::to_string(var.integerValue);
+      return std::to_string(var.integerValue());
     }
     case VariableType::Float: {
-      return std::to_string(var.doubleValue);
+      return std::to_string(var.doubleValue());
     }
     case VariableType::Function: {
       return "<function>";
@@ -1044,14 +3622,17 @@ std::string VirtualMachine::variableToString(Variable var, bool panic) {
     case VariableType::Object: {
       return "<object>";
     }
+    case VariableType::Array: {
+      return "<array>";
+    }
     case VariableType::String: {
-      return *var.stringValue;
+      return std::string{flattenString(var.stringValue())};
     }
     case VariableType::Undefined: {
       return "undefined";
     }
     case VariableType::Boolean: {
-      return var.boolValue ? "true" : "false";
+      return var.boolValue() ? "true" : "false";
     }
     default: {
       if (panic) {
@@ -1064,11 +3645,12 @@ std::string VirtualMachine::variableToString(Variable var, bool panic) {
 }
 
 bool runtime::VirtualMachine::booleanValueOfVariable(Variable var) {
-  switch (var.type) {
+  switch (var.type()) {
     case VariableType::Integer:
     case VariableType::Float:
     case VariableType::Function:
     case VariableType::Object:
+    case VariableType::Array:
     case VariableType::String: {
       return true;
     }
@@ -1076,7 +3658,7 @@ bool runtime::VirtualMachine::booleanValueOfVariable(Variable var) {
       return false;
     }
     case VariableType::Boolean: {
-      return var.boolValue;
+      return var.boolValue();
     }
     default: {
       this->panic("Unknown varible type at booleanValueOfVariable");
@@ -1085,59 +3667,57 @@ bool runtime::VirtualMachine::booleanValueOfVariable(Variable var) {
 }
 
 void runtime::VirtualMachine::pushUndefined() {
-  Variable undefined{};
-  undefined.type = VariableType::Undefined;
-  this->pushOpStack(undefined);
+  this->pushOpStack(Variable::MakeUndefined());
 }
 
 void runtime::VirtualMachine::pushInteger(std::int64_t val) {
-  Variable variable{};
-  variable.type = VariableType::Integer;
-  variable.integerValue = val;
-  this->pushOpStack(variable);
+  this->pushOpStack(this->makeInteger(val));
+}
+
+runtime::Variable runtime::VirtualMachine::makeInteger(std::int64_t val) {
+  if (Variable::FitsInline(val)) {
+    return Variable::MakeInteger(val);
+  }
+
+#if FLANG_NAN_BOXING
+  runtime::BoxedInteger* box = this->heap.NewBoxedInteger();
+  box->value = val;
+  return Variable::MakeBoxedInteger(box);
+#else
+  return Variable::MakeInteger(val);
+#endif
 }
 
 void runtime::VirtualMachine::pushFloat(double val) {
-  Variable variable{};
-  variable.type = VariableType::Float;
-  variable.doubleValue = val;
-  this->pushOpStack(variable);
+  this->pushOpStack(Variable::MakeFloat(val));
 }
 
 void runtime::VirtualMachine::pushBoolean(bool val) {
-  Variable variable{};
-  variable.type = VariableType::Boolean;
-  variable.boolValue = val;
-  this->pushOpStack(variable);
+  this->pushOpStack(Variable::MakeBoolean(val));
 }
 
-void runtime::VirtualMachine::pushString(const std::string* val) {
-  Variable variable{};
-  variable.type = VariableType::String;
-  variable.stringValue = val;
-  this->pushOpStack(variable);
+void runtime::VirtualMachine::pushString(runtime::String* val) {
+  this->pushOpStack(Variable::MakeString(val));
 }
 
 void runtime::VirtualMachine::pushFunction(runtime::Function* fn) {
-  Variable variable{};
-  variable.type = VariableType::Function;
-  variable.functionValue = fn;
-  this->pushOpStack(variable);
+  this->pushOpStack(Variable::MakeFunction(fn));
 }
 
 void runtime::VirtualMachine::pushObject(runtime::Object* obj) {
-  Variable variable{};
-  variable.type = VariableType::Object;
-  variable.objectValue = obj;
-  this->pushOpStack(variable);
+  this->pushOpStack(Variable::MakeObject(obj));
+}
+
+void runtime::VirtualMachine::pushArray(runtime::Array* arr) {
+  this->pushOpStack(Variable::MakeArray(arr));
 }
 
 std::size_t runtime::VirtualMachine::getByteCodeParameter() {
-  return this->stackFrame->function->fn->byteCode.at(this->stackFrame->programCounter).parameter;
+  return this->stackFrame->function->prototype->byteCode[this->stackFrame->programCounter].parameter;
 }
 
 bool runtime::VirtualMachine::protectDifferentTypes(Variable v1, Variable v2) {
-  if (v1.type != v2.type) {
+  if (!Variable::HaveSameType(v1, v2)) {
     this->pushUndefined();
     return false;
   }
@@ -1145,9 +3725,15 @@ bool runtime::VirtualMachine::protectDifferentTypes(Variable v1, Variable v2) {
   return true;
 }
 
+static std::string fusedOperandsToString(std::size_t parameter) {
+  auto operands = bytecode::FusedOperands::Unpack(parameter);
+  return std::to_string(operands.first) + ", " + std::to_string(operands.second) + ", " + std::to_string(operands.third);
+}
+
 std::string runtime::VirtualMachine::byteCodeToString(bytecode::ByteCode bc, bool panic) {
 
   #define PARAM "(" + std::to_string(bc.parameter) + ")"
+  #define FUSED "(" + fusedOperandsToString(bc.parameter) + ")"
 
   switch (bc.instruction) {
     case bytecode::ByteCodeInstruction::Halt: return "Halt";
@@ -1192,6 +3778,30 @@ std::string runtime::VirtualMachine::byteCodeToString(bytecode::ByteCode bc, boo
     case bytecode::ByteCodeInstruction::GetEnv: return "GetEnv";
     case bytecode::ByteCodeInstruction::LoadClosure: return "LoadClosure" PARAM;
     case bytecode::ByteCodeInstruction::Pop: return "Pop";
+    case bytecode::ByteCodeInstruction::TailCall: return "TailCall" PARAM;
+    case bytecode::ByteCodeInstruction::MakeArray: return "MakeArray" PARAM;
+    case bytecode::ByteCodeInstruction::IndexGet: return "IndexGet";
+    case bytecode::ByteCodeInstruction::IndexSet: return "IndexSet";
+    case bytecode::ByteCodeInstruction::ArrayPush: return "ArrayPush";
+    case bytecode::ByteCodeInstruction::AddIntegerToLocal: return "AddIntegerToLocal" FUSED;
+    case bytecode::ByteCodeInstruction::JumpUnlessLocalLessInteger: return "JumpUnlessLocalLessInteger" FUSED;
+    case bytecode::ByteCodeInstruction::LoadLocalProperty: return "LoadLocalProperty" FUSED;
+    case bytecode::ByteCodeInstruction::AddInt: return "AddInt";
+    case bytecode::ByteCodeInstruction::AddFloat: return "AddFloat";
+    case bytecode::ByteCodeInstruction::SubtractInt: return "SubtractInt";
+    case bytecode::ByteCodeInstruction::SubtractFloat: return "SubtractFloat";
+    case bytecode::ByteCodeInstruction::MultiplyInt: return "MultiplyInt";
+    case bytecode::ByteCodeInstruction::MultiplyFloat: return "MultiplyFloat";
+    case bytecode::ByteCodeInstruction::DivideInt: return "DivideInt";
+    case bytecode::ByteCodeInstruction::DivideFloat: return "DivideFloat";
+    case bytecode::ByteCodeInstruction::LessInt: return "LessInt";
+    case bytecode::ByteCodeInstruction::LessFloat: return "LessFloat";
+    case bytecode::ByteCodeInstruction::LessOrEqualInt: return "LessOrEqualInt";
+    case bytecode::ByteCodeInstruction::LessOrEqualFloat: return "LessOrEqualFloat";
+    case bytecode::ByteCodeInstruction::GreaterInt: return "GreaterInt";
+    case bytecode::ByteCodeInstruction::GreaterFloat: return "GreaterFloat";
+    case bytecode::ByteCodeInstruction::GreaterOrEqualInt: return "GreaterOrEqualInt";
+    case bytecode::ByteCodeInstruction::GreaterOrEqualFloat: return "GreaterOrEqualFloat";
     default: {
       if (panic) {
         this->panic("Unkown bytecode instruction encountered");
@@ -1203,6 +3813,7 @@ std::string runtime::VirtualMachine::byteCodeToString(bytecode::ByteCode bc, boo
   }
 
   #undef PARAM
+  #undef FUSED
 }
 
 template<typename T>
@@ -1217,9 +3828,10 @@ void printConstantArray(std::ostream & out, const std::vector<T> & vec) {
 void runtime::VirtualMachine::printFunction(const bytecode::Function* fn) {
   this->out << "| | Argument Count: " << fn->argumentCount << '\n';
   this->out << "| | Local Count: " << fn->localsCount << '\n';
+  this->out << "| | Max Stack: " << fn->maxStack << '\n';
   this->out << "| | Capture Contexts:\n";
   for (std::size_t i = 0; i < fn->closures.size(); i++) {
-    this->out << "| |   |" << i << "| ClosureContext(scopeOffsets:" << fn->closures.at(i).scopeOffsets << ", LocalIndex: " << fn->closures.at(i).localIndex << ")" << '\n';
+    this->out << "| |   |" << i << "| ClosureContext(isLocal: " << fn->closures.at(i).isLocal << ", Index: " << fn->closures.at(i).index << ")" << '\n';
   }
   this->out << "| | Byte Code:\n";
   for (std::size_t i = 0; i < fn->byteCode.size(); i++) {
@@ -1231,32 +3843,38 @@ void runtime::VirtualMachine::printFunction(const bytecode::Function* fn) {
 void runtime::VirtualMachine::print() {
   this->out << "Stack Frames:\n";
 
-  StackFrame* stackFrame = this->stackFrame.get();
-
   int frameDepth = 0;
 
-  while (stackFrame != nullptr) {
+  for (StackFrame* stackFrame = this->stackFrame; stackFrame != nullptr; frameDepth++) {
+    // deep recursion would bury the rest of the dump
+    if (frameDepth == maxPrintedFrames) {
+      this->out << "| ... " << (stackFrame - this->frames.get() + 1) << " more stack frames\n";
+      break;
+    }
+
+    Variable* opStackEnd = stackFrame == this->stackFrame ? this->stackTop : (stackFrame + 1)->locals;
+
     this->out << "| Stack Frame: " << frameDepth << '\n';
     this->out << "| | Program Counter: " << stackFrame->programCounter << '\n';
     this->out << "| | Locals:\n";
-    for (std::size_t i = 0; i < stackFrame->locals.size(); i++) {
-      this->out << "| |   |" << i << "| " << this->variableToString(stackFrame->locals.at(i), false) << '\n';
+    for (std::size_t i = 0; i < stackFrame->function->fn->localsCount; i++) {
+      this->out << "| |   |" << i << "| " << this->variableToString(stackFrame->locals[i], false) << '\n';
     }
     this->out << "| | Captures:\n";
     for (std::size_t i = 0; i < stackFrame->function->captures.size(); i++) {
       this->out << "| |   |" << i << "| " << this->variableToString(this->loadClosureValue(stackFrame->function, i), false) << '\n';
     }
     this->out << "| | Op Stack:\n";
-    for (std::size_t i = 0; i < stackFrame->opStack.size(); i++) {
-      this->out << "| |   |" << i << "| " << this->variableToString(stackFrame->opStack.at(i), false) << '\n';
+    for (Variable* v = stackFrame->opStackBase; v < opStackEnd; v++) {
+      this->out << "| |   |" << (v - stackFrame->opStackBase) << "| " << this->variableToString(*v, false) << '\n';
     }
     this->out << "| | Byte Code:\n";
-    for (std::size_t i = 0; i < stackFrame->function->fn->byteCode.size(); i++) {
-      this->out << "| |   |" << i << "| " << this->byteCodeToString(stackFrame->function->fn->byteCode.at(i), false) << '\n';
+    for (std::size_t i = 0; i < stackFrame->function->prototype->byteCode.size(); i++) {
+      this->out << "| |   |" << i << "| " << this->byteCodeToString(stackFrame->function->prototype->byteCode.at(i), false) << '\n';
     }
     this->out << "| \\------------------\n";
 
-    stackFrame = stackFrame->outer.get();
+    stackFrame = stackFrame == this->frames.get() ? nullptr : stackFrame - 1;
   }
   this->out << "\\------------------\n";
 
@@ -1306,10 +3924,15 @@ void runtime::VirtualMachine::panic(const std::string & message) {
 
   this->isPanicing = true;
 
+  this->flushOutput();
   this->out << "PANIC!: " << message << "\n";
 
   this->print();
 
+  // what ran up to the panic is often what the profile is wanted for, the
+  // guard above keeps a panic while writing it from coming back here
+  this->writeProfile();
+
   exit(1);
 }
 
@@ -1317,49 +3940,602 @@ void runtime::VirtualMachine::advance() {
   this->stackFrame->programCounter++;
 }
 
-runtime::Heap::Heap(runtime::VirtualMachine* /*vm*/) noexcept {
+void runtime::VirtualMachine::collectGarbageIfNeeded() {
+  // Collections only happen at calls and loop back edges. At those points
+  // every live value is reachable from the stack, upvalues or constants,
+  // while handlers in the middle of an instruction may hold popped values
+  // the collector can not see.
+  if (this->heap.ShouldCollect()) {
+    this->heap.Collect();
+  }
+}
+
+void runtime::VirtualMachine::markRoots() {
+  for (Variable* v = this->valueStack.get(); v < this->stackTop; v++) {
+    this->heap.MarkVariable(*v);
+  }
+
+  if (this->stackFrame != nullptr) {
+    for (StackFrame* frame = this->frames.get(); frame <= this->stackFrame; frame++) {
+      this->heap.MarkObject(const_cast<runtime::Function*>(frame->function));
+    }
+  }
+
+  for (Upvalue* upvalue = this->openUpvalues; upvalue != nullptr; upvalue = upvalue->nextOpen) {
+    this->heap.MarkObject(upvalue);
+  }
+
+  for (auto str : this->stringConstants) {
+    this->heap.MarkObject(str);
+  }
+
+  for (auto str : this->characterStrings) {
+    this->heap.MarkObject(str);
+  }
+
+  for (auto str : this->typeNameStrings) {
+    this->heap.MarkObject(str);
+  }
+
+  for (const auto& shape : this->shapes) {
+    this->heap.MarkObject(shape->key);
+  }
 
+  for (const auto& constructorShape : this->constructorShapes) {
+    for (auto key : constructorShape.keys) {
+      this->heap.MarkObject(key);
+    }
+  }
 }
 
-runtime::Heap::~Heap() noexcept {
+void runtime::VirtualMachine::forwardRoots() {
+  for (Variable* v = this->valueStack.get(); v < this->stackTop; v++) {
+    this->heap.ForwardVariable(*v);
+  }
+
+  if (this->stackFrame != nullptr) {
+    for (StackFrame* frame = this->frames.get(); frame <= this->stackFrame; frame++) {
+      auto function = const_cast<runtime::Function*>(frame->function);
+      this->heap.ForwardReference(function);
+      frame->function = function;
+    }
+  }
+
+  this->heap.ForwardReference(this->openUpvalues);
+
+  for (auto& str : this->stringConstants) {
+    this->heap.ForwardReference(str);
+  }
+}
+
+runtime::NurseryResource::NurseryResource(runtime::Heap* heap) noexcept
+: heap{heap}
+{}
+
+void* runtime::NurseryResource::do_allocate(std::size_t bytes, std::size_t alignment) {
+  void* ret = this->heap->allocateYoung(bytes, alignment);
+
+  if (ret != nullptr) {
+    return ret;
+  }
+
+  // the nursery is full until the next minor collection, the overflow is
+  // released together with the nursery
+  ret = std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  this->heap->nurseryOverflow.push_back(NurseryOverflow{ret, bytes, alignment});
+  return ret;
+}
+
+void runtime::NurseryResource::do_deallocate(void* /*p*/, std::size_t /*bytes*/, std::size_t /*alignment*/) {
+  // young memory is only ever released all at once by a minor collection
+}
+
+bool runtime::NurseryResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+  return this == &other;
+}
+
+runtime::Heap::Heap(runtime::VirtualMachine* vm, runtime::GcOptions options) noexcept
+: vm{vm}
+, options{options}
+, objects{nullptr}
+, objectCount{0}
+, nextCollection{options.initialThreshold}
+, isCollecting{false}
+, nursery{new char[options.nurserySize]}
+, nurseryTop{nursery.get()}
+, nurseryEnd{nursery.get() + options.nurserySize}
+, isNurseryExhausted{false}
+, nurseryResource{this}
+{}
 
+runtime::Heap::~Heap() noexcept {
+  this->EndGc();
 }
 
 void runtime::Heap::StartGc() noexcept {
+  this->isCollecting = true;
+}
+
+void runtime::Heap::EndGc() noexcept {
+  this->isCollecting = false;
+
+  while (this->objects != nullptr) {
+    HeapObject* object = this->objects;
+    this->objects = object->nextObject;
+    this->freeObject(object);
+  }
+
+  this->objectCount = 0;
+  this->rememberedObjects.clear();
+  this->releaseNursery();
+}
+
+bool runtime::Heap::ShouldCollect() const noexcept {
+  return this->isCollecting && (this->isNurseryExhausted || this->objectCount >= this->nextCollection);
+}
+
+void runtime::Heap::Collect() noexcept {
+  // the major collector only knows about old objects, so the nursery is
+  // always emptied first
+  this->minorCollection();
+
+  if (this->objectCount >= this->nextCollection) {
+    this->majorCollection();
+
+    double next = static_cast<double>(this->objectCount) * this->options.growthFactor;
+    this->nextCollection = std::max(this->options.initialThreshold, static_cast<std::size_t>(next));
+  }
+}
+
+void runtime::Heap::WriteBarrier(runtime::HeapObject* owner, runtime::Variable value) noexcept {
+  this->WriteBarrier(owner, value.heapReference());
+}
+
+void runtime::Heap::WriteBarrier(runtime::HeapObject* owner, runtime::HeapObject* value) noexcept {
+  // old objects pointing into the nursery are extra roots for the next
+  // minor collection
+  if (owner->isYoung || owner->isRemembered || value == nullptr || !value->isYoung) {
+    return;
+  }
+
+  owner->isRemembered = true;
+  this->rememberedObjects.push_back(owner);
+}
+
+void runtime::Heap::MarkVariable(runtime::Variable var) noexcept {
+  this->MarkObject(var.heapReference());
+}
+
+void runtime::Heap::MarkObject(runtime::HeapObject* object) noexcept {
+  if (object == nullptr || object->isMarked) {
+    return;
+  }
+
+  object->isMarked = true;
+  this->grayObjects.push_back(object);
+}
+
+void runtime::Heap::ForwardVariable(runtime::Variable& var) noexcept {
+  HeapObject* reference = var.heapReference();
 
+  if (reference == nullptr || !reference->isYoung) {
+    return;
+  }
+
+  this->ForwardReference(reference);
+  var.replaceHeapReference(reference);
 }
 
 template<typename T>
-void deInitList(std::list<T*> & items) {
-  while (!items.empty()) {
-    T* first = items.front();
-    delete first;
-    items.pop_front();
+void runtime::Heap::ForwardReference(T*& reference) noexcept {
+  if (reference == nullptr || !reference->isYoung) {
+    return;
   }
+
+  if (reference->nextObject == nullptr) {
+    reference->nextObject = this->promote(reference);
+  }
+
+  reference = static_cast<T*>(reference->nextObject);
 }
 
-void runtime::Heap::EndGc() noexcept {
-  deInitList<std::string>(this->createdStrings);
-  deInitList<runtime::Function>(this->createdFunctions);
-  deInitList<runtime::Object>(this->createdObjects);
+runtime::HeapObject* runtime::Heap::promote(runtime::HeapObject* object) noexcept {
+  std::pmr::memory_resource* resource = std::pmr::new_delete_resource();
+
+  HeapObject* copy = nullptr;
+
+  switch (object->heapObjectType) {
+    case HeapObjectType::String: {
+      auto young = static_cast<runtime::String*>(object);
+      auto old = new runtime::String{resource};
+      old->value = young->value;
+      old->hash = young->hash;
+      old->hasHash = young->hasHash;
+      copy = old;
+      break;
+    }
+    case HeapObjectType::Function: {
+      auto young = static_cast<runtime::Function*>(object);
+      auto old = new runtime::Function{resource};
+      old->captures = young->captures;
+      old->fn = young->fn;
+      old->prototype = young->prototype;
+      copy = old;
+      break;
+    }
+    case HeapObjectType::Object: {
+      auto young = static_cast<runtime::Object*>(object);
+      auto old = new runtime::Object{resource};
+      old->shape = young->shape;
+      old->slots = young->slots;
+      old->properties = young->properties;
+      old->elements = young->elements;
+      old->hasSparseElements = young->hasSparseElements;
+      copy = old;
+      break;
+    }
+    case HeapObjectType::Upvalue: {
+      auto young = static_cast<runtime::Upvalue*>(object);
+      auto old = new runtime::Upvalue{resource};
+      old->closed = young->closed;
+      old->location = young->location == &young->closed ? &old->closed : young->location;
+      old->nextOpen = young->nextOpen;
+      copy = old;
+      break;
+    }
+    case HeapObjectType::Integer: {
+      auto old = new runtime::BoxedInteger{resource};
+      old->value = static_cast<runtime::BoxedInteger*>(object)->value;
+      copy = old;
+      break;
+    }
+    case HeapObjectType::Rope: {
+      auto young = static_cast<runtime::Rope*>(object);
+      auto old = new runtime::Rope{resource};
+      old->value = young->value;
+      old->hash = young->hash;
+      old->hasHash = young->hasHash;
+      old->left = young->left;
+      old->right = young->right;
+      old->length = young->length;
+      copy = old;
+      break;
+    }
+    case HeapObjectType::Array: {
+      auto old = new runtime::Array{resource};
+      old->elements = static_cast<runtime::Array*>(object)->elements;
+      copy = old;
+      break;
+    }
+  }
+
+  this->linkOldObject(copy, object->heapObjectType);
+  this->promotedObjects.push_back(copy);
+
+  return copy;
+}
+
+void runtime::Heap::forwardReferences(runtime::HeapObject* object) noexcept {
+  switch (object->heapObjectType) {
+    case HeapObjectType::String: {
+      break;
+    }
+    case HeapObjectType::Function: {
+      for (auto& upvalue : static_cast<runtime::Function*>(object)->captures) {
+        this->ForwardReference(upvalue);
+      }
+      break;
+    }
+    case HeapObjectType::Object: {
+      auto obj = static_cast<runtime::Object*>(object);
+
+      for (auto& slot : obj->slots) {
+        this->ForwardVariable(slot);
+      }
+
+      for (auto& property : obj->properties) {
+        this->ForwardReference(property.first.str);
+        this->ForwardVariable(property.second);
+      }
+
+      for (auto& element : obj->elements) {
+        this->ForwardVariable(element);
+      }
+      break;
+    }
+    case HeapObjectType::Upvalue: {
+      auto upvalue = static_cast<runtime::Upvalue*>(object);
+      // open upvalues point into the stack, which is already a root
+      if (upvalue->location == &upvalue->closed) {
+        this->ForwardVariable(upvalue->closed);
+      }
+      this->ForwardReference(upvalue->nextOpen);
+      break;
+    }
+    case HeapObjectType::Integer: {
+      break;
+    }
+    case HeapObjectType::Rope: {
+      this->ForwardReference(static_cast<runtime::Rope*>(object)->left);
+      this->ForwardReference(static_cast<runtime::Rope*>(object)->right);
+      break;
+    }
+    case HeapObjectType::Array: {
+      for (auto& element : static_cast<runtime::Array*>(object)->elements) {
+        this->ForwardVariable(element);
+      }
+      break;
+    }
+  }
+}
+
+void runtime::Heap::minorCollection() noexcept {
+  // Every young object reachable from the roots or from a remembered old
+  // object is copied into the old generation, the rest of the nursery is
+  // dropped without being looked at.
+  this->vm->forwardRoots();
+
+  for (auto object : this->rememberedObjects) {
+    object->isRemembered = false;
+    this->forwardReferences(object);
+  }
+  this->rememberedObjects.clear();
+
+  while (!this->promotedObjects.empty()) {
+    HeapObject* object = this->promotedObjects.back();
+    this->promotedObjects.pop_back();
+    this->forwardReferences(object);
+  }
+
+  this->releaseNursery();
 }
 
-std::string* runtime::Heap::NewString() noexcept {
-  auto ret = new std::string{""};
-  this->createdStrings.push_back(ret);
+void runtime::Heap::majorCollection() noexcept {
+  this->vm->markRoots();
+  this->traceReferences();
+  this->sweep();
+}
+
+void runtime::Heap::releaseNursery() noexcept {
+  for (const auto& overflow : this->nurseryOverflow) {
+    std::pmr::new_delete_resource()->deallocate(overflow.memory, overflow.bytes, overflow.alignment);
+  }
+  this->nurseryOverflow.clear();
+
+  this->nurseryTop = this->nursery.get();
+  this->isNurseryExhausted = false;
+}
+
+void* runtime::Heap::allocateYoung(std::size_t bytes, std::size_t alignment) noexcept {
+  void* ret = this->nurseryTop;
+  std::size_t space = static_cast<std::size_t>(this->nurseryEnd - this->nurseryTop);
+
+  if (!std::align(alignment, bytes, ret, space)) {
+    this->isNurseryExhausted = true;
+    return nullptr;
+  }
+
+  this->nurseryTop = static_cast<char*>(ret) + bytes;
   return ret;
 }
 
-runtime::Function* runtime::Heap::NewFunction() noexcept {
-  auto ret = new runtime::Function{};
-  this->createdFunctions.push_back(ret);
+void runtime::Heap::linkOldObject(runtime::HeapObject* object, runtime::HeapObjectType type) noexcept {
+  object->heapObjectType = type;
+  object->isMarked = false;
+  object->isYoung = false;
+  object->isRemembered = false;
+  object->nextObject = this->objects;
+  this->objects = object;
+  this->objectCount++;
+}
+
+void runtime::Heap::traceReferences() noexcept {
+  while (!this->grayObjects.empty()) {
+    HeapObject* object = this->grayObjects.back();
+    this->grayObjects.pop_back();
+
+    switch (object->heapObjectType) {
+      case HeapObjectType::String: {
+        break;
+      }
+      case HeapObjectType::Function: {
+        for (auto upvalue : static_cast<runtime::Function*>(object)->captures) {
+          this->MarkObject(upvalue);
+        }
+        break;
+      }
+      case HeapObjectType::Object: {
+        for (auto slot : static_cast<runtime::Object*>(object)->slots) {
+          this->MarkVariable(slot);
+        }
+        for (const auto& property : static_cast<runtime::Object*>(object)->properties) {
+          this->MarkObject(property.first.str);
+          this->MarkVariable(property.second);
+        }
+        for (auto element : static_cast<runtime::Object*>(object)->elements) {
+          this->MarkVariable(element);
+        }
+        break;
+      }
+      case HeapObjectType::Upvalue: {
+        // open upvalues point into the stack, which is already a root
+        this->MarkVariable(*static_cast<runtime::Upvalue*>(object)->location);
+        break;
+      }
+      case HeapObjectType::Integer: {
+        break;
+      }
+      case HeapObjectType::Rope: {
+        this->MarkObject(static_cast<runtime::Rope*>(object)->left);
+        this->MarkObject(static_cast<runtime::Rope*>(object)->right);
+        break;
+      }
+      case HeapObjectType::Array: {
+        for (auto element : static_cast<runtime::Array*>(object)->elements) {
+          this->MarkVariable(element);
+        }
+        break;
+      }
+    }
+  }
+}
+
+void runtime::Heap::sweep() noexcept {
+  HeapObject** link = &this->objects;
+
+  while (*link != nullptr) {
+    HeapObject* object = *link;
+
+    if (object->isMarked) {
+      object->isMarked = false;
+      link = &object->nextObject;
+
+    } else {
+      *link = object->nextObject;
+      this->freeObject(object);
+      this->objectCount--;
+    }
+  }
+}
+
+void runtime::Heap::freeObject(runtime::HeapObject* object) noexcept {
+  switch (object->heapObjectType) {
+    case HeapObjectType::String: {
+      auto str = static_cast<runtime::String*>(object);
+      if (str->isInterned) {
+        this->vm->forgetInterned(str);
+      }
+      delete str;
+      break;
+    }
+    case HeapObjectType::Function: {
+      delete static_cast<runtime::Function*>(object);
+      break;
+    }
+    case HeapObjectType::Object: {
+      delete static_cast<runtime::Object*>(object);
+      break;
+    }
+    case HeapObjectType::Upvalue: {
+      delete static_cast<runtime::Upvalue*>(object);
+      break;
+    }
+    case HeapObjectType::Integer: {
+      delete static_cast<runtime::BoxedInteger*>(object);
+      break;
+    }
+    case HeapObjectType::Rope: {
+      auto rope = static_cast<runtime::Rope*>(object);
+      if (rope->isInterned) {
+        this->vm->forgetInterned(rope);
+      }
+      delete rope;
+      break;
+    }
+    case HeapObjectType::Array: {
+      delete static_cast<runtime::Array*>(object);
+      break;
+    }
+  }
+}
+
+template<typename T>
+T* runtime::Heap::allocateOld(HeapObjectType type) noexcept {
+  T* ret = new T{std::pmr::new_delete_resource()};
+  this->linkOldObject(ret, type);
   return ret;
 }
 
-runtime::Object* runtime::Heap::NewObject() noexcept {
-  auto ret = new runtime::Object{};
-  this->createdObjects.push_back(ret);
+template<typename T>
+T* runtime::Heap::allocate(HeapObjectType type) noexcept {
+  void* memory = this->allocateYoung(sizeof(T), alignof(T));
+
+  if (memory == nullptr) {
+    // the nursery is full until the next collection, tenure straight away.
+    // The new object is about to be filled in with young references, so it
+    // is remembered up front rather than at every store.
+    T* ret = this->allocateOld<T>(type);
+    ret->isRemembered = true;
+    this->rememberedObjects.push_back(ret);
+    return ret;
+  }
+
+  T* ret = new (memory) T{&this->nurseryResource};
+  ret->heapObjectType = type;
+  ret->isMarked = false;
+  ret->isYoung = true;
+  ret->isRemembered = false;
+  ret->nextObject = nullptr;
   return ret;
 }
 
-}
\ No newline at end of file
+runtime::String* runtime::Heap::NewString() noexcept {
+  return this->allocate<runtime::String>(HeapObjectType::String);
+}
+
+runtime::String* runtime::Heap::NewOldString() noexcept {
+  return this->allocateOld<runtime::String>(HeapObjectType::String);
+}
+
+runtime::Function* runtime::Heap::NewFunction() noexcept {
+  return this->allocate<runtime::Function>(HeapObjectType::Function);
+}
+
+runtime::Object* runtime::Heap::NewObject() noexcept {
+  return this->allocate<runtime::Object>(HeapObjectType::Object);
+}
+
+runtime::Array* runtime::Heap::NewArray() noexcept {
+  return this->allocate<runtime::Array>(HeapObjectType::Array);
+}
+
+runtime::Upvalue* runtime::Heap::NewUpvalue() noexcept {
+  return this->allocate<runtime::Upvalue>(HeapObjectType::Upvalue);
+}
+
+runtime::Rope* runtime::Heap::NewRope() noexcept {
+  return this->allocate<runtime::Rope>(HeapObjectType::Rope);
+}
+
+runtime::BoxedInteger* runtime::Heap::NewBoxedInteger() noexcept {
+  return this->allocate<runtime::BoxedInteger>(HeapObjectType::Integer);
+}
+
+}
+
+// The vm's side of flang.h, emitted code passes the vm as a flang_vm.
+
+extern "C" void flang_enter(flang_vm* handle, flang_frame* frame) {
+  auto vm = reinterpret_cast<runtime::VirtualMachine*>(handle);
+
+#if FLANG_NAN_BOXING
+  static_assert(sizeof(runtime::Variable) == sizeof(flang_value), "a Variable is its bits");
+
+  frame->locals = reinterpret_cast<flang_value*>(vm->stackFrame->locals);
+  frame->stack = reinterpret_cast<flang_value*>(vm->stackFrame->opStackBase);
+#else
+  static_cast<void>(vm);
+  frame->locals = nullptr;
+  frame->stack = nullptr;
+#endif
+}
+
+extern "C" std::size_t flang_call(flang_vm* handle, flang_frame* frame, std::size_t programCounter, std::size_t depth) {
+  auto vm = reinterpret_cast<runtime::VirtualMachine*>(handle);
+
+  vm->stackFrame->programCounter = programCounter;
+  vm->stackTop = vm->stackFrame->opStackBase + depth;
+
+  // the vm may have quickened the instruction since the code was emitted
+  programCounter = vm->nativeHelpers[static_cast<std::size_t>(vm->fetchInstruction())](vm);
+
+  flang_enter(handle, frame);
+  return programCounter;
+}
+
+extern "C" void flang_leave(flang_vm* handle, std::size_t programCounter, std::size_t depth) {
+  auto vm = reinterpret_cast<runtime::VirtualMachine*>(handle);
+
+  vm->stackFrame->programCounter = programCounter;
+  vm->stackTop = vm->stackFrame->opStackBase + depth;
+}
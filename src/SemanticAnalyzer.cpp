@@ -104,6 +104,9 @@ public:
   std::ostream & out;
   const std::shared_ptr<const Readable> reader;
   const std::unordered_map<std::string, std::size_t> builtInFunctionArgumentCounts;
+  // built in functions which are not keywords, a variable of the same name
+  // shadows them
+  const std::unordered_map<std::string, std::size_t> unreservedBuiltInFunctionArgumentCounts;
 
   // these are modified to check semantic corectness
   bool error;
@@ -141,6 +144,9 @@ public:
     {"charAt", 2},
     {"append", 2}
   }}
+  , unreservedBuiltInFunctionArgumentCounts{{
+    {"push", 2}
+  }}
   , error{false}
   , functionDept{0}
   , inLoop{false}
@@ -221,9 +227,18 @@ public:
 
   // validate that identifier is defined
   void onEnterFunctionInvocationExpressionAstNode(FunctionInvocationExpressionAstNode*  node) noexcept override {
-    if (!this->currentScope->find(node->identifier->value, true)) {
+    if (this->currentScope->find(node->identifier->value, true)) {
+      return;
+    }
+
+    auto builtIn = this->unreservedBuiltInFunctionArgumentCounts.find(node->identifier->value);
+
+    if (builtIn == this->unreservedBuiltInFunctionArgumentCounts.end()) {
       this->reportError(node->identifier, "Undefined reference in function invocation.");
+      return;
     }
+
+    this->checkArgumentCount(node->identifier, builtIn->second, node->expressions.size());
   }
 
   // increase scope, define arguments
@@ -288,10 +303,12 @@ public:
       find != this->builtInFunctionArgumentCounts.end(),
       "onEnterBuiltInFunctionInvocationExpressionAstNode found a built in function it does not know about");
 
-    std::size_t count = find->second;
+    this->checkArgumentCount(fn->identifier, find->second, fn->expressions.size());
+  }
 
-    if (count != fn->expressions.size()) {
-      this->reportError(fn->identifier,
+  void checkArgumentCount(const std::shared_ptr<Token>& identifier, std::size_t count, std::size_t given) noexcept {
+    if (count != given) {
+      this->reportError(identifier,
         "Argument size for built in function did not match expected count of " + std::to_string(count));
     }
   }
@@ -0,0 +1,229 @@
+#include "Verifier.hpp"
+
+using bytecode::ByteCodeInstruction;
+
+std::optional<std::string> verifier::checkInstruction(
+  const bytecode::CompiledFile& file,
+  const bytecode::Function& fn,
+  bool isEntrypoint,
+  std::size_t programCounter,
+  std::size_t depth
+) noexcept {
+
+  if (programCounter >= fn.byteCode.size()) {
+    return "Program counter overran bytecode";
+  }
+
+  bytecode::ByteCode bc = fn.byteCode[programCounter];
+
+  switch (bc.instruction) {
+    case ByteCodeInstruction::Jump:
+    case ByteCodeInstruction::JumpIfFalse: {
+      if (bc.parameter >= fn.byteCode.size()) {
+        return "Jump target out of bounds";
+      }
+      break;
+    }
+    case ByteCodeInstruction::LoadIntegerConstant: {
+      if (bc.parameter >= file.intConstants.size()) {
+        return "Index out of bounds in LoadIntegerConstant";
+      }
+      break;
+    }
+    case ByteCodeInstruction::LoadFloatConstant: {
+      if (bc.parameter >= file.floatConstants.size()) {
+        return "Index out of bounds in LoadFloatConstant";
+      }
+      break;
+    }
+    case ByteCodeInstruction::LoadStringConstant: {
+      if (bc.parameter >= file.stringConstants.size()) {
+        return "Index out of bounds in LoadStringConstant";
+      }
+      break;
+    }
+    case ByteCodeInstruction::LoadLocal:
+    case ByteCodeInstruction::SetLocal: {
+      if (bc.parameter >= fn.localsCount) {
+        return "Index out of bounds for locals";
+      }
+      break;
+    }
+    case ByteCodeInstruction::LoadClosure: {
+      if (bc.parameter >= fn.closures.size()) {
+        return "Index out of bounds in LoadClosure";
+      }
+      break;
+    }
+    case ByteCodeInstruction::MakeFn: {
+      if (bc.parameter >= file.functions.size()) {
+        return "Index out of bounds in MakeFn";
+      }
+
+      // the new function captures from the locals and captures of this one
+      for (const auto& closure : file.functions[bc.parameter].closures) {
+        if (closure.index >= (closure.isLocal ? fn.localsCount : fn.closures.size())) {
+          return "Closure index out of bounds in MakeFn";
+        }
+      }
+      break;
+    }
+    case ByteCodeInstruction::MakeObj: {
+      if (bc.parameter >= file.objects.size()) {
+        return "Index out of bounds in MakeObj";
+      }
+      break;
+    }
+    case ByteCodeInstruction::Return: {
+      if (isEntrypoint) {
+        return "Return outside of a function";
+      }
+      break;
+    }
+    case ByteCodeInstruction::AddIntegerToLocal:
+    case ByteCodeInstruction::JumpUnlessLocalLessInteger: {
+      auto operands = bytecode::FusedOperands::Unpack(bc.parameter);
+
+      if (operands.first >= fn.localsCount || operands.second >= file.intConstants.size()) {
+        return "Operand out of bounds in superinstruction";
+      }
+
+      if (bc.instruction == ByteCodeInstruction::JumpUnlessLocalLessInteger && operands.third >= fn.byteCode.size()) {
+        return "Jump target out of bounds";
+      }
+      break;
+    }
+    case ByteCodeInstruction::LoadLocalProperty: {
+      auto operands = bytecode::FusedOperands::Unpack(bc.parameter);
+
+      if (operands.first >= fn.localsCount || operands.second >= file.stringConstants.size()) {
+        return "Operand out of bounds in superinstruction";
+      }
+      break;
+    }
+    case ByteCodeInstruction::TailCall: {
+      if (programCounter + 1 >= fn.byteCode.size() || fn.byteCode[programCounter + 1].instruction != ByteCodeInstruction::Return) {
+        return "TailCall not followed by Return";
+      }
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+
+  if (bytecode::stackEffect(file.objects, bc).pops > depth) {
+    return "Not enough values on the op stack";
+  }
+
+  return std::nullopt;
+}
+
+bool verifier::Verifier::isValid(const bytecode::CompiledFile& file) noexcept {
+  this->error.clear();
+
+  for (std::size_t i = 0; i < file.functions.size(); i++) {
+    if (!this->isValidFunction(file, file.functions[i], false)) {
+      this->error = "Function " + std::to_string(i) + ": " + this->error;
+      return false;
+    }
+  }
+
+  if (!this->isValidFunction(file, file.entrypoint, true)) {
+    this->error = "Entrypoint: " + this->error;
+    return false;
+  }
+
+  return true;
+}
+
+bool verifier::Verifier::isValidFunction(
+  const bytecode::CompiledFile& file,
+  const bytecode::Function& fn,
+  bool isEntrypoint
+) noexcept {
+
+  // the op stack depth on entry to each instruction, once it has been reached
+  std::vector<std::optional<std::size_t>> depths(fn.byteCode.size());
+  std::vector<std::size_t> workList;
+
+  auto reach = [&](std::size_t programCounter, std::size_t depth) {
+    if (programCounter >= fn.byteCode.size()) {
+      this->error = "Instruction " + std::to_string(programCounter) + ": Program counter overran bytecode";
+      return false;
+    }
+
+    auto& known = depths[programCounter];
+
+    if (!known) {
+      known = depth;
+      workList.push_back(programCounter);
+      return true;
+    }
+
+    if (*known != depth) {
+      this->error = "Instruction " + std::to_string(programCounter) + ": Op stack depth differs between paths";
+      return false;
+    }
+
+    return true;
+  };
+
+  if (!reach(0, 0)) {
+    return false;
+  }
+
+  while (!workList.empty()) {
+    std::size_t programCounter = workList.back();
+    workList.pop_back();
+
+    std::size_t depth = *depths[programCounter];
+    auto problem = checkInstruction(file, fn, isEntrypoint, programCounter, depth);
+
+    if (problem) {
+      this->error = "Instruction " + std::to_string(programCounter) + ": " + *problem;
+      return false;
+    }
+
+    bytecode::ByteCode bc = fn.byteCode[programCounter];
+    bytecode::StackEffect effect = bytecode::stackEffect(file.objects, bc);
+    std::size_t nextDepth = depth - effect.pops + effect.pushes;
+
+    if (nextDepth > fn.maxStack) {
+      this->error = "Instruction " + std::to_string(programCounter) + ": Op stack exceeds maxStack";
+      return false;
+    }
+
+    switch (bc.instruction) {
+      case ByteCodeInstruction::Halt:
+      case ByteCodeInstruction::Return: {
+        break;
+      }
+      case ByteCodeInstruction::Jump: {
+        if (!reach(bc.parameter, nextDepth)) {
+          return false;
+        }
+        break;
+      }
+      case ByteCodeInstruction::JumpIfFalse: {
+        if (!reach(bc.parameter, nextDepth) || !reach(programCounter + 1, nextDepth)) {
+          return false;
+        }
+        break;
+      }
+      case ByteCodeInstruction::JumpUnlessLocalLessInteger: {
+        if (!reach(bytecode::FusedOperands::Unpack(bc.parameter).third, nextDepth) || !reach(programCounter + 1, nextDepth)) {
+          return false;
+        }
+        break;
+      }
+      default: {
+        if (!reach(programCounter + 1, nextDepth)) {
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
@@ -5,29 +5,120 @@
 void usage(const std::string & msg) {
   std::cerr
     << "Error: " << msg << '\n'
-    << "Usage: flang <path to source code file>" << std::endl;
+    << "Usage: flang [options] <path to source code file>\n"
+    << "Options:\n"
+    << "  -O0                               run the bytecode as compiled, without peephole optimization\n"
+    << "  -O1                               optimize the bytecode before running it (default)\n"
+    << "  --jit                             compile functions to native code where supported\n"
+    << "  --jit-threshold=<calls>           calls of a function before it is compiled (default 1), 0 turns it off\n"
+    << "  --jit-trace-threshold=<count>     loop iterations before a loop is traced, 0 turns tracing off\n"
+    << "  --profile=<path>                  write the operand types, shapes and callees each instruction saw to path as JSON\n"
+    << "  --emit-c=<path>                   write the script to path as C to build against the flang_runtime library instead of running it\n"
+    << "  --gc-nursery-size=<bytes>         size of the nursery young objects are allocated in\n"
+    << "  --gc-initial-threshold=<objects>  live old objects before the first major collection\n"
+    << "  --gc-growth-factor=<factor>       old generation growth over the survivors before the next major collection\n"
+    << "  --max-stack-frames=<count>        calls nested deeper than this stop the script with a stack overflow"
+    << std::endl;
 
   exit(1);
 }
 
+bool parseOption(const std::string & arg, const std::string & name, std::string & value) {
+  std::string prefix = name + "=";
+
+  if (arg.compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+
+  value = arg.substr(prefix.size());
+  return true;
+}
+
 int main(int argc, char** argv) {
 
-  if (argc != 2) {
+  compiler::CompilerOptions compilerOptions;
+  runtime::GcOptions gcOptions;
+  runtime::StackOptions stackOptions;
+  runtime::JitOptions jitOptions;
+  std::optional<std::string> profilePath;
+  std::optional<std::string> emitPath;
+  std::optional<std::string> filePath;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg{argv[i]};
+    std::string value;
+
+    try {
+      if (arg == "-O0" || arg == "-O1") {
+        compilerOptions.optimizationLevel = arg == "-O0" ? 0 : 1;
+
+      } else if (arg == "--jit") {
+        jitOptions.isEnabled = true;
+
+      } else if (parseOption(arg, "--jit-threshold", value)) {
+        jitOptions.threshold = std::stoull(value);
+
+      } else if (parseOption(arg, "--jit-trace-threshold", value)) {
+        jitOptions.traceThreshold = std::stoull(value);
+
+      } else if (parseOption(arg, "--profile", value)) {
+        profilePath = value;
+
+      } else if (parseOption(arg, "--emit-c", value)) {
+        emitPath = value;
+
+      } else if (parseOption(arg, "--gc-nursery-size", value)) {
+        gcOptions.nurserySize = std::stoull(value);
+
+      } else if (parseOption(arg, "--gc-initial-threshold", value)) {
+        gcOptions.initialThreshold = std::stoull(value);
+
+      } else if (parseOption(arg, "--gc-growth-factor", value)) {
+        gcOptions.growthFactor = std::stod(value);
+
+        if (gcOptions.growthFactor < 1.0) {
+          usage("--gc-growth-factor must be at least 1.");
+        }
+
+      } else if (parseOption(arg, "--max-stack-frames", value)) {
+        stackOptions.maxFrames = std::stoull(value);
+
+        if (stackOptions.maxFrames == 0) {
+          usage("--max-stack-frames must be at least 1.");
+        }
+
+      } else if (arg.compare(0, 1, "-") == 0 || filePath) {
+        usage("Unexpected argument " + arg + ".");
+
+      } else {
+        filePath = arg;
+      }
+
+    } catch (...) {
+      usage("Invalid value for " + arg + ".");
+    }
+  }
+
+  if (!filePath) {
     usage("Unexpected number of arguments.");
     return 1;
   }
 
-  std::string filePath{argv[1]};
-
-  auto contents = io::readFileToString(filePath);
+  auto contents = io::readFileToString(filePath.value());
 
   if (!contents) {
     usage("Could not open file.");
     return 1;
   }
 
-  auto interpreter = std::make_shared<interpreter::Interpreter>(std::cout, std::cin);
+  auto interpreter = std::make_shared<interpreter::Interpreter>(compilerOptions, gcOptions, stackOptions, jitOptions, profilePath, std::cout, std::cin);
+
+  if (emitPath) {
+    interpreter->EmitC(contents.value(), emitPath.value());
+    return 0;
+  }
+
   interpreter->Run(contents.value());
 
   return 0;
-}
\ No newline at end of file
+}
@@ -6,9 +6,12 @@
 #include "TokenBuffer.hpp"
 #include "Parser.hpp"
 #include "SemanticAnalyzer.hpp"
+#include "AstCompiler.hpp"
+#include "InstructionFuser.hpp"
+#include "Verifier.hpp"
 
 enum class FailStep {
-  None, Parsing, SemanticAnalysis,
+  None, Parsing, SemanticAnalysis, Verification,
 };
 
 FailStep failStepFromString(const std::string & str) {
@@ -24,6 +27,10 @@ FailStep failStepFromString(const std::string & str) {
     return FailStep::SemanticAnalysis;
   }
 
+  if (str == "verification") {
+    return FailStep::Verification;
+  }
+
   throw std::runtime_error("Unknown fail step provided");
 }
 
@@ -48,6 +55,20 @@ FailStep run(const std::string & str) {
     return FailStep::SemanticAnalysis;
   }
 
+  // both with and without the peephole optimizer
+  for (std::size_t optimizationLevel = 0; optimizationLevel <= 1; optimizationLevel++) {
+    auto compiler = std::make_shared<compiler::AstCompiler>(compiler::CompilerOptions{optimizationLevel});
+    compiler::InstructionFuser fuser;
+    auto compiledFile = fuser.fuse(*compiler->compile(script.value()));
+
+    verifier::Verifier verifier;
+
+    if (!verifier.isValid(*compiledFile)) {
+      std::cerr << "Failure during bytecode verification at -O" << optimizationLevel << "! " << verifier.error << std::endl;
+      return FailStep::Verification;
+    }
+  }
+
   std::cout << "No Failure!" << std::endl;
 
   return FailStep::None;
@@ -0,0 +1,90 @@
+# Runs a script from data/test/full with the interpreter, the baseline
+# compiler, the trace compiler, a collector with tiny generations and as C
+# emitted by --emit-c, and checks that all of them print the same. The interpreter's output is checked against the
+# script's .out file when it has one, and a .in file is its standard input.
+#
+#   cmake -DFLANG=<flang> -DSCRIPT=<script.f> -DWORK_DIR=<dir>
+#         -DC_COMPILER=<cc> -DCXX_COMPILER=<c++> -DLINK_FLAGS=<flags>
+#         -DINCLUDE_DIR=<include> -DRUNTIME=<libflang_runtime> -P full_tester.cmake
+
+get_filename_component(directory ${SCRIPT} DIRECTORY)
+get_filename_component(name ${SCRIPT} NAME_WE)
+
+file(MAKE_DIRECTORY ${WORK_DIR})
+
+set(input ${directory}/${name}.in)
+if(NOT EXISTS ${input})
+  set(input ${WORK_DIR}/${name}.in)
+  file(WRITE ${input} "")
+endif()
+
+# sets <prefix>_output and <prefix>_result to what command printed and
+# exited with
+function(run prefix)
+  execute_process(
+    COMMAND ${ARGN}
+    INPUT_FILE ${input}
+    OUTPUT_VARIABLE output
+    ERROR_VARIABLE output
+    RESULT_VARIABLE result)
+  set(${prefix}_output "${output}" PARENT_SCOPE)
+  set(${prefix}_result "${result}" PARENT_SCOPE)
+endfunction()
+
+run(interpreter ${FLANG} ${SCRIPT})
+
+if(NOT interpreter_result EQUAL 0)
+  message(FATAL_ERROR "${SCRIPT} exited with ${interpreter_result}\n${interpreter_output}")
+endif()
+
+set(expected ${directory}/${name}.out)
+if(EXISTS ${expected})
+  file(READ ${expected} expected_output)
+
+  if(NOT interpreter_output STREQUAL expected_output)
+    message(FATAL_ERROR "${SCRIPT} printed\n${interpreter_output}\nbut expected\n${expected_output}")
+  endif()
+endif()
+
+# checks that the run under prefix behaved like the interpreter
+function(compare prefix)
+  if(NOT "${${prefix}_result}" STREQUAL "${interpreter_result}" OR NOT "${${prefix}_output}" STREQUAL "${interpreter_output}")
+    message(FATAL_ERROR "${SCRIPT} with the ${prefix} exited with ${${prefix}_result} after printing\n"
+      "${${prefix}_output}\nbut the interpreter printed\n${interpreter_output}")
+  endif()
+endfunction()
+
+run(baseline ${FLANG} --jit --jit-threshold=1 --jit-trace-threshold=0 ${SCRIPT})
+compare(baseline)
+
+run(tracing ${FLANG} --jit --jit-trace-threshold=1 ${SCRIPT})
+compare(tracing)
+
+# collects at nearly every call and back edge, so that objects the
+# collector moves or frees too early show up
+run(gc ${FLANG} --gc-nursery-size=1024 --gc-initial-threshold=1 --gc-growth-factor=1 ${SCRIPT})
+compare(gc)
+
+# the emitted C is built like the flang_runtime library's users would
+set(source ${WORK_DIR}/${name}.c)
+set(object ${WORK_DIR}/${name}.o)
+set(program ${WORK_DIR}/${name})
+separate_arguments(link_flags UNIX_COMMAND "${LINK_FLAGS}")
+
+foreach(step
+    "${FLANG};--emit-c=${source};${SCRIPT}"
+    "${C_COMPILER};-std=c99;-I${INCLUDE_DIR};-c;${source};-o;${object}"
+    "${CXX_COMPILER};${link_flags};${object};${RUNTIME};-o;${program}")
+  execute_process(
+    COMMAND ${step}
+    OUTPUT_VARIABLE output
+    ERROR_VARIABLE output
+    RESULT_VARIABLE result)
+
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${step} failed with ${result}\n${output}")
+  endif()
+endforeach()
+
+run(emitted_c ${program})
+compare(emitted_c)
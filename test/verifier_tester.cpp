@@ -0,0 +1,189 @@
+#include "lib.hpp"
+
+#include "ByteCode.hpp"
+#include "Verifier.hpp"
+
+using bytecode::ByteCode;
+using bytecode::ByteCodeInstruction;
+using bytecode::ClosureContext;
+using bytecode::CompiledFile;
+using bytecode::Function;
+
+// Hand built bytecode the compiler never emits, the vm's dispatch relies on
+// the verifier rejecting all of it.
+
+struct VerifierTest {
+  std::string name;
+  std::shared_ptr<CompiledFile> file;
+  // what Verifier::error holds afterwards, empty when the file is valid
+  std::string error;
+};
+
+static std::shared_ptr<CompiledFile> fileOf(Function entrypoint, std::vector<Function> functions = {}, std::vector<std::int64_t> intConstants = {}) {
+  return std::make_shared<CompiledFile>(
+    std::move(entrypoint),
+    std::move(functions),
+    std::vector<bytecode::ObjectConstructor>{},
+    std::move(intConstants),
+    std::vector<double>{},
+    std::vector<std::string>{}
+  );
+}
+
+static Function functionOf(std::size_t localsCount, std::size_t maxStack, std::vector<ByteCode> byteCode, std::vector<ClosureContext> closures = {}) {
+  return Function{0, localsCount, maxStack, std::move(closures), std::move(byteCode)};
+}
+
+static std::vector<VerifierTest> tests() {
+  std::vector<VerifierTest> ret;
+
+  ret.push_back(VerifierTest{
+    "valid",
+    fileOf(functionOf(1, 1, {
+      ByteCode{ByteCodeInstruction::LoadIntegerConstant, 0},
+      ByteCode{ByteCodeInstruction::SetLocal, 0},
+      ByteCode{ByteCodeInstruction::LoadBooleanTrueConstant, 0},
+      ByteCode{ByteCodeInstruction::JumpIfFalse, 5},
+      ByteCode{ByteCodeInstruction::Jump, 0},
+      ByteCode{ByteCodeInstruction::Halt, 0},
+    }), {}, {1}),
+    ""
+  });
+
+  ret.push_back(VerifierTest{
+    "jump out of range",
+    fileOf(functionOf(0, 0, {
+      ByteCode{ByteCodeInstruction::Jump, 5},
+      ByteCode{ByteCodeInstruction::Halt, 0},
+    })),
+    "Entrypoint: Instruction 0: Jump target out of bounds"
+  });
+
+  ret.push_back(VerifierTest{
+    "running off the end",
+    fileOf(functionOf(0, 0, {
+      ByteCode{ByteCodeInstruction::NoOp, 0},
+    })),
+    "Entrypoint: Instruction 1: Program counter overran bytecode"
+  });
+
+  // the value pushed on one path is missing on the other
+  ret.push_back(VerifierTest{
+    "depths differ at a join",
+    fileOf(functionOf(0, 1, {
+      ByteCode{ByteCodeInstruction::LoadBooleanTrueConstant, 0},
+      ByteCode{ByteCodeInstruction::JumpIfFalse, 3},
+      ByteCode{ByteCodeInstruction::LoadIntegerConstant, 0},
+      ByteCode{ByteCodeInstruction::Halt, 0},
+    }), {}, {1}),
+    "Entrypoint: Instruction 3: Op stack depth differs between paths"
+  });
+
+  ret.push_back(VerifierTest{
+    "more than maxStack",
+    fileOf(functionOf(0, 1, {
+      ByteCode{ByteCodeInstruction::LoadIntegerConstant, 0},
+      ByteCode{ByteCodeInstruction::LoadIntegerConstant, 0},
+      ByteCode{ByteCodeInstruction::Halt, 0},
+    }), {}, {1}),
+    "Entrypoint: Instruction 1: Op stack exceeds maxStack"
+  });
+
+  ret.push_back(VerifierTest{
+    "popping an empty op stack",
+    fileOf(functionOf(0, 0, {
+      ByteCode{ByteCodeInstruction::Pop, 0},
+      ByteCode{ByteCodeInstruction::Halt, 0},
+    })),
+    "Entrypoint: Instruction 0: Not enough values on the op stack"
+  });
+
+  ret.push_back(VerifierTest{
+    "constant out of range",
+    fileOf(functionOf(0, 1, {
+      ByteCode{ByteCodeInstruction::LoadIntegerConstant, 1},
+      ByteCode{ByteCodeInstruction::Halt, 0},
+    }), {}, {1}),
+    "Entrypoint: Instruction 0: Index out of bounds in LoadIntegerConstant"
+  });
+
+  ret.push_back(VerifierTest{
+    "local out of range",
+    fileOf(functionOf(1, 1, {
+      ByteCode{ByteCodeInstruction::LoadLocal, 1},
+      ByteCode{ByteCodeInstruction::Halt, 0},
+    })),
+    "Entrypoint: Instruction 0: Index out of bounds for locals"
+  });
+
+  ret.push_back(VerifierTest{
+    "return from the entrypoint",
+    fileOf(functionOf(0, 1, {
+      ByteCode{ByteCodeInstruction::LoadUndefinedConstant, 0},
+      ByteCode{ByteCodeInstruction::Return, 0},
+    })),
+    "Entrypoint: Instruction 1: Return outside of a function"
+  });
+
+  ret.push_back(VerifierTest{
+    "TailCall without Return",
+    fileOf(functionOf(0, 0, {ByteCode{ByteCodeInstruction::Halt, 0}}), {
+      functionOf(1, 1, {
+        ByteCode{ByteCodeInstruction::LoadLocal, 0},
+        ByteCode{ByteCodeInstruction::TailCall, 0},
+        ByteCode{ByteCodeInstruction::Halt, 0},
+      }),
+    }),
+    "Function 0: Instruction 1: TailCall not followed by Return"
+  });
+
+  // the function captures a local its creator does not have
+  ret.push_back(VerifierTest{
+    "MakeFn closure out of range",
+    fileOf(functionOf(1, 1, {
+      ByteCode{ByteCodeInstruction::MakeFn, 0},
+      ByteCode{ByteCodeInstruction::Pop, 0},
+      ByteCode{ByteCodeInstruction::Halt, 0},
+    }), {
+      functionOf(0, 1, {
+        ByteCode{ByteCodeInstruction::LoadUndefinedConstant, 0},
+        ByteCode{ByteCodeInstruction::Return, 0},
+      }, {ClosureContext{true, 3}}),
+    }),
+    "Entrypoint: Instruction 0: Closure index out of bounds in MakeFn"
+  });
+
+  ret.push_back(VerifierTest{
+    "fused jump out of range",
+    fileOf(functionOf(1, 0, {
+      ByteCode{ByteCodeInstruction::JumpUnlessLocalLessInteger, bytecode::FusedOperands{0, 0, 7}.pack()},
+      ByteCode{ByteCodeInstruction::Halt, 0},
+    }), {}, {1}),
+    "Entrypoint: Instruction 0: Jump target out of bounds"
+  });
+
+  return ret;
+}
+
+int main() {
+  int failures = 0;
+
+  for (const auto& test : tests()) {
+    verifier::Verifier verifier;
+    bool isValid = verifier.isValid(*test.file);
+
+    if (isValid != test.error.empty() || verifier.error != test.error) {
+      std::cerr << "Verifier test '" << test.name << "' failed, expected '" << test.error
+        << "' but got '" << verifier.error << "'" << std::endl;
+      failures++;
+    }
+  }
+
+  if (failures > 0) {
+    return 1;
+  }
+
+  std::cout << "No Failure!" << std::endl;
+
+  return 0;
+}